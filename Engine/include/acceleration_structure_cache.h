@@ -0,0 +1,35 @@
+#pragma once
+#include <mesh.h>
+
+#include <vulkan/vulkan.hpp>
+#include <unordered_set>
+#include <string>
+#include <vector>
+
+namespace core {
+
+	// Header the driver writes at the start of every serialized acceleration structure.
+	struct SerializedAccelerationStructureHeader {
+		uint8_t driverUUID[VK_UUID_SIZE];
+		uint8_t compatibilityUUID[VK_UUID_SIZE];
+		uint64_t serializedSize;   // Size of the whole serialized data, header included.
+		uint64_t deserializedSize; // Size the acceleration structure needs once deserialized.
+		uint64_t handleCount;      // Bottom level handles referenced by a serialized TLAS.
+	};
+
+	// Serialized BLASes stored next to the mesh files, keyed by the mesh's content hash and the driver's UUID.
+	// Deformable meshes are never cached, their BLASes are refit from vertices only known at runtime.
+	class AccelerationStructureCache {
+	public:
+		// Deserializes the BLASes of every cached mesh, returns the meshes whose BLASes still have to be built.
+		static std::unordered_set<Mesh*> load(const std::unordered_set<Mesh*>& meshes);
+		// Serializes the built BLASes of the meshes, files already in the cache are rewritten.
+		static void store(const std::unordered_set<Mesh*>& meshes);
+
+	private:
+		static std::string getFilepath(Mesh* mesh);
+		static bool readFile(Mesh* mesh, std::vector<std::vector<uint8_t>>& blobs);
+		static void writeFile(Mesh* mesh, const std::vector<const uint8_t*>& blobs, const std::vector<VkDeviceSize>& sizes);
+
+	};
+}
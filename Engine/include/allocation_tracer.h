@@ -0,0 +1,95 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+// Allocation tracing is compiled into debug builds only.
+#if(_DEBUG)
+	#define ALLOCATION_TRACING_ENABLED 1
+#else
+	#define ALLOCATION_TRACING_ENABLED 0
+#endif
+
+// Tags every allocation made until the end of the enclosing scope.
+#if(ALLOCATION_TRACING_ENABLED)
+	#define ALLOCATION_TAG(tag) core::ScopedAllocationTag allocationTag(tag)
+#else
+	#define ALLOCATION_TAG(tag) ((void)0)
+#endif
+
+namespace core {
+
+	typedef enum AllocationEventType {
+		ALLOCATION_EVENT_CREATE,
+		ALLOCATION_EVENT_DESTROY
+	} AllocationEventType;
+
+	typedef enum AllocationResourceType {
+		ALLOCATION_RESOURCE_BUFFER,
+		ALLOCATION_RESOURCE_IMAGE,
+		ALLOCATION_RESOURCE_MEMORY // Raw memory shared by aliased resources.
+	} AllocationResourceType;
+
+	struct AllocationEvent {
+		AllocationEventType type;
+		AllocationResourceType resourceType;
+		uint64_t id;          // VmaAllocation handle of the allocation.
+		VkDeviceSize size;
+		uint32_t usage;       // Buffer or image usage flags.
+		uint32_t category;    // AllocationCategory of the allocation.
+		const char* tag;      // Call-site tag, must point to a string literal.
+		uint64_t frame;
+		uint64_t timestamp;   // Nanoseconds since the tracer started.
+	};
+
+	// Number of events the ring holds between two collections, must be a power of two.
+	const uint64_t ALLOCATION_TRACE_RING_SIZE = 4096;
+	// Maximum number of events kept for the timeline export.
+	const size_t ALLOCATION_TRACE_TIMELINE_SIZE = 1024 * 1024;
+
+	// Records allocation events into a lock-free ring, collected once per frame into leak and timeline data.
+	class AllocationTracer {
+	public:
+		// Safe to call from any thread.
+		static void record(AllocationEventType type, AllocationResourceType resourceType, uint64_t id, VkDeviceSize size, uint32_t usage, uint32_t category, uint64_t frame);
+		// Moves recorded events out of the ring, must be called from a single thread.
+		static void collect();
+
+		// Lists every live allocation grouped by call-site tag, at shutdown these are leaks.
+		static std::string getLeakReport();
+		static void printLeakReport();
+		// Writes the allocation timeline in the Chrome trace event format (chrome://tracing, Perfetto).
+		static void exportTimeline(const std::string& filepath);
+
+		static const char* getTag() { return currentTag; }
+		static void setTag(const char* tag) { currentTag = tag; }
+
+	private:
+		struct TraceSlot {
+			std::atomic<uint64_t> sequence{ 0 }; // Index of the event plus one once written, 0 while being written.
+			AllocationEvent event;
+		};
+
+		static TraceSlot ring[ALLOCATION_TRACE_RING_SIZE];
+		static std::atomic<uint64_t> writeIndex;
+		static uint64_t readIndex;
+		static uint64_t droppedEvents;
+		static std::unordered_map<uint64_t, AllocationEvent> liveAllocations;
+		static std::vector<AllocationEvent> timeline;
+		static thread_local const char* currentTag;
+
+	};
+
+	class ScopedAllocationTag {
+	public:
+		ScopedAllocationTag(const char* tag) : previousTag(AllocationTracer::getTag()) { AllocationTracer::setTag(tag); }
+		~ScopedAllocationTag() { AllocationTracer::setTag(previousTag); }
+
+	private:
+		const char* previousTag;
+
+	};
+}
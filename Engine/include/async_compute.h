@@ -0,0 +1,61 @@
+#pragma once
+#include <resource_allocator.h>
+
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <deque>
+#include <functional>
+
+namespace core {
+
+	// Completion token of async compute work, the results are ready once the semaphore reaches value.
+	struct ComputeToken {
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		uint64_t value = 0;
+	};
+
+	struct ComputeRelease {
+		uint64_t timelineValue = 0; // Released once the timeline semaphore reached this value.
+		std::function<void()> release;
+	};
+
+	// Submits acceleration structure builds on a compute-only queue family when the device has one, so they overlap rendering.
+	// Submissions execute in order and signal a timeline semaphore, consumers wait on its value instead of idling a queue.
+	class AsyncCompute {
+	public:
+		static void setup(const VkDevice& device, const VkQueue& queue, const uint32_t queueFamilyIndex);
+		static void cleanup();
+
+		// Returns a recording command buffer, only one can be open at a time.
+		static VkCommandBuffer begin();
+		static ComputeToken submit();
+		static void wait(const ComputeToken& token);
+		static bool isComplete(const ComputeToken& token);
+		// Token of the last submission, graphics submissions using built acceleration structures wait on it.
+		static ComputeToken getLastToken() { return { semaphore, semaphoreValue }; }
+		// Token every graphics submission signals, later async compute submissions wait on it.
+		// Graphics frames refit deformable BLAS in place, which TLAS builds and compactions read.
+		static ComputeToken signalFromGraphics() { return { graphicsSemaphore, ++graphicsSemaphoreValue }; }
+
+		// Runs release once the token's work completed, resources used by a submission must outlive it.
+		static void releaseAfter(const ComputeToken& token, std::function<void()>&& release);
+		// Runs the releases of completed submissions, must be called once per frame.
+		static void update();
+
+		static uint32_t getQueueFamilyIndex() { return queueFamilyIndex; }
+
+	private:
+		static VkDevice device;
+		static VkQueue queue;
+		static uint32_t queueFamilyIndex;
+		static VkCommandPool commandPool;
+		static VkSemaphore semaphore;
+		static uint64_t semaphoreValue;
+		static VkSemaphore graphicsSemaphore;
+		static uint64_t graphicsSemaphoreValue;
+		static std::vector<UploadContext> contexts;
+		static int32_t activeContext;
+		static std::deque<ComputeRelease> releases;
+
+	};
+}
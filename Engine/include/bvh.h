@@ -0,0 +1,357 @@
+#pragma once
+#include <engine_globals.h>
+#include <mesh.h>
+#include <resource_pool.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <stdint.h>
+
+#if defined(ENGINE_SSE2)
+	#include <emmintrin.h>
+	#include <xmmintrin.h>
+#endif
+
+namespace core {
+
+	struct Object;
+
+	struct BoundingBox {
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+
+		void grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+		void grow(const BoundingBox& box) { min = glm::min(min, box.min); max = glm::max(max, box.max); }
+		bool isValid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+		bool overlaps(const BoundingBox& box) const;
+		// Half the surface area, enough for SAH cost comparisons.
+		float getHalfArea() const;
+		BoundingBox transform(const glm::mat4& matrix) const;
+	};
+
+	struct Ray {
+		glm::vec3 origin;
+		glm::vec3 direction; // Need not be normalized, hit distances are in units of its length.
+		float tMin = 0.0f;
+		float tMax = FLT_MAX; // Shrinks to the closest hit found so far.
+	};
+
+	// Four rays traversed together, stored as structure of arrays. Lanes with tMin > tMax are inactive.
+	struct alignas(16) RayPacket {
+		float originX[4], originY[4], originZ[4];
+		float directionX[4], directionY[4], directionZ[4];
+		float tMin[4];
+		float tMax[4];
+
+		void setRay(const uint32_t lane, const Ray& ray);
+		Ray getRay(const uint32_t lane) const;
+	};
+
+	struct RayHit {
+		float t = FLT_MAX;
+		float u = 0.0f, v = 0.0f; // Barycentrics of the hit point.
+		uint32_t submesh = INVALID_HANDLE_INDEX;
+		uint32_t primitive = INVALID_HANDLE_INDEX; // Triangle index within the submesh.
+		Handle<Object> object;
+		bool isValid() const { return primitive != INVALID_HANDLE_INDEX; }
+	};
+
+	// Four-wide node, each slot holds either an inner child or a leaf.
+	struct alignas(16) BVHNode {
+		float minX[4], minY[4], minZ[4];
+		float maxX[4], maxY[4], maxZ[4];
+		uint32_t children[4]; // Node index of inner children, first primitive of leaves, INVALID_HANDLE_INDEX for empty slots.
+		uint32_t counts[4];   // Primitive count of leaves, 0 for inner children.
+	};
+
+	struct BVHBuildContext;
+
+	// Binned SAH bounding volume hierarchy over arbitrary primitive bounds, traversed four children at a time.
+	// Nodes are stored depth-first, children always follow their parent.
+	class BVH {
+	public:
+		// Large subtrees are built on separate threads, a thread count of 0 uses every hardware thread.
+		void build(const std::vector<BoundingBox>& bounds, uint32_t threadCount = 0);
+		// Updates the node bounds for moved primitives, keeping the topology.
+		void refit(const std::vector<BoundingBox>& bounds);
+		// Same as above, only walking the nodes above the given primitives.
+		void refit(const std::vector<BoundingBox>& bounds, const std::vector<uint32_t>& primitives);
+
+		// Visits primitives whose leaves the ray enters, nearest first. The intersector has the signature
+		// bool(uint32_t primitive, Ray& ray), shrinks ray.tMax on hits and returns true to stop the traversal.
+		template<typename Intersector>
+		void traverse(Ray& ray, Intersector&& intersect) const;
+		// Same as above for four rays, the intersector has the signature void(uint32_t primitive, RayPacket& packet, uint32_t laneMask).
+		template<typename Intersector>
+		void traverse(RayPacket& packet, Intersector&& intersect) const;
+		// Visits primitives whose leaves overlap the box, the visitor has the signature void(uint32_t primitive).
+		template<typename Visitor>
+		void overlap(const BoundingBox& box, Visitor&& visit) const;
+
+		BoundingBox getBounds() const { return nodes.empty() ? BoundingBox() : getNodeBounds(nodes[0]); }
+		bool empty() const { return nodes.empty(); }
+
+	private:
+		std::vector<BVHNode> nodes;
+		std::vector<uint32_t> primitiveIndices; // Primitives in leaf order, leaves index ranges of this array.
+		std::vector<uint32_t> parents;          // Parent of each node, INVALID_HANDLE_INDEX for the root.
+		std::vector<uint32_t> primitiveNodes;   // Node holding the leaf of each primitive.
+
+		static BoundingBox getNodeBounds(const BVHNode& node);
+		void refitNode(BVHNode& node, const std::vector<BoundingBox>& bounds) const;
+		static void setSlot(BVHNode& node, const uint32_t slot, const BoundingBox& box);
+		static uint32_t buildNode(BVHBuildContext& context, std::vector<BVHNode>& out, const uint32_t begin, const uint32_t end, const uint32_t depth);
+		static uint32_t split(BVHBuildContext& context, const uint32_t begin, const uint32_t end, const uint32_t depth);
+
+		static uint32_t intersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDirection, const float tMin, const float tMax, float tNear[4]);
+		static uint32_t intersectSlot(const BVHNode& node, const uint32_t slot, const RayPacket& packet, const float invDirection[3][4], const uint32_t laneMask);
+
+	};
+
+	// Triangle BVH of a mesh, covering every submesh.
+	class MeshBVH {
+	public:
+		MeshBVH(const Vertex* vertices, const uint32_t submeshCount, uint32_t** indicesList, const uint32_t* indexCountList);
+
+		// Deformable meshes refit their BVH with every vertex update.
+		void refit(const Vertex* vertices);
+
+		// Closest hit, returns true and shrinks ray.tMax when the hit is closer than the ray's tMax.
+		bool intersect(Ray& ray, RayHit& hit) const;
+		bool occluded(const Ray& ray) const;
+		// Returns the lanes whose hit was updated.
+		uint32_t intersect(RayPacket& packet, RayHit hits[4]) const;
+
+		BoundingBox getBounds() const { return bvh.getBounds(); }
+
+	private:
+		// Vertex and edges of each triangle, precomputed for the intersection test.
+		struct Triangle {
+			glm::vec3 v0, e1, e2;
+		};
+
+		BVH bvh;
+		std::vector<Triangle> triangles;
+		std::vector<uint32_t> indices;       // Three vertex indices per triangle, kept for refits.
+		std::vector<uint32_t> submeshFirsts; // First triangle of each submesh.
+
+		void setTriangles(const Vertex* vertices, std::vector<BoundingBox>& bounds);
+		void getTriangleId(const uint32_t triangle, RayHit& hit) const;
+
+	};
+
+	// Object level BVH of a scene for CPU ray and overlap queries (picking, line of sight, collision broad phase).
+	// Only objects whose mesh was created while queries were enabled take part.
+	class SceneBVH {
+	public:
+		// Meshes build their triangle BVH on creation while enabled.
+		static void setEnabled(const bool enabled) { SceneBVH::enabled = enabled; }
+		static bool isEnabled() { return enabled; }
+
+		void build(ResourcePool<Object>& objects, uint32_t threadCount = 0);
+		// Follows the new transforms of moved objects, and the bounds of deformed meshes, without rebuilding.
+		void refit(ResourcePool<Object>& objects, const std::vector<Handle<Object>>& moved);
+
+		bool intersect(Ray& ray, RayHit& hit) const;
+		bool occluded(const Ray& ray) const;
+		uint32_t intersect(RayPacket& packet, RayHit hits[4]) const;
+		void overlap(const BoundingBox& box, std::vector<Handle<Object>>& objects) const;
+
+	private:
+		struct Instance {
+			Handle<Object> object;
+			const MeshBVH* bvh;
+			glm::mat4 worldToObject;
+		};
+
+		static bool enabled;
+		BVH bvh;
+		std::vector<Instance> instances;
+		std::vector<BoundingBox> bounds;        // World space bounds of each instance.
+		std::vector<uint32_t> objectInstances;  // Instance of each object slot, indexed by handle index.
+
+		static Ray toObjectSpace(const Ray& ray, const glm::mat4& worldToObject);
+
+	};
+
+	//***************************************************************************************//
+	//                                   Traversal Kernels                                   //
+	//***************************************************************************************//
+
+	// Deepest possible traversal stack, the builder bounds the tree depth so it never overflows.
+	const uint32_t BVH_STACK_SIZE = 256;
+
+	inline uint32_t BVH::intersectNode(const BVHNode& node, const glm::vec3& origin, const glm::vec3& invDirection, const float tMin, const float tMax, float tNear[4]) {
+#if defined(ENGINE_SSE2)
+		// Slab test of the ray against the four child boxes at once.
+		const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+		const __m128 ix = _mm_set1_ps(invDirection.x), iy = _mm_set1_ps(invDirection.y), iz = _mm_set1_ps(invDirection.z);
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), ox), ix);
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), ox), ix);
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), oy), iy);
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), oy), iy);
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), oz), iz);
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), oz), iz);
+		__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_set1_ps(tMin)));
+		__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+		_mm_storeu_ps(tNear, entry);
+
+		// Empty slots have inverted boxes, which a ray along an axis would still enter.
+		__m128i empty = _mm_cmpeq_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(node.children)), _mm_set1_epi32(-1));
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entry, exit)) & ~_mm_movemask_ps(_mm_castsi128_ps(empty)) & 0xF);
+#else
+		uint32_t mask = 0;
+		for (uint32_t slot = 0; slot < 4; slot++) {
+			if (node.children[slot] == INVALID_HANDLE_INDEX) continue;
+			float t0x = (node.minX[slot] - origin.x) * invDirection.x, t1x = (node.maxX[slot] - origin.x) * invDirection.x;
+			float t0y = (node.minY[slot] - origin.y) * invDirection.y, t1y = (node.maxY[slot] - origin.y) * invDirection.y;
+			float t0z = (node.minZ[slot] - origin.z) * invDirection.z, t1z = (node.maxZ[slot] - origin.z) * invDirection.z;
+			float entry = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), tMin));
+			float exit = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tMax));
+			tNear[slot] = entry;
+			if (entry <= exit) mask |= 1u << slot;
+		}
+		return mask;
+#endif
+	}
+
+	inline uint32_t BVH::intersectSlot(const BVHNode& node, const uint32_t slot, const RayPacket& packet, const float invDirection[3][4], const uint32_t laneMask) {
+#if defined(ENGINE_SSE2)
+		// Slab test of four rays against one child box.
+		__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minX[slot]), _mm_load_ps(packet.originX)), _mm_load_ps(invDirection[0]));
+		__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maxX[slot]), _mm_load_ps(packet.originX)), _mm_load_ps(invDirection[0]));
+		__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minY[slot]), _mm_load_ps(packet.originY)), _mm_load_ps(invDirection[1]));
+		__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maxY[slot]), _mm_load_ps(packet.originY)), _mm_load_ps(invDirection[1]));
+		__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minZ[slot]), _mm_load_ps(packet.originZ)), _mm_load_ps(invDirection[2]));
+		__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maxZ[slot]), _mm_load_ps(packet.originZ)), _mm_load_ps(invDirection[2]));
+		__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_load_ps(packet.tMin)));
+		__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_load_ps(packet.tMax)));
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entry, exit))) & laneMask;
+#else
+		uint32_t mask = 0;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (!(laneMask & (1u << lane))) continue;
+			float t0x = (node.minX[slot] - packet.originX[lane]) * invDirection[0][lane], t1x = (node.maxX[slot] - packet.originX[lane]) * invDirection[0][lane];
+			float t0y = (node.minY[slot] - packet.originY[lane]) * invDirection[1][lane], t1y = (node.maxY[slot] - packet.originY[lane]) * invDirection[1][lane];
+			float t0z = (node.minZ[slot] - packet.originZ[lane]) * invDirection[2][lane], t1z = (node.maxZ[slot] - packet.originZ[lane]) * invDirection[2][lane];
+			float entry = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), packet.tMin[lane]));
+			float exit = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), packet.tMax[lane]));
+			if (entry <= exit) mask |= 1u << lane;
+		}
+		return mask;
+#endif
+	}
+
+	template<typename Intersector>
+	void BVH::traverse(Ray& ray, Intersector&& intersect) const {
+		if (nodes.empty()) return;
+		glm::vec3 invDirection = 1.0f / ray.direction;
+
+		struct StackEntry {
+			uint32_t index;
+			uint32_t count;
+			float tNear;
+		};
+		StackEntry stack[BVH_STACK_SIZE];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = {0, 0, ray.tMin};
+
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+			// Skip entries behind the closest hit found since they were pushed.
+			if (entry.tNear > ray.tMax) continue;
+
+			if (entry.count > 0) {
+				for (uint32_t i = entry.index; i < entry.index + entry.count; i++) {
+					if (intersect(primitiveIndices[i], ray)) return;
+				}
+				continue;
+			}
+
+			const BVHNode& node = nodes[entry.index];
+			float tNear[4];
+			uint32_t mask = intersectNode(node, ray.origin, invDirection, ray.tMin, ray.tMax, tNear);
+
+			// Push hit children far to near so the nearest is popped first.
+			uint32_t first = stackSize;
+			for (uint32_t slot = 0; slot < 4; slot++) {
+				if (!(mask & (1u << slot))) continue;
+				StackEntry child = {node.children[slot], node.counts[slot], tNear[slot]};
+				uint32_t j = stackSize++;
+				while (j > first && stack[j - 1].tNear < child.tNear) {
+					stack[j] = stack[j - 1];
+					j--;
+				}
+				stack[j] = child;
+			}
+		}
+	}
+
+	template<typename Intersector>
+	void BVH::traverse(RayPacket& packet, Intersector&& intersect) const {
+		if (nodes.empty()) return;
+		alignas(16) float invDirection[3][4];
+		uint32_t laneMask = 0;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			invDirection[0][lane] = 1.0f / packet.directionX[lane];
+			invDirection[1][lane] = 1.0f / packet.directionY[lane];
+			invDirection[2][lane] = 1.0f / packet.directionZ[lane];
+			if (packet.tMin[lane] <= packet.tMax[lane]) laneMask |= 1u << lane;
+		}
+
+		// Every entry carries the lanes still inside it, the packet splits up as its rays diverge.
+		struct StackEntry {
+			uint32_t index;
+			uint32_t count;
+			uint32_t laneMask;
+		};
+		StackEntry stack[BVH_STACK_SIZE];
+		uint32_t stackSize = 0;
+		if (laneMask != 0) stack[stackSize++] = {0, 0, laneMask};
+
+		while (stackSize > 0) {
+			StackEntry entry = stack[--stackSize];
+			if (entry.count > 0) {
+				for (uint32_t i = entry.index; i < entry.index + entry.count; i++) {
+					intersect(primitiveIndices[i], packet, entry.laneMask);
+				}
+				continue;
+			}
+
+			const BVHNode& node = nodes[entry.index];
+			for (uint32_t slot = 0; slot < 4; slot++) {
+				if (node.children[slot] == INVALID_HANDLE_INDEX) continue;
+				uint32_t mask = intersectSlot(node, slot, packet, invDirection, entry.laneMask);
+				if (mask != 0) stack[stackSize++] = {node.children[slot], node.counts[slot], mask};
+			}
+		}
+	}
+
+	template<typename Visitor>
+	void BVH::overlap(const BoundingBox& box, Visitor&& visit) const {
+		if (nodes.empty()) return;
+		uint32_t stack[BVH_STACK_SIZE];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0) {
+			const BVHNode& node = nodes[stack[--stackSize]];
+			for (uint32_t slot = 0; slot < 4; slot++) {
+				if (node.children[slot] == INVALID_HANDLE_INDEX) continue;
+				if (node.minX[slot] > box.max.x || node.maxX[slot] < box.min.x) continue;
+				if (node.minY[slot] > box.max.y || node.maxY[slot] < box.min.y) continue;
+				if (node.minZ[slot] > box.max.z || node.maxZ[slot] < box.min.z) continue;
+
+				if (node.counts[slot] == 0) {
+					stack[stackSize++] = node.children[slot];
+					continue;
+				}
+				for (uint32_t i = node.children[slot]; i < node.children[slot] + node.counts[slot]; i++) {
+					visit(primitiveIndices[i]);
+				}
+			}
+		}
+	}
+}
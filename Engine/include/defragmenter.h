@@ -0,0 +1,118 @@
+#pragma once
+#include <resource_allocator.h>
+
+#include <vulkan/vulkan.hpp>
+#include <vk_mem_alloc.h>
+#include <functional>
+#include <unordered_map>
+#include <map>
+#include <vector>
+
+namespace core {
+
+	typedef enum RelocatableType {
+		RELOCATABLE_TYPE_BUFFER,
+		RELOCATABLE_TYPE_IMAGE,
+		RELOCATABLE_TYPE_ACCELERATION_STRUCTURE
+	} RelocatableType;
+
+	typedef enum RelocationFlagBits {
+		RELOCATION_BUFFER_BIT = 0x00000001,
+		RELOCATION_IMAGE_BIT = 0x00000002,
+		RELOCATION_ACCELERATION_STRUCTURE_BIT = 0x00000004
+	} RelocationFlagBits;
+	typedef uint32_t RelocationFlags;
+
+	// Listeners run in increasing priority, then in registration order.
+	typedef enum RelocationListenerPriority {
+		RELOCATION_LISTENER_PRIORITY_RESOURCES = 0,  // Rebuilds resources derived from moved ones (TLAS, object descriptions).
+		RELOCATION_LISTENER_PRIORITY_DESCRIPTORS = 1 // Rewrites descriptors, after the resources they reference were rebuilt.
+	} RelocationListenerPriority;
+
+	struct RelocationListener {
+		RelocationListenerPriority priority;
+		std::function<void(const RelocationFlags&)> notify;
+	};
+
+	// Resource the defragmenter is allowed to move, the owner's struct is patched in place when it is.
+	struct Relocatable {
+		RelocatableType type;
+		Buffer* buffer = nullptr;
+		Image* image = nullptr;
+		AccelerationStructure* accelStruct = nullptr;
+		VkBufferCreateInfo bufferInfo{};   // Recreates buffers and acceleration structure storage.
+		VkImageCreateInfo imageInfo{};     // Recreates images.
+		VkImageLayout imageLayout = VK_IMAGE_LAYOUT_UNDEFINED; // Layout the image is kept in between uses.
+		VkAccelerationStructureTypeKHR accelStructType = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+		std::function<void()> onRelocated; // Patches state owned by the resource's owner (e.g. image views).
+	};
+
+	// Moved resource of the current pass.
+	struct RelocationMove {
+		uint32_t moveIndex;
+		VmaAllocation allocation;
+		VkBuffer newBuffer = VK_NULL_HANDLE;
+		VkImage newImage = VK_NULL_HANDLE;
+		VkAccelerationStructureKHR newAccelStruct = VK_NULL_HANDLE;
+	};
+
+	typedef enum DefragmentationState {
+		DEFRAGMENTATION_STATE_IDLE,    // No defragmentation running.
+		DEFRAGMENTATION_STATE_READY,   // Running, the next pass can begin.
+		DEFRAGMENTATION_STATE_COPYING, // Pass copies were submitted to the GPU.
+		DEFRAGMENTATION_STATE_COPIED   // Pass copies completed, waiting for apply().
+	} DefragmentationState;
+
+	// Incremental GPU memory defragmentation on top of VMA, one pass per frame within a time budget.
+	class Defragmenter {
+	public:
+		static void setup(const VkDevice& device, const VkQueue& queue, const uint32_t queueFamilyIndex);
+		static void cleanup();
+
+		// Only registered resources are moved, every other allocation stays in place.
+		// Resources the GPU rewrites every frame must not be registered, a pass would swap in a stale copy.
+		static void registerBuffer(Buffer& buffer, const VkDeviceSize& size, const VkBufferUsageFlags& usage, std::function<void()> onRelocated = nullptr);
+		static void registerImage(Image& image, const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VkImageUsageFlags& usage, const VkImageLayout& layout, std::function<void()> onRelocated = nullptr);
+		static void registerAccelerationStructure(AccelerationStructure& accelStruct, const VkDeviceSize& size, const VkAccelerationStructureTypeKHR& type, std::function<void()> onRelocated = nullptr);
+		static void unregister(const VmaAllocation& allocation);
+
+		// Listeners patch state that references moved resources (descriptors, device addresses, TLAS instances).
+		static uint32_t addListener(std::function<void(const RelocationFlags&)> listener, const RelocationListenerPriority& priority);
+		static void removeListener(const uint32_t id);
+
+		// Requests a defragmentation run, runs also start on their own when memory gets fragmented.
+		static void start();
+		// Advances defragmentation, returns true once a pass has copied its resources and must be applied.
+		static bool update(const double& timeBudgetMs);
+		// Patches moved resources and notifies listeners, no frame in flight may still use the old resources.
+		static void apply();
+		static bool isRunning() { return state != DEFRAGMENTATION_STATE_IDLE; }
+
+	private:
+		static VkDevice device;
+		static VkQueue queue;
+		static VkCommandPool commandPool;
+		static VkCommandBuffer commandBuffer;
+		static VkFence fence;
+
+		static DefragmentationState state;
+		static bool requested;
+		static uint64_t frameCounter;
+		static uint32_t poolIndex;
+		static VmaDefragmentationContext context;
+		static VmaDefragmentationPassMoveInfo pass;
+		static std::vector<RelocationMove> moves;
+		static std::unordered_map<VmaAllocation, Relocatable> relocatables;
+		static std::map<uint32_t, RelocationListener> listeners;
+		static uint32_t nextListenerId;
+
+		static bool isFragmented();
+		static void beginContext();
+		static void endContext();
+		static void beginPass(const double& timeBudgetMs);
+		static void recordMove(const VmaDefragmentationMove& move, const Relocatable& relocatable, RelocationMove& relocation);
+		static void destroyMove(const RelocationMove& relocation);
+		static void abortPass();
+
+	};
+}
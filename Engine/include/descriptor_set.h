@@ -2,6 +2,7 @@
 #include <vulkan/vulkan.hpp>
 
 #include <vector>
+#include <deque>
 
 namespace core {
 
@@ -33,6 +34,11 @@ namespace core {
 		std::vector<VkDescriptorSetLayoutBinding> bindings;
 		std::vector<VkDescriptorBindingFlags> bindingFlags;
 		std::vector<VkWriteDescriptorSet> writes;
+		// Copies of the pending writes' infos, callers' infos may go out of scope before update().
+		std::deque<VkDescriptorBufferInfo> bufferInfos;
+		std::deque<VkDescriptorImageInfo> imageInfos;
+		std::deque<VkWriteDescriptorSetAccelerationStructureKHR> accelStructInfos;
+		std::deque<std::vector<VkAccelerationStructureKHR>> accelStructHandles;
 		bool hasVariableDescriptor;
 
 		void createLayout();
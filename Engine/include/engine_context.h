@@ -29,12 +29,14 @@ namespace core {
 	struct QueueFamilyIndices {
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> transferFamily;
+		std::optional<uint32_t> computeFamily;
 
 		bool isComplete() {
 			return graphicsFamily.has_value() && presentFamily.has_value();
 		}
 		std::vector<uint32_t> toVector() {
-			std::set<uint32_t> unique = {graphicsFamily.value(), presentFamily.value()};
+			std::set<uint32_t> unique = {graphicsFamily.value(), presentFamily.value(), transferFamily.value_or(graphicsFamily.value()), computeFamily.value_or(graphicsFamily.value())};
 			return std::vector<uint32_t>(unique.begin(), unique.end());
 		}
 	};
@@ -53,6 +55,7 @@ namespace core {
 		VkPhysicalDeviceProperties deviceProperties;
 		VkPhysicalDeviceRayTracingPipelinePropertiesKHR raytracingProperties;
 		VkPhysicalDeviceAccelerationStructurePropertiesKHR accelStructProperties;
+		VkPhysicalDeviceIDProperties idProperties; // Driver UUID keys serialized acceleration structures.
 	};
 
 	class EngineContext {
@@ -69,8 +72,11 @@ namespace core {
 		static vk::Device getDevice() { return device; }
 		static vk::Queue getGraphicsQueue() { return graphicsQueue; }
 		static vk::Queue getPresentQueue() { return presentQueue; }
+		static vk::Queue getTransferQueue() { return transferQueue; }
+		static vk::Queue getComputeQueue() { return computeQueue; }
 
 		static PhysicalDeviceProperties getPhysicalDeviceProperties() { return physicalDeviceProperties; }
+		static bool supportsHostAccelerationStructureCommands() { return hostAccelerationStructureCommands; }
 		static QueueFamilyIndices getQueueFamilyIndices() { return queryQueueFamilies(physicalDevice); }
 		static SwapChainSupport getSwapChainSupport() { return querySwapChainSupport(physicalDevice); }
 
@@ -89,10 +95,13 @@ namespace core {
 		static std::vector<const char*> layers;
 
 		static PhysicalDeviceProperties physicalDeviceProperties;
+		static bool hostAccelerationStructureCommands;
 		static vk::PhysicalDevice physicalDevice;
 		static vk::Device device;
 		static vk::Queue graphicsQueue;
 		static vk::Queue presentQueue;
+		static vk::Queue transferQueue;
+		static vk::Queue computeQueue;
 
 		static vk::CommandPool commandPool;
 
@@ -15,6 +15,11 @@
 	#define DEBUG_ASSERT(cond) ((void)0)
 #endif
 
+// SSE2 is available on every x64 target, and on x86 targets compiled for it. Users include the intrinsic headers they need.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define ENGINE_SSE2
+#endif
+
 namespace core {
 	const int MAX_FRAMES_IN_FLIGHT = 2;
 }
\ No newline at end of file
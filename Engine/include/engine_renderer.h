@@ -1,6 +1,7 @@
 #pragma once
 #include <scene.h>
 #include <descriptor_set.h>
+#include <suballocator.h>
 #include <renderer/renderer.h>
 
 #include <vulkan/vulkan.hpp>
@@ -33,6 +34,8 @@ namespace core {
 
 		static Swapchain& getSwapchain() { return swapchain; }
 		static uint32_t getCurrentSwapchainIndex() { return currentSwapchainIndex; }
+		static FrameSuballocator& getFrameAllocator() { return *frameAllocator; }
+		static uint32_t getCameraDescOffset() { return cameraDescOffset; }
 
 		static void setScene(Scene& scene) { EngineRenderer::scene = &scene; }
 
@@ -48,9 +51,12 @@ namespace core {
 		static DescriptorSet* cameraDescSet;
 		static DescriptorSet* texturesDescSet;
 
-		// Descriptor buffers.
-		static Buffer cameraDescBuffer;
-		static uint32_t cameraDescBufferAlignment;
+		// Per-frame scratch memory for uniforms and draw data.
+		static FrameSuballocator* frameAllocator;
+		// Dynamic offset of the current frame's camera descriptor.
+		static uint32_t cameraDescOffset;
+		// Defragmentation listener patching the texture array.
+		static uint32_t relocationListener;
 
 		// Instances for all the renderers.
 		static Renderer* standardRenderer;
@@ -58,9 +64,11 @@ namespace core {
 		static Renderer* pathtracedRenderer;
 
 		static void createSwapChain();
+		static void createFrameAllocator();
 		static void createRenderers();
 		static void createDescriptorSets();
 		static void initDescriptorSets();
+		static void writeTextureArrayDescriptor();
 
 		// Recreates the swapchain.
 		static void updateSwapchain();
@@ -13,10 +13,16 @@ namespace core {
 		COLOR_SPACE_SRGB
 	} ColorSpace;
 
+	typedef enum HdrEncoding {
+		HDR_ENCODING_HALF_FLOAT,     // VK_FORMAT_R16G16B16A16_SFLOAT (8 bytes per texel, keeps alpha).
+		HDR_ENCODING_SHARED_EXPONENT // VK_FORMAT_E5B9G9R9_UFLOAT_PACK32 (4 bytes per texel, no alpha).
+	} HdrEncoding;
+
 	class FileReader {
 	public:
 		static Mesh* readMeshFile(std::string filename);
 		static Texture* readImageFile(std::string filename, const ColorSpace& colorSpace = COLOR_SPACE_SRGB);
+		static Texture* readHdrImageFile(std::string filename, const HdrEncoding& encoding = HDR_ENCODING_HALF_FLOAT);
 		static char* readBytes(const std::string& filepath, size_t* size);
 
 	private:
@@ -0,0 +1,50 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vector>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace core {
+
+	// Deferred host build joined by the worker threads.
+	struct HostBuild {
+		VkDeferredOperationKHR operation = VK_NULL_HANDLE;
+		uint32_t maxConcurrency = 1;
+		uint32_t joiners = 0;  // Threads currently inside vkDeferredOperationJoinKHR.
+		bool joinable = true;  // Cleared once the operation has no more work to hand out.
+	};
+
+	// Builds acceleration structures on the CPU through VK_KHR_deferred_host_operations.
+	// Only available on devices supporting accelerationStructureHostCommands, geometry and scratch use host addresses.
+	class HostAccelerationBuilder {
+	public:
+		static void setup(const VkDevice& device, const bool supported, const uint32_t threadCount);
+		static void cleanup();
+
+		// Host builds are opt-in, they must be enabled before meshes are created so their geometry is kept on the host.
+		static void setEnabled(const bool enabled) { HostAccelerationBuilder::enabled = enabled && supported; }
+		static bool isEnabled() { return enabled; }
+
+		// Starts the builds on the worker threads, every pointer in the build infos must stay valid until wait() returned.
+		static HostBuild* build(const uint32_t infoCount, const VkAccelerationStructureBuildGeometryInfoKHR* pInfos, const VkAccelerationStructureBuildRangeInfoKHR* const* ppRangeInfos);
+		static bool isComplete(HostBuild* build);
+		// Joins the build from the calling thread until it completed, then releases it.
+		static void wait(HostBuild* build);
+
+	private:
+		static VkDevice device;
+		static bool supported;
+		static bool enabled;
+		static bool stopping;
+		static std::vector<std::thread> workers;
+		static std::list<HostBuild> builds;
+		static std::mutex mutex;
+		static std::condition_variable condition;
+
+		static void workerLoop();
+		static VkResult join(HostBuild& build, std::unique_lock<std::mutex>& lock);
+
+	};
+}
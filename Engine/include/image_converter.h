@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace core {
+
+	class ImageConverter {
+	public:
+		// Converts RGBA 32-bit float texels into RGBA 16-bit float texels (VK_FORMAT_R16G16B16A16_SFLOAT).
+		static void toHalfFloat(const float* src, uint16_t* dst, const size_t texelCount);
+		// Converts RGBA 32-bit float texels into shared exponent RGB texels (VK_FORMAT_E5B9G9R9_UFLOAT_PACK32). Alpha is dropped.
+		static void toSharedExponent(const float* src, uint32_t* dst, const size_t texelCount);
+
+	private:
+		static uint16_t toHalfFloat(const float value);
+		static uint32_t toSharedExponent(const float r, const float g, const float b);
+
+	};
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <resource_allocator.h>
+#include <suballocator.h>
 #include <texture.h>
 #include <glm/glm.hpp>
 
@@ -9,11 +10,17 @@ namespace core {
 	public:
 		Material(Texture* albedoMap, glm::vec3 albedo, Texture* metallicMap, float metallic, float smoothness, Texture* normalMap, glm::vec2 tilling, glm::vec2 offset);
 		~Material();
+		// Materials own their pool region, ResourcePool moves them to keep its storage dense.
+		Material(Material&& other) noexcept;
+		Material& operator=(Material&& other) noexcept;
+		Material(const Material&) = delete;
+		Material& operator=(const Material&) = delete;
 
 		void cleanup();
-		void setup(uint16_t albedoMapIndex, uint16_t metallicMapIndex, uint16_t normalMapIndex);
+		void setup(PoolSuballocator* pool, uint16_t albedoMapIndex, uint16_t metallicMapIndex, uint16_t normalMapIndex);
 
-		Buffer& getBuffer() { return materialBuffer; }
+		BufferRegion& getRegion() { return materialRegion; }
+		static VkDeviceSize getDataSize();
 
 	private:
 		Texture* albedoMap;   // Texture map which represents the color of the surface without lighting or shadowing.
@@ -28,9 +35,10 @@ namespace core {
 		uint16_t albedoMapIndex;
 		uint16_t metallicMapIndex;
 		uint16_t normalMapIndex;
-		Buffer materialBuffer; // On device buffer containing the material's data.
+		PoolSuballocator* materialPool; // Scene's material pool, the region is returned to it on cleanup.
+		BufferRegion materialRegion;    // Region of the scene's material pool containing the material's data.
 
-		void createMaterialBuffer(Buffer& buffer);
+		void uploadMaterialData(const BufferRegion& region);
 
 	};
 }
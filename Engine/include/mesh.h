@@ -3,9 +3,13 @@
 #include <Vulkan/vulkan.hpp>
 
 #include <resource_allocator.h>
+#include <suballocator.h>
+#include <vector>
 
 namespace core {
 
+	class MeshBVH;
+
 	struct Vertex {
 		glm::vec3 position;
 		glm::vec3 color;
@@ -41,28 +45,45 @@ namespace core {
 	public:
 		class Submesh {
 		public: 
-			Submesh(uint32_t* indices, uint32_t indexCount);
+			Submesh(const BufferRegion& indexRegion, uint32_t indexCount, uint32_t* indices);
 			~Submesh();
 
 			void cleanup();
 
 			uint32_t getIndexCount() { return indexCount; }
-			Buffer& getIndexBuffer() { return indexBuffer; }
+			BufferRegion& getIndexRegion() { return indexRegion; }
 			AccelerationStructure& getBLAS() { return blas; }
+			std::vector<uint32_t>& getIndices() { return indices; }
 
 		private:
 			uint32_t indexCount;
-			Buffer indexBuffer;
+			BufferRegion indexRegion; // Region of the mesh's index buffer.
 			AccelerationStructure blas;
+			std::vector<uint32_t> indices; // Host copy, kept only until host acceleration structure builds are done.
 
 		};
 
 	public:
-		Mesh(float* vertices, uint32_t vertexCount, uint32_t submeshCount, uint32_t** indicesList, uint32_t* indexCountList);
+		Mesh(float* vertices, uint32_t vertexCount, uint32_t submeshCount, uint32_t** indicesList, uint32_t* indexCountList, const bool deformable = false);
 		~Mesh();
 
 		void cleanup();
 
+		// Deformable meshes take new vertices every frame, their BLAS are refitted instead of rebuilt.
+		void updateVertices(const Vertex* vertices);
+		// Marks the pending vertices as uploaded, returns true when the BLAS should be rebuilt rather than refitted.
+		bool consumePendingVertices();
+		bool isDeformable() { return deformable; }
+		// Hash of the vertices and indices the mesh was created with, keys the serialized BLAS cache.
+		uint64_t getContentHash() { return contentHash; }
+		bool hasPendingVertices() { return pendingVertices; }
+		std::vector<Vertex>& getVertices() { return vertices; }
+		// Host geometry is kept for host acceleration structure builds, released once the BLAS are built.
+		bool hasHostGeometry();
+		void releaseHostGeometry();
+		// Triangle BVH for CPU scene queries, nullptr unless the mesh was created while SceneBVH was enabled.
+		MeshBVH* getBVH() { return bvh; }
+
 		Buffer& getVertexBuffer() { return vertexBuffer; }
 		uint32_t getVertexCount() { return vertexCount; }
 		Submesh& getSubmesh(uint32_t index) { return *submeshes[index]; }
@@ -73,9 +94,19 @@ namespace core {
 		Buffer vertexBuffer;
 		uint32_t submeshCount;
 		Submesh** submeshes;
-
-		static void createVertexBuffer(Vertex* vertices, uint32_t vertexCount, Buffer& vertexBuffer);
-		static void createIndexBuffer(uint32_t* indices, uint32_t indexCount, Buffer& indexBuffer);
+		LinearSuballocator indexAllocator; // Packs every submesh's indices into one buffer.
+		uint64_t contentHash;
+		MeshBVH* bvh = nullptr;
+
+		bool deformable;
+		bool pendingVertices = false;
+		std::vector<Vertex> vertices; // Host copy, kept for deformable meshes and host acceleration structure builds.
+		uint32_t refitCount = 0;      // Refits since the BLAS was last built.
+		float builtSurfaceArea = 0.0f; // Bounds surface area when the BLAS was last built.
+
+		float getSurfaceArea();
+		static void createVertexBuffer(Vertex* vertices, uint32_t vertexCount, Buffer& vertexBuffer, const bool relocatable);
+		static BufferRegion createIndexRegion(uint32_t* indices, uint32_t indexCount, LinearSuballocator& indexAllocator);
 
 	};
 }
\ No newline at end of file
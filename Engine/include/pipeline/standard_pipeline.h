@@ -9,11 +9,14 @@
 
 namespace core {
 
-	struct StandardPushConstant {
-		glm::mat4 proj;
+	// Per-draw data, written to the frame allocator and read through a buffer reference.
+	struct StandardDrawData {
 		glm::mat4 world;
-		glm::mat4 view;
 		VkDeviceAddress materialAddress;
+	};
+
+	struct StandardPushConstant {
+		VkDeviceAddress drawDataAddress;
 
 		static uint32_t getSize() {
 			return sizeof(StandardPushConstant);
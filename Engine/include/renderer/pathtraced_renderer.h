@@ -18,6 +18,7 @@ namespace core {
 		~PathTracedRenderer();
 
 		virtual void cleanup();
+		virtual void waitForFrame(const uint32_t currentFrame);
 		virtual void render(const uint32_t currentFrame, Scene& scene);
 
 		VkRenderPass& getRenderPass() { return renderPass; }
@@ -43,6 +44,9 @@ namespace core {
 		DescriptorSet* postDescSet;
 
 		bool firstRender;
+		uint32_t relocationListener = 0;
+		VkAccelerationStructureKHR writtenTLAS = VK_NULL_HANDLE; // Scene resources currently written in the descriptor sets.
+		VkBuffer writtenObjDescriptions = VK_NULL_HANDLE;
 
 		void createRenderPass();
 		void createFramebuffers();
@@ -52,7 +56,8 @@ namespace core {
 		void createPipeline(VkDevice device);
 		void createDescriptorSets();
 		void initDescriptorSets(Scene& scene);
-		void updateDescriptorSets();
+		void writeSceneDescriptors(Scene& scene);
+		void updateDescriptorSets(Scene& scene);
 
 		void recordCommandBuffer(const VkCommandBuffer& commandBuffer, uint32_t currentFrame, uint32_t imageIndex, Scene& scene);
 
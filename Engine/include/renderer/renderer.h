@@ -11,9 +11,11 @@ namespace core {
 	class Renderer {
 	public:
 		Renderer(VkDevice device, VkQueue graphicsQueue, VkQueue presentQueue);
-		~Renderer();
+		virtual ~Renderer();
 
 		virtual void cleanup() = 0;
+		// Blocks until the GPU has finished the given frame in flight.
+		virtual void waitForFrame(const uint32_t currentFrame) = 0;
 		// TODO - virtual void render(Scene& scene) = 0;
 
 	protected:
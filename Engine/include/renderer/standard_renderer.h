@@ -16,6 +16,7 @@ namespace core {
 		~StandardRenderer();
 
 		virtual void cleanup();
+		virtual void waitForFrame(const uint32_t currentFrame);
 		virtual void render(const uint32_t currentFrame, Scene& scene);
 
 		VkRenderPass& getRenderPass() { return renderPass; }
@@ -1,13 +1,52 @@
 #pragma once
 #include <vulkan/vulkan.hpp>
 #include <vk_mem_alloc.h>
+#include <allocation_tracer.h>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <string>
 
 namespace core {
 
+	typedef enum MemoryUsage {
+		MEMORY_USAGE_GPU_ONLY, // Device-local, never mapped. Filled through staging uploads or GPU writes.
+		MEMORY_USAGE_UPLOAD,   // Host-visible, mapped. Written once by the CPU and read by transfers.
+		MEMORY_USAGE_READBACK, // Host-visible and cached, mapped. Written by the GPU and read by the CPU.
+		MEMORY_USAGE_DYNAMIC   // Host-visible, mapped, preferably device-local. Rewritten by the CPU and read by shaders.
+	} MemoryUsage;
+
+	typedef enum AllocationCategory {
+		ALLOCATION_CATEGORY_GEOMETRY,               // Vertex and index buffers.
+		ALLOCATION_CATEGORY_TEXTURE,                // Sampled images.
+		ALLOCATION_CATEGORY_RENDER_TARGET,          // Attachment and storage images.
+		ALLOCATION_CATEGORY_ACCELERATION_STRUCTURE, // Acceleration structure storage and instance buffers.
+		ALLOCATION_CATEGORY_STAGING,                // Host-visible upload and readback buffers.
+		ALLOCATION_CATEGORY_DESCRIPTOR,             // Uniform, storage and shader binding table buffers.
+		ALLOCATION_CATEGORY_OTHER,
+		ALLOCATION_CATEGORY_COUNT
+	} AllocationCategory;
+
+	struct CategoryStats {
+		uint64_t allocationCount = 0;
+		VkDeviceSize allocationBytes = 0;
+	};
+
+	struct MemoryStats {
+		std::vector<VmaBudget> heapBudgets; // Usage and budget of every memory heap.
+		VmaTotalStatistics totals;
+		CategoryStats categories[ALLOCATION_CATEGORY_COUNT];
+		uint32_t frameAllocations = 0; // Allocations made during the last completed frame.
+		uint32_t frameFrees = 0;       // Allocations freed during the last completed frame.
+	};
+
 	struct Buffer {
 		VkBuffer buffer = VK_NULL_HANDLE;
 		VmaAllocation allocation = VK_NULL_HANDLE;
-		VkDeviceAddress getDeviceAddress();
+		void* mapped = nullptr; // Persistently mapped pointer for host-visible buffers.
+		VkDeviceAddress address = 0; // Cached at creation, 0 without VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT.
+		VkDeviceAddress getDeviceAddress() const { return address; }
 		bool isCreated();
 	};
 
@@ -20,19 +59,71 @@ namespace core {
 		VkBuffer buffer = VK_NULL_HANDLE;
 		VmaAllocation allocation = VK_NULL_HANDLE;
 		VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
-		VkDeviceAddress getDeviceAddress();
+		VkDeviceAddress address = 0; // Cached at creation.
+		VkDeviceAddress getDeviceAddress() const { return address; }
+	};
+
+	// Size of the persistently mapped staging ring used by every upload.
+	const VkDeviceSize STAGING_BUFFER_SIZE = 64 * 1024 * 1024;
+	// Size of each memory block shared by sampled textures.
+	const VkDeviceSize TEXTURE_POOL_BLOCK_SIZE = 64 * 1024 * 1024;
+	// Attachments at least this large get their own memory allocation.
+	const VkDeviceSize DEDICATED_IMAGE_THRESHOLD = 16 * 1024 * 1024;
+
+	struct UploadContext {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		uint64_t timelineValue = 0; // Timeline value signaled once the command buffer completed.
+	};
+
+	// Completion token of an upload batch, the resources are ready once the semaphore reaches value.
+	struct UploadToken {
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		uint64_t value = 0;
+	};
+
+	struct StagingSubmission {
+		uint64_t timelineValue = 0;
+		VkDeviceSize stagingHead = 0; // Staging ring head at submission, freed once the timeline value is reached.
+	};
+
+	struct DeferredDeletion {
+		uint64_t frame = 0; // Frame during which the resource was released.
+		std::function<void()> destroy;
 	};
 
 	class ResourceAllocator {
 	public:
-		static void setup(const VkInstance& instance, const VkPhysicalDevice& physicalDevice, const VkDevice& device, const uint32_t familyQueueIndex);
+		static void setup(const VkInstance& instance, const VkPhysicalDevice& physicalDevice, const VkDevice& device, const uint32_t graphicsFamilyIndex, const uint32_t transferFamilyIndex, const uint32_t computeFamilyIndex);
 		static void cleanup();
 
-		static void createBuffer(const VkDeviceSize& size, Buffer& buffer, VkBufferUsageFlags usage);
-		static void createBuffer(const VkDeviceSize& size, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage);
-		static void createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, Buffer& buffer, VkBufferUsageFlags usage);
-		static void createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage);
+		static VmaAllocator getAllocator() { return allocator; }
+		static VmaPool getTexturePool() { return texturePool; }
+
+		// Advances the frame counter and destroys resources no frame in flight can still use.
+		// Must be called once per frame, after waiting on the fence of the frame being reused.
+		static void beginFrame();
+		// Queues destruction until every frame in flight that might use the resource has completed.
+		// All destroy* functions go through this queue, so no device wait is needed before releasing resources.
+		static void deferDestroy(std::function<void()>&& destroy);
+		// Destroys every queued resource immediately, the device must be idle.
+		static void flushDeletionQueue();
+		// Index of the current frame, a resource released during frame f is unused once frame f + MAX_FRAMES_IN_FLIGHT began.
+		static uint64_t getFrameCounter() { return frameCounter; }
+
+		// Memory budget and usage, broken down by allocation category.
+		static MemoryStats getMemoryStats();
+		static std::string getMemoryStatsJson();
+		static void dumpMemoryStats(const std::string& filepath);
+		static const char* getAllocationCategoryName(const AllocationCategory& category);
+
+		static void createBuffer(const VkDeviceSize& size, Buffer& buffer, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage);
+		static void createBuffer(const VkDeviceSize& size, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage);
+		static void createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, Buffer& buffer, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage);
+		static void createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage);
+		// Upload targets, acceleration structure storage and build inputs are shared across families, other buffers are exclusive.
+		static void setSharingMode(VkBufferCreateInfo& bufferInfo);
 		static void mapDataToBuffer(const Buffer& buffer, const VkDeviceSize& size, const void* data, const uint32_t& offset = 0);
+		static void flushBuffer(const Buffer& buffer, const VkDeviceSize& offset = 0, const VkDeviceSize& size = VK_WHOLE_SIZE);
 		static void createAndStageBuffer(const VkDeviceSize& size, const void* data, Buffer& buffer, VkBufferUsageFlags usage);
 		static void createAndStageBuffer(const VkCommandBuffer& commandBuffer, const VkDeviceSize& size, const void* data, Buffer& srcBuffer, Buffer& dstBuffer, VkBufferUsageFlags usage);
 		static VkDeviceAddress getBufferDeviceAddress(const VkBuffer& buffer);
@@ -41,6 +132,12 @@ namespace core {
 		static void destroyBuffer(const Buffer& buffer);
 
 		static void createImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, Image& image, const VkImageUsageFlags& usage);
+		// Transient attachments whose lifetimes do not overlap can share one aliasing allocation.
+		static VkImageCreateInfo getImage2DCreateInfo(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VkImageUsageFlags& usage);
+		static VkMemoryRequirements getImage2DMemoryRequirements(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VkImageUsageFlags& usage);
+		static VmaAllocation allocateAliasingMemory(const std::vector<VkMemoryRequirements>& requirements);
+		static void createAliasedImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VmaAllocation& memory, Image& image, const VkImageUsageFlags& usage);
+		static void freeAliasingMemory(const VmaAllocation& memory);
 		static void createAndStageImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const void* data, Image& image, VkImageUsageFlags usage);
 		static void createAndStageImage2D(const VkCommandBuffer& commandBuffer, const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const void* data, Buffer& srcBuffer, Image& dstImage, VkImageUsageFlags usage);
 		static void createImageView2D(VkImage& image, VkImageView& view, const VkFormat& format, const VkImageAspectFlags aspectFlags);
@@ -49,18 +146,84 @@ namespace core {
 		static void destroyImage(const Image& image);
 		static void destroyImageView(const VkImageView& view);
 		static void destroySampler(const VkSampler& sampler);
+		static VkDeviceSize getTexelSize(const VkFormat& format);
+
+		// Upload batches record every upload and layout transition into one submission on the transfer queue.
+		// Images are handed over to the graphics queue and buffers are shared with it, later graphics submissions can use them without waiting.
+		// Buffer uploads are not ordered against rendering, they must only write ranges no frame in flight reads.
+		// Without an open batch each upload is submitted and waited on individually.
+		static void beginUploadBatch();
+		static UploadToken submitUploadBatch();
+		static void waitForUploadBatch(const UploadToken& token);
+		static bool isUploadBatchComplete(const UploadToken& token);
+		// Token of the last submitted upload batch, async compute submissions wait on it before reading uploaded buffers.
+		static UploadToken getLastUploadToken() { return lastUploadToken; }
+		static void uploadToBuffer(const Buffer& buffer, const VkDeviceSize& offset, const VkDeviceSize& size, const void* data);
+		static void uploadToImage2D(const Image& image, const VkExtent2D& extent, const VkFormat& format, const void* data, const VkImageLayout& finalLayout);
+		static void transitionImageLayout(const Image& image, const VkFormat& format, const VkImageLayout& oldLayout, const VkImageLayout& newLayout);
 
-		static void createAccelerationStructure(const VkDeviceSize& size, AccelerationStructure& accelStruct, const VkAccelerationStructureTypeKHR& type);
+		// Host-built acceleration structures must live in host-visible memory (MEMORY_USAGE_UPLOAD).
+		static void createAccelerationStructure(const VkDeviceSize& size, AccelerationStructure& accelStruct, const VkAccelerationStructureTypeKHR& type, const MemoryUsage& memoryUsage = MEMORY_USAGE_GPU_ONLY);
 		static void destroyAccelerationStructure(const AccelerationStructure& accelStruct);
 
 	private:
 		static VkDevice device;
 		static VkCommandPool commandPool;
+		static VkCommandPool acquireCommandPool;
 		static VkQueue transferQueue;
+		static VkQueue graphicsQueue;
+		static uint32_t transferFamilyIndex;
+		static uint32_t graphicsFamilyIndex;
+		static std::vector<uint32_t> sharedFamilyIndices; // Families accessing acceleration structure buffers.
 		static VmaAllocator allocator;
+		static VmaPool texturePool;
+		static uint32_t texturePoolMemoryType;
+
+		static Buffer stagingBuffer;
+		static uint8_t* stagingData;
+		static VkDeviceSize stagingHead; // Virtual offsets, the ring offset is (offset % STAGING_BUFFER_SIZE).
+		static VkDeviceSize stagingTail;
+		static VkDeviceSize stagingSubmitted;
+		static std::deque<StagingSubmission> stagingSubmissions;
+		static VkSemaphore uploadSemaphore;
+		static uint64_t uploadSemaphoreValue;
+		static VkSemaphore acquireSemaphore;
+		static uint64_t acquireSemaphoreValue;
+		static UploadToken lastUploadToken;
+		static std::vector<UploadContext> uploadContexts;
+		static std::vector<UploadContext> acquireContexts;
+		static int32_t activeUpload;
+		static std::vector<VkImageMemoryBarrier> pendingImageBarriers;
+		static std::vector<VkImageMemoryBarrier> pendingImageTransitions;
+		static uint64_t frameCounter;
+		static std::deque<DeferredDeletion> deletionQueue;
+		static std::unordered_map<VmaAllocation, AllocationCategory> allocationCategories;
+		static CategoryStats categoryStats[ALLOCATION_CATEGORY_COUNT];
+		static uint32_t frameAllocations;
+		static uint32_t frameFrees;
+		static uint32_t lastFrameAllocations;
+		static uint32_t lastFrameFrees;
 
 		static void createAllocator(const VkInstance& instance, const VkPhysicalDevice physicalDevice);
-		static void fetchQueue(const VkDevice& device, const uint32_t familyQueueIndex);
-		static void createCommandPool(const uint32_t familyQueueIndex);
+		static VmaAllocationCreateInfo getAllocationCreateInfo(const MemoryUsage& memoryUsage);
+		static VmaAllocationCreateInfo getImageAllocationCreateInfo(const VkImageCreateInfo& imageInfo);
+		static void createTexturePool();
+		static AllocationCategory getBufferCategory(const VkBufferUsageFlags& usage, const MemoryUsage& memoryUsage);
+		static AllocationCategory getImageCategory(const VkImageUsageFlags& usage);
+		static void trackAllocation(const VmaAllocation& allocation, const AllocationCategory& category, const AllocationResourceType& resourceType, const uint32_t usage);
+		static void untrackAllocation(const VmaAllocation& allocation, const AllocationResourceType& resourceType);
+		static void fetchQueues(const VkDevice& device);
+		static void createCommandPools();
+		static void createStagingBuffer();
+		static void createUploadSemaphores();
+
+		static VkCommandBuffer beginContext(std::vector<UploadContext>& contexts, const VkCommandPool& pool, const VkSemaphore& semaphore, int32_t& index);
+		static uint64_t submitTransferCommands();
+		static void waitForTransfer(const uint64_t value);
+		static VkCommandBuffer getUploadCommandBuffer();
+		static VkDeviceSize allocateStaging(const VkDeviceSize& size, const VkDeviceSize& alignment);
+		static void retireStaging();
+		static void stageBufferData(const VkDeviceSize& size, const void* data, const Buffer& dstBuffer, const VkDeviceSize& dstOffset);
+		static void stageImageData(const VkExtent2D& extent, const VkFormat& format, const void* data, const Image& dstImage);
 	};
 }
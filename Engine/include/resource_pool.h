@@ -0,0 +1,114 @@
+#pragma once
+#include <engine_globals.h>
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+namespace core {
+
+	const uint32_t INVALID_HANDLE_INDEX = 0xFFFFFFFF;
+
+	// Typed reference to an object of a ResourcePool, detects use after the object was destroyed.
+	template<typename T>
+	struct Handle {
+		uint32_t index = INVALID_HANDLE_INDEX; // Slot of the object in its pool.
+		uint32_t generation = 0;               // Generation of the slot when the handle was created.
+
+		bool isValid() const { return index != INVALID_HANDLE_INDEX; }
+		bool operator==(const Handle<T>& other) const { return index == other.index && generation == other.generation; }
+		bool operator!=(const Handle<T>& other) const { return !(*this == other); }
+	};
+
+	// Pool of objects stored contiguously and referenced through generational handles.
+	// Objects move when others are destroyed, pointers returned by get() are only valid until the next create() or destroy().
+	template<typename T>
+	class ResourcePool {
+	public:
+		template<typename... Args>
+		Handle<T> create(Args&&... args) {
+			uint32_t index;
+			if (!freeSlots.empty()) {
+				index = freeSlots.back();
+				freeSlots.pop_back();
+			} else {
+				index = static_cast<uint32_t>(slots.size());
+				slots.push_back({});
+			}
+
+			slots[index].denseIndex = static_cast<uint32_t>(objects.size());
+			objects.emplace_back(std::forward<Args>(args)...);
+			denseSlots.push_back(index);
+			return { index, slots[index].generation };
+		}
+
+		void destroy(const Handle<T>& handle) {
+			if (!isAlive(handle)) return;
+
+			// Move the last object into the destroyed object's place to keep storage dense.
+			uint32_t denseIndex = slots[handle.index].denseIndex;
+			uint32_t lastIndex = static_cast<uint32_t>(objects.size() - 1);
+			if (denseIndex != lastIndex) {
+				objects[denseIndex] = std::move(objects[lastIndex]);
+				denseSlots[denseIndex] = denseSlots[lastIndex];
+				slots[denseSlots[denseIndex]].denseIndex = denseIndex;
+			}
+			objects.pop_back();
+			denseSlots.pop_back();
+
+			// Invalidate every handle to the slot before reusing it.
+			slots[handle.index].generation++;
+			freeSlots.push_back(handle.index);
+		}
+
+		void clear() {
+			for (uint32_t index : denseSlots) {
+				slots[index].generation++;
+				freeSlots.push_back(index);
+			}
+			objects.clear();
+			denseSlots.clear();
+		}
+
+		bool isAlive(const Handle<T>& handle) const {
+			return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+		}
+
+		// Returns nullptr for invalid or stale handles.
+		T* get(const Handle<T>& handle) { return isAlive(handle) ? &objects[slots[handle.index].denseIndex] : nullptr; }
+		const T* get(const Handle<T>& handle) const { return isAlive(handle) ? &objects[slots[handle.index].denseIndex] : nullptr; }
+
+		T& at(const Handle<T>& handle) {
+			DEBUG_ASSERT_MSG(isAlive(handle), "Invalid or stale resource handle.");
+			return objects[slots[handle.index].denseIndex];
+		}
+		const T& at(const Handle<T>& handle) const {
+			DEBUG_ASSERT_MSG(isAlive(handle), "Invalid or stale resource handle.");
+			return objects[slots[handle.index].denseIndex];
+		}
+
+		// Handle of the object at the given position of the dense storage.
+		Handle<T> getHandle(const uint32_t denseIndex) const { return { denseSlots[denseIndex], slots[denseSlots[denseIndex]].generation }; }
+
+		size_t size() const { return objects.size(); }
+		bool empty() const { return objects.empty(); }
+
+		// Iterates over live objects in storage order.
+		typename std::vector<T>::iterator begin() { return objects.begin(); }
+		typename std::vector<T>::iterator end() { return objects.end(); }
+		typename std::vector<T>::const_iterator begin() const { return objects.begin(); }
+		typename std::vector<T>::const_iterator end() const { return objects.end(); }
+
+	private:
+		struct Slot {
+			uint32_t denseIndex = INVALID_HANDLE_INDEX; // Position of the object in the dense storage.
+			uint32_t generation = 0;                    // Incremented every time the slot's object is destroyed.
+		};
+
+		std::vector<T> objects;           // Live objects, contiguous.
+		std::vector<uint32_t> denseSlots; // Slot of each live object.
+		std::vector<Slot> slots;
+		std::vector<uint32_t> freeSlots;
+
+	};
+}
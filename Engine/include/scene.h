@@ -3,25 +3,52 @@
 #include <material.h>
 #include <glm/matrix.hpp>
 #include <camera.h>
+#include <defragmenter.h>
+#include <resource_pool.h>
+#include <bvh.h>
+#include <async_compute.h>
 
 #include <vector>
 #include <unordered_set>
 #include <map>
+#include <list>
 #include <stddef.h>
 
 namespace core {
 
 	struct Object {
 		Mesh* mesh;
-		std::vector<Material*> materials;
+		std::vector<Handle<Material>> materials;
 		glm::mat4 transform;
 		uint32_t shaderHitGroupOffset;
+		uint32_t firstInstance = 0; // Index of the object's first TLAS instance.
+		bool isStatic = false;      // Static objects with small meshes are merged into shared BLASes.
+		bool batched = false;       // Geometry lives in a static batch's BLAS rather than in its own instances.
 	};
 
 	struct ObjDesc {
 		uint64_t vertexAddress;    // Address of the Vertex buffer
 		uint64_t indexAddress;     // Address of the index buffer
 		uint64_t materialAddress;  // Address of the material buffer
+		uint64_t transformAddress; // Address of the transform baked into a static batch, 0 for instanced geometry
+	};
+
+	// Small static objects merged into one BLAS, one geometry per submesh with its object's transform baked in.
+	// The batch's single TLAS instance has an identity transform, geometry g maps to ObjDesc[instanceCustomIndex + g].
+	struct StaticBatch {
+		AccelerationStructure blas;
+		Buffer transformBuffer; // Object transform of every geometry, read by the build and by hit shaders.
+		std::vector<Handle<Object>> objects;
+		uint32_t shaderHitGroupOffset;
+		uint32_t geometryCount = 0;
+		uint32_t firstDescription = 0; // Object description of the first geometry.
+	};
+
+	// BLAS of a device build batch, compacted by the first update after the batch completed.
+	struct PendingCompaction {
+		std::vector<AccelerationStructure*> blas; // nullptr once the BLAS was destroyed before its compaction.
+		VkQueryPool queryPool = VK_NULL_HANDLE;   // Compacted size of every BLAS, in the same order.
+		ComputeToken token;
 	};
 
 	class Scene {
@@ -31,24 +58,46 @@ namespace core {
 		void setup();
 		void cleanup();
 		void update();
+		// Drops the BLAS from the pending compactions of every scene, must be called before the BLAS is destroyed.
+		static void cancelCompaction(const AccelerationStructure* blas);
+
+		Handle<Camera> addCamera(glm::mat4 transform, const float& fov, const float& aspectRatio, const float& n = 0.01f, const float& f = 1000.f);
+		// Static objects never move once added, moving one anyway rebuilds every static batch.
+		Handle<Object> addObject(Mesh* mesh, std::vector<Handle<Material>> materials, glm::mat4 transform, uint32_t shader, const bool isStatic = false);
+		Handle<Material> addMaterial(Texture* albedoMap, glm::vec3 albedo, Texture* metallicMap, float metallic, float smoothness, Texture* normalMap, glm::vec2 tilling, glm::vec2 offset);
+		// Removed objects leave the TLAS on the next update, every handle to them becomes stale.
+		void removeObject(const Handle<Object>& object);
+		// Materials must no longer be used by any object, their pool region is recycled once no frame in flight reads it.
+		void removeMaterial(const Handle<Material>& material);
+		// Removing the main camera makes the first remaining camera the main camera.
+		void removeCamera(const Handle<Camera>& camera);
 
-		Camera* addCamera(glm::mat4 transform, const float& fov, const float& aspectRatio, const float& n = 0.01f, const float& f = 1000.f);
-		Object* addObject(Mesh* mesh, std::vector<Material*> materials, glm::mat4 transform, uint32_t shader);
-		Material* addMaterial(Texture* albedoMap, glm::vec3 albedo, Texture* metallicMap, float metallic, float smoothness, Texture* normalMap, glm::vec2 tilling, glm::vec2 offset);
+		// Moves an object, its TLAS instances are refitted on the next recorded frame.
+		void setTransform(const Handle<Object>& object, const glm::mat4& transform);
+		// Records the vertex uploads and refits for objects moved and meshes deformed since the last call, before any draw or trace.
+		void recordAccelerationStructureUpdate(const VkCommandBuffer& commandBuffer, FrameSuballocator& frameAllocator);
 
-		Camera& getMainCamera() { return *mainCamera; }
-		void setMainCamera(Camera* camera);
+		// Lookups return nullptr for stale handles.
+		Camera* getCamera(const Handle<Camera>& camera) { return cameras.get(camera); }
+		Object* getObject(const Handle<Object>& object) { return objects.get(object); }
+		Material* getMaterial(const Handle<Material>& material) { return materials.get(material); }
 
-		std::vector<Object>& getObjects() { return objects; }
+		Camera& getMainCamera() { return cameras.at(mainCamera); }
+		void setMainCamera(const Handle<Camera>& camera);
+
+		ResourcePool<Object>& getObjects() { return objects; }
+		ResourcePool<Material>& getMaterials() { return materials; }
 		AccelerationStructure& getTLAS() { return tlas; }
 		std::vector<Texture*>& getTextures() { return textures; }
 		Buffer& getObjDescriptions() { return objDescBuffer; }
+		// Object BVH for CPU ray and overlap queries, rebuilt first when objects were added or removed, refitted when they moved or deformed.
+		SceneBVH& getBVH();
 
 	private:
-		Camera* mainCamera;
-		std::vector<Camera*> cameras;
-		std::vector<Object> objects;
-		std::vector<Material*> materials;
+		Handle<Camera> mainCamera;
+		ResourcePool<Camera> cameras;
+		ResourcePool<Object> objects;
+		ResourcePool<Material> materials;
 		std::unordered_set<Mesh*> meshes;
 		std::map<Texture*, uint16_t> textureIndices;
 
@@ -56,10 +105,40 @@ namespace core {
 		std::vector<ObjDesc> objDescriptions;
 
 		AccelerationStructure tlas;
+		Buffer instanceBuffer;    // Persistent TLAS instances, rewritten in place for moved objects.
+		Buffer tlasScratchBuffer; // Kept for the per-frame TLAS refits.
+		Buffer blasScratchBuffer; // Grown on demand for the per-frame refits of deformable BLAS.
+		VkDeviceSize blasScratchSize = 0;
+		uint32_t instanceCount = 0;
+		Buffer instanceUploadBuffer;          // Mapped ring of MAX_FRAMES_IN_FLIGHT ranges staging the instances of moved objects.
+		uint32_t instanceUploadCapacity = 0;  // Instances per range, grown on demand.
+		uint32_t instanceUploadIndex = 0;     // Range used by the next recorded frame.
+		std::list<StaticBatch> staticBatches; // Listed so the defragmenter can patch their BLAS in place.
+		std::vector<Handle<Object>> dirtyObjects; // Moved since the last recorded frame.
+		bool topologyChanged = false; // Objects were added or removed since the last TLAS build.
+		std::unordered_set<Mesh*> pendingCacheMeshes; // Built meshes stored to the BLAS cache once their builds and compaction completed.
+		ComputeToken pendingCacheToken;
+		std::vector<PendingCompaction> pendingCompactions; // In submission order.
+		SceneBVH queryBVH;
+		bool queryBVHChanged = true;  // Objects were added or removed since the last query BVH build.
+		std::vector<Handle<Object>> queryBVHMoved; // Moved since the last query, refitted into the query BVH.
 		Buffer objDescBuffer;
+		PoolSuballocator materialPool; // Backing buffers of every material's data.
+		uint32_t relocationListener = 0;
+
+		void buildAccelerationStructure(ResourcePool<Object>& objects, std::unordered_set<Mesh*>& meshes);
+		void rebuildAccelerationStructure(ResourcePool<Object>& objects, std::unordered_set<Mesh*>& meshes);
+		void buildTLAS(ResourcePool<Object>& objects);
+		// Returns true when BLAS were replaced by their compacted copies.
+		bool compactPendingBLAS();
 
-		void buildAccelerationStructure(std::vector<Object>& objects, std::unordered_set<Mesh*>& meshes);
-		void createObjectDescriptions(std::vector<Object>& objects);
+		static std::vector<Scene*> scenes; // Live scenes, searched by cancelCompaction.
+		void createStaticBatches(ResourcePool<Object>& objects);
+		void buildStaticBatches();
+		void destroyStaticBatches();
+		void createObjectDescriptions(ResourcePool<Object>& objects);
+		void fetchObjectDescriptions(ResourcePool<Object>& objects);
+		void onResourcesRelocated(const RelocationFlags& flags);
 
 	};
 }
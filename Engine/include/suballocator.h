@@ -0,0 +1,103 @@
+#pragma once
+#include <resource_allocator.h>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <atomic>
+
+namespace core {
+
+	// Range of a large backing buffer handed out by a suballocator.
+	struct BufferRegion {
+		Buffer buffer;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		VkDeviceAddress address = 0; // Device address of the region (0 if the backing buffer has none).
+		bool isValid() { return buffer.isCreated(); }
+		// Host pointer to the region (nullptr if the backing buffer is not mapped).
+		void* getMapped() { return buffer.mapped != nullptr ? static_cast<uint8_t*>(buffer.mapped) + offset : nullptr; }
+	};
+
+	// Bump allocator for same-lifetime data, every region is released at once by reset() or cleanup().
+	class LinearSuballocator {
+	public:
+		LinearSuballocator(const VkDeviceSize& blockSize, const VkDeviceSize& alignment, const VkBufferUsageFlags& usage, const MemoryUsage& memoryUsage);
+		~LinearSuballocator();
+
+		void cleanup();
+		void reset();
+		BufferRegion allocate(const VkDeviceSize& size);
+
+	private:
+		struct Block {
+			Buffer buffer;
+			VkDeviceAddress address;
+			VkDeviceSize size;
+			VkDeviceSize head;
+		};
+
+		VkDeviceSize blockSize;
+		VkDeviceSize alignment;
+		VkBufferUsageFlags usage;
+		MemoryUsage memoryUsage;
+		std::vector<Block> blocks;
+
+		Block& createBlock(const VkDeviceSize& size);
+	};
+
+	// Fixed-size slot allocator, regions can be freed individually and are recycled.
+	// Freed regions are only handed out again once no frame in flight can still read them.
+	class PoolSuballocator {
+	public:
+		PoolSuballocator(const VkDeviceSize& elementSize, const uint32_t& elementsPerBlock, const VkDeviceSize& alignment, const VkBufferUsageFlags& usage, const MemoryUsage& memoryUsage);
+		~PoolSuballocator();
+
+		void cleanup();
+		BufferRegion allocate();
+		void free(const BufferRegion& region);
+
+	private:
+		struct Block {
+			Buffer buffer;
+			VkDeviceAddress address;
+		};
+
+		VkDeviceSize elementSize;
+		VkDeviceSize stride;
+		uint32_t elementsPerBlock;
+		VkBufferUsageFlags usage;
+		MemoryUsage memoryUsage;
+		std::vector<Block> blocks;
+		std::vector<BufferRegion> freeRegions;
+		std::deque<std::pair<uint64_t, BufferRegion>> releasedRegions; // Frame of release and region.
+
+		void createBlock();
+	};
+
+	// Per-frame-in-flight bump allocator over one persistently mapped buffer.
+	// A frame's regions are recycled by beginFrame(), only once that frame's fence has signaled.
+	class FrameSuballocator {
+	public:
+		FrameSuballocator(const VkDeviceSize& frameSize, const VkDeviceSize& alignment, const VkBufferUsageFlags& usage);
+		~FrameSuballocator();
+
+		void cleanup();
+		void beginFrame(const uint32_t frameIndex);
+		BufferRegion allocate(const VkDeviceSize& size);
+		BufferRegion push(const void* data, const VkDeviceSize& size);
+		template<typename T> BufferRegion push(const T& data) { return push(&data, sizeof(T)); }
+		// Flushes everything written during the current frame (no-op on coherent memory).
+		void flush();
+
+		Buffer& getBuffer() { return buffer; }
+		VkDeviceSize getFrameSize() { return frameSize; }
+
+	private:
+		Buffer buffer;
+		VkDeviceAddress address;
+		VkDeviceSize frameSize;
+		VkDeviceSize alignment;
+		uint32_t frameIndex;
+		std::atomic<VkDeviceSize> head;
+	};
+}
@@ -1,15 +1,18 @@
 #version 460
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
+#extension GL_EXT_buffer_reference : require
 
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inUV;
 
-layout(push_constant) uniform constants {
-    mat4 proj;
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer DrawData {
     mat4 world;
-    mat4 view;
     uint64_t materialAddress;
+};
+
+layout(push_constant) uniform constants {
+    DrawData drawData;
 } PushConstants;
 
 layout(binding = 0, set = 0) uniform CameraUniforms {
@@ -22,8 +25,9 @@ layout(location = 1) out vec3 fragColor;
 layout(location = 2) out vec2 outUV;
 
 void main() {
-    gl_Position = PushConstants.proj * PushConstants.view * PushConstants.world * vec4(inPosition, 1.0);
-    materialAddress = PushConstants.materialAddress;
+    DrawData drawData = PushConstants.drawData;
+    gl_Position = camera.viewProj * drawData.world * vec4(inPosition, 1.0);
+    materialAddress = drawData.materialAddress;
     fragColor = inColor;
     outUV = inUV;
 }
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include <acceleration_structure_cache.h>
+#include <engine_context.h>
+#include <engine_globals.h>
+#include <resource_allocator.h>
+#include <defragmenter.h>
+#include <async_compute.h>
+#include <file_reader.h>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+#define BLAS_CACHE_HEADER (('S'<<24)+('A'<<16)+('L'<<8)+'B')
+
+namespace core {
+
+	// Bumped whenever the layout of cache files changes.
+	const uint32_t BLAS_CACHE_VERSION = 1;
+	// Serialized data must be placed at 256 byte aligned device addresses.
+	const VkDeviceSize SERIALIZATION_ALIGNMENT = 256;
+
+	struct CacheFileHeader {
+		uint32_t identifier;   // Used to determine byte order.
+		uint32_t version;
+		uint32_t submeshCount; // One serialized BLAS per submesh follows, each prefixed by its size.
+	};
+
+	std::string AccelerationStructureCache::getFilepath(Mesh* mesh) {
+		static const char* digits = "0123456789abcdef";
+		std::string name;
+		uint64_t hash = mesh->getContentHash();
+		for (int32_t shift = 60; shift >= 0; shift -= 4) {
+			name += digits[(hash >> shift) & 0xF];
+		}
+		name += '_';
+		const uint8_t* driverUUID = EngineContext::getPhysicalDeviceProperties().idProperties.driverUUID;
+		for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+			name += digits[driverUUID[i] >> 4];
+			name += digits[driverUUID[i] & 0xF];
+		}
+		return MESH_FOLDER_PATH + name + ".blas";
+	}
+
+	bool AccelerationStructureCache::readFile(Mesh* mesh, std::vector<std::vector<uint8_t>>& blobs) {
+		// A missing file is a cache miss, not an error.
+		std::ifstream stream(getFilepath(mesh), std::ios::binary);
+		if (!stream) return false;
+
+		CacheFileHeader header;
+		stream.read((char*)&header, sizeof(CacheFileHeader));
+		if (!stream || header.identifier != BLAS_CACHE_HEADER || header.version != BLAS_CACHE_VERSION || header.submeshCount != mesh->getSubmeshCount()) return false;
+
+		VkDevice device = EngineContext::getDevice();
+		const uint8_t* driverUUID = EngineContext::getPhysicalDeviceProperties().idProperties.driverUUID;
+		blobs.resize(header.submeshCount);
+		for (uint32_t i = 0; i < header.submeshCount; i++) {
+			uint64_t size = 0;
+			stream.read((char*)&size, sizeof(uint64_t));
+			if (!stream || size < sizeof(SerializedAccelerationStructureHeader)) return false;
+			blobs[i].resize(size);
+			stream.read((char*)blobs[i].data(), size);
+			if (!stream) return false;
+
+			// Data serialized by another driver, or by an incompatible version of it, must be rebuilt.
+			const SerializedAccelerationStructureHeader* serialized = (const SerializedAccelerationStructureHeader*)blobs[i].data();
+			if (serialized->serializedSize != size || memcmp(serialized->driverUUID, driverUUID, VK_UUID_SIZE) != 0) return false;
+
+			VkAccelerationStructureVersionInfoKHR versionInfo{};
+			versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+			versionInfo.pVersionData = blobs[i].data();
+			VkAccelerationStructureCompatibilityKHR compatibility;
+			vkGetDeviceAccelerationStructureCompatibilityKHR(device, &versionInfo, &compatibility);
+			if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) return false;
+		}
+		return true;
+	}
+
+	void AccelerationStructureCache::writeFile(Mesh* mesh, const std::vector<const uint8_t*>& blobs, const std::vector<VkDeviceSize>& sizes) {
+		std::string filepath = getFilepath(mesh);
+		std::ofstream stream(filepath, std::ios::binary | std::ios::trunc);
+		if (!stream) {
+			std::cerr << "Error: BLAS cache file '" << filepath << "' could not be written." << std::endl;
+			return;
+		}
+
+		CacheFileHeader header = {BLAS_CACHE_HEADER, BLAS_CACHE_VERSION, static_cast<uint32_t>(blobs.size())};
+		stream.write((const char*)&header, sizeof(CacheFileHeader));
+		for (size_t i = 0; i < blobs.size(); i++) {
+			uint64_t size = sizes[i];
+			stream.write((const char*)&size, sizeof(uint64_t));
+			stream.write((const char*)blobs[i], size);
+		}
+	}
+
+	std::unordered_set<Mesh*> AccelerationStructureCache::load(const std::unordered_set<Mesh*>& meshes) {
+		ALLOCATION_TAG("AccelerationStructureCache::load");
+		// Read every cache file, meshes without a valid one are built as usual.
+		std::unordered_set<Mesh*> uncached;
+		std::vector<Mesh*> cached;
+		std::vector<std::vector<std::vector<uint8_t>>> cachedBlobs;
+		for (auto mesh : meshes) {
+			std::vector<std::vector<uint8_t>> blobs;
+			if (mesh->isDeformable() || mesh->getSubmeshCount() == 0 || !readFile(mesh, blobs)) {
+				uncached.insert(mesh);
+				continue;
+			}
+			cached.push_back(mesh);
+			cachedBlobs.push_back(std::move(blobs));
+		}
+		if (cached.empty()) return uncached;
+
+		// Stage all serialized data into one buffer, every BLAS at an aligned offset.
+		std::vector<std::vector<VkDeviceSize>> offsets(cached.size());
+		VkDeviceSize stagingSize = 0;
+		for (size_t i = 0; i < cached.size(); i++) {
+			for (auto& blob : cachedBlobs[i]) {
+				offsets[i].push_back(stagingSize);
+				stagingSize += (blob.size() + SERIALIZATION_ALIGNMENT - 1) & ~(SERIALIZATION_ALIGNMENT - 1);
+			}
+		}
+		Buffer stagingBuffer;
+		ResourceAllocator::createBufferWithAlignment(stagingSize, SERIALIZATION_ALIGNMENT, stagingBuffer, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MEMORY_USAGE_UPLOAD);
+		for (size_t i = 0; i < cached.size(); i++) {
+			for (size_t j = 0; j < cachedBlobs[i].size(); j++) {
+				memcpy((uint8_t*)stagingBuffer.mapped + offsets[i][j], cachedBlobs[i][j].data(), cachedBlobs[i][j].size());
+			}
+		}
+		ResourceAllocator::flushBuffer(stagingBuffer);
+
+		// Deserialize each BLAS into an allocation of the size recorded by the driver.
+		VkCommandBuffer cmdBuffer = AsyncCompute::begin();
+		for (size_t i = 0; i < cached.size(); i++) {
+			for (uint32_t j = 0; j < cached[i]->getSubmeshCount(); j++) {
+				const SerializedAccelerationStructureHeader* serialized = (const SerializedAccelerationStructureHeader*)cachedBlobs[i][j].data();
+				AccelerationStructure& blas = cached[i]->getSubmesh(j).getBLAS();
+				ResourceAllocator::createAccelerationStructure(serialized->deserializedSize, blas, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+
+				VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+				copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+				copyInfo.src.deviceAddress = stagingBuffer.getDeviceAddress() + offsets[i][j];
+				copyInfo.dst = blas.handle;
+				copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+				vkCmdCopyMemoryToAccelerationStructureKHR(cmdBuffer, &copyInfo);
+			}
+		}
+
+		// The deserialized BLAS are read by later builds and copies.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		// Deserialization runs on the async compute queue ahead of the builds, nothing waits for it on the host.
+		ComputeToken token = AsyncCompute::submit();
+		AsyncCompute::releaseAfter(token, [stagingBuffer]() { ResourceAllocator::destroyBuffer(stagingBuffer); });
+
+		for (size_t i = 0; i < cached.size(); i++) {
+			for (uint32_t j = 0; j < cached[i]->getSubmeshCount(); j++) {
+				const SerializedAccelerationStructureHeader* serialized = (const SerializedAccelerationStructureHeader*)cachedBlobs[i][j].data();
+				Defragmenter::registerAccelerationStructure(cached[i]->getSubmesh(j).getBLAS(), serialized->deserializedSize, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+			}
+		}
+		return uncached;
+	}
+
+	void AccelerationStructureCache::store(const std::unordered_set<Mesh*>& meshes) {
+		ALLOCATION_TAG("AccelerationStructureCache::store");
+		VkDevice device = EngineContext::getDevice();
+
+		// Gather the BLASes of every static mesh.
+		std::vector<Mesh*> stored;
+		std::vector<VkAccelerationStructureKHR> handles;
+		for (auto mesh : meshes) {
+			if (mesh->isDeformable() || mesh->getSubmeshCount() == 0) continue;
+			stored.push_back(mesh);
+			for (uint32_t i = 0; i < mesh->getSubmeshCount(); i++) {
+				handles.push_back(mesh->getSubmesh(i).getBLAS().handle);
+			}
+		}
+		if (handles.empty()) return;
+		uint32_t handleCount = static_cast<uint32_t>(handles.size());
+
+		VkQueryPoolCreateInfo queryPoolInfo{};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryCount = handleCount;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+		VkQueryPool queryPool;
+		VK_CHECK(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool));
+
+		// Builds and compaction copies must be visible before the BLASes are read.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+
+		// Fetch serialization sizes.
+		VkCommandBuffer cmdBuffer = AsyncCompute::begin();
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		vkCmdResetQueryPool(cmdBuffer, queryPool, 0, handleCount);
+		vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer, handleCount, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, queryPool, 0);
+		AsyncCompute::wait(AsyncCompute::submit());
+
+		std::vector<VkDeviceSize> sizes(handleCount);
+		VK_CHECK(vkGetQueryPoolResults(device, queryPool, 0, handleCount, handleCount * sizeof(VkDeviceSize), sizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_64_BIT));
+		vkDestroyQueryPool(device, queryPool, nullptr);
+
+		// Serialize every BLAS into one readback buffer at aligned offsets.
+		std::vector<VkDeviceSize> offsets(handleCount);
+		VkDeviceSize readbackSize = 0;
+		for (uint32_t i = 0; i < handleCount; i++) {
+			offsets[i] = readbackSize;
+			readbackSize += (sizes[i] + SERIALIZATION_ALIGNMENT - 1) & ~(SERIALIZATION_ALIGNMENT - 1);
+		}
+		Buffer readbackBuffer;
+		ResourceAllocator::createBufferWithAlignment(readbackSize, SERIALIZATION_ALIGNMENT, readbackBuffer, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MEMORY_USAGE_READBACK);
+
+		cmdBuffer = AsyncCompute::begin();
+		for (uint32_t i = 0; i < handleCount; i++) {
+			VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+			copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+			copyInfo.src = handles[i];
+			copyInfo.dst.deviceAddress = readbackBuffer.getDeviceAddress() + offsets[i];
+			copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+			vkCmdCopyAccelerationStructureToMemoryKHR(cmdBuffer, &copyInfo);
+		}
+		// Serialization writes the buffer as a transfer write of the acceleration structure build stage.
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		AsyncCompute::wait(AsyncCompute::submit());
+		VK_CHECK(vmaInvalidateAllocation(ResourceAllocator::getAllocator(), readbackBuffer.allocation, 0, VK_WHOLE_SIZE));
+
+		// Write one file per mesh.
+		uint32_t first = 0;
+		for (auto mesh : stored) {
+			uint32_t submeshCount = mesh->getSubmeshCount();
+			std::vector<const uint8_t*> blobs(submeshCount);
+			std::vector<VkDeviceSize> blobSizes(sizes.begin() + first, sizes.begin() + first + submeshCount);
+			for (uint32_t i = 0; i < submeshCount; i++) {
+				blobs[i] = (const uint8_t*)readbackBuffer.mapped + offsets[first + i];
+			}
+			writeFile(mesh, blobs, blobSizes);
+			first += submeshCount;
+		}
+		ResourceAllocator::destroyBuffer(readbackBuffer);
+	}
+}
@@ -0,0 +1,173 @@
+#include <allocation_tracer.h>
+#include <resource_allocator.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <map>
+
+namespace core {
+
+	AllocationTracer::TraceSlot AllocationTracer::ring[ALLOCATION_TRACE_RING_SIZE];
+	std::atomic<uint64_t> AllocationTracer::writeIndex{ 0 };
+	uint64_t AllocationTracer::readIndex = 0;
+	uint64_t AllocationTracer::droppedEvents = 0;
+	std::unordered_map<uint64_t, AllocationEvent> AllocationTracer::liveAllocations;
+	std::vector<AllocationEvent> AllocationTracer::timeline;
+	thread_local const char* AllocationTracer::currentTag = nullptr;
+
+	static const auto traceStart = std::chrono::steady_clock::now();
+
+	static const char* getResourceTypeName(const AllocationResourceType& type) {
+		switch (type) {
+			case ALLOCATION_RESOURCE_BUFFER: return "buffer";
+			case ALLOCATION_RESOURCE_IMAGE: return "image";
+			default: return "memory";
+		}
+	}
+
+	// Tags are string literals, only quotes and backslashes need escaping.
+	static std::string escapeJson(const char* text) {
+		std::string escaped;
+		for (const char* c = text; *c != '\0'; c++) {
+			if (*c == '"' || *c == '\\') escaped += '\\';
+			escaped += *c;
+		}
+		return escaped;
+	}
+
+	void AllocationTracer::record(AllocationEventType type, AllocationResourceType resourceType, uint64_t id, VkDeviceSize size, uint32_t usage, uint32_t category, uint64_t frame) {
+		uint64_t index = writeIndex.fetch_add(1, std::memory_order_relaxed);
+		TraceSlot& slot = ring[index & (ALLOCATION_TRACE_RING_SIZE - 1)];
+
+		// Mark the slot as being written so a lagging reader cannot consume a torn event.
+		slot.sequence.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.event.type = type;
+		slot.event.resourceType = resourceType;
+		slot.event.id = id;
+		slot.event.size = size;
+		slot.event.usage = usage;
+		slot.event.category = category;
+		slot.event.tag = (currentTag != nullptr) ? currentTag : "untagged";
+		slot.event.frame = frame;
+		slot.event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+		slot.sequence.store(index + 1, std::memory_order_release);
+	}
+
+	void AllocationTracer::collect() {
+		uint64_t endIndex = writeIndex.load(std::memory_order_acquire);
+
+		// Events older than a full ring were overwritten before being collected.
+		if (endIndex - readIndex > ALLOCATION_TRACE_RING_SIZE) {
+			droppedEvents += endIndex - readIndex - ALLOCATION_TRACE_RING_SIZE;
+			readIndex = endIndex - ALLOCATION_TRACE_RING_SIZE;
+		}
+
+		for (; readIndex < endIndex; readIndex++) {
+			TraceSlot& slot = ring[readIndex & (ALLOCATION_TRACE_RING_SIZE - 1)];
+			uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence < readIndex + 1) break; // Still being written, picked up by the next collection.
+
+			AllocationEvent event = slot.event;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence != readIndex + 1 || slot.sequence.load(std::memory_order_relaxed) != sequence) {
+				// Overwritten by a writer that lapped the ring.
+				droppedEvents++;
+				continue;
+			}
+
+			if (event.type == ALLOCATION_EVENT_CREATE) {
+				liveAllocations[event.id] = event;
+			} else {
+				liveAllocations.erase(event.id);
+			}
+			if (timeline.size() < ALLOCATION_TRACE_TIMELINE_SIZE) {
+				timeline.push_back(event);
+			} else {
+				droppedEvents++;
+			}
+		}
+	}
+
+	//***************************************************************************************//
+	//                                        Reports                                        //
+	//***************************************************************************************//
+
+	std::string AllocationTracer::getLeakReport() {
+		collect();
+
+		struct TagLeaks {
+			uint64_t count = 0;
+			VkDeviceSize bytes = 0;
+			std::vector<const AllocationEvent*> allocations;
+		};
+		std::map<std::string, TagLeaks> leaks;
+		for (const auto& allocation : liveAllocations) {
+			TagLeaks& tagLeaks = leaks[allocation.second.tag];
+			tagLeaks.count++;
+			tagLeaks.bytes += allocation.second.size;
+			tagLeaks.allocations.push_back(&allocation.second);
+		}
+
+		std::ostringstream report;
+		if (leaks.empty()) {
+			report << "No live allocations." << std::endl;
+		} else {
+			report << liveAllocations.size() << " live allocation(s):" << std::endl;
+			for (auto& tagLeaks : leaks) {
+				report << "  " << tagLeaks.first << ": " << tagLeaks.second.count << " allocation(s), " << tagLeaks.second.bytes << " bytes" << std::endl;
+				std::sort(tagLeaks.second.allocations.begin(), tagLeaks.second.allocations.end(), [](const AllocationEvent* a, const AllocationEvent* b) { return a->timestamp < b->timestamp; });
+				for (const AllocationEvent* allocation : tagLeaks.second.allocations) {
+					report << "    " << getResourceTypeName(allocation->resourceType) << " (" << ResourceAllocator::getAllocationCategoryName(static_cast<AllocationCategory>(allocation->category)) << ")"
+						<< ", " << allocation->size << " bytes, usage 0x" << std::hex << allocation->usage << std::dec << ", frame " << allocation->frame << std::endl;
+				}
+			}
+		}
+		if (droppedEvents > 0) {
+			report << "Warning: " << droppedEvents << " event(s) were dropped, the report may be incomplete." << std::endl;
+		}
+		return report.str();
+	}
+
+	void AllocationTracer::printLeakReport() {
+		std::cout << getLeakReport();
+	}
+
+	void AllocationTracer::exportTimeline(const std::string& filepath) {
+		collect();
+
+		// Allocation and free events are instant events, per-category usage is a counter track.
+		std::ostringstream json;
+		json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		VkDeviceSize categoryBytes[ALLOCATION_CATEGORY_COUNT] = {};
+		bool first = true;
+		for (const AllocationEvent& event : timeline) {
+			const char* categoryName = ResourceAllocator::getAllocationCategoryName(static_cast<AllocationCategory>(event.category));
+			double timestamp = event.timestamp / 1000.0;
+			bool created = event.type == ALLOCATION_EVENT_CREATE;
+			if (event.category < ALLOCATION_CATEGORY_COUNT) {
+				categoryBytes[event.category] = created ? categoryBytes[event.category] + event.size : categoryBytes[event.category] - std::min(categoryBytes[event.category], event.size);
+			}
+
+			json << (first ? "" : ",") << "{\"name\":\"" << (created ? "create " : "destroy ") << escapeJson(event.tag) << "\",\"cat\":\"" << categoryName
+				<< "\",\"ph\":\"i\",\"s\":\"p\",\"pid\":1,\"tid\":1,\"ts\":" << timestamp
+				<< ",\"args\":{\"type\":\"" << getResourceTypeName(event.resourceType) << "\",\"size\":" << event.size << ",\"usage\":" << event.usage
+				<< ",\"frame\":" << event.frame << ",\"id\":" << event.id << "}}";
+			first = false;
+
+			json << ",{\"name\":\"GPU memory\",\"ph\":\"C\",\"pid\":1,\"ts\":" << timestamp << ",\"args\":{";
+			for (uint32_t i = 0; i < ALLOCATION_CATEGORY_COUNT; i++) {
+				json << (i == 0 ? "" : ",") << "\"" << ResourceAllocator::getAllocationCategoryName(static_cast<AllocationCategory>(i)) << "\":" << categoryBytes[i];
+			}
+			json << "}}";
+		}
+		json << "]}";
+
+		std::ofstream file(filepath);
+		if (!file.is_open()) throw std::runtime_error("Failed to open " + filepath + " for writing.");
+		file << json.str();
+	}
+}
@@ -0,0 +1,162 @@
+#include <async_compute.h>
+#include <engine_globals.h>
+
+namespace core {
+
+	VkDevice AsyncCompute::device = VK_NULL_HANDLE;
+	VkQueue AsyncCompute::queue = VK_NULL_HANDLE;
+	uint32_t AsyncCompute::queueFamilyIndex = 0;
+	VkCommandPool AsyncCompute::commandPool = VK_NULL_HANDLE;
+	VkSemaphore AsyncCompute::semaphore = VK_NULL_HANDLE;
+	uint64_t AsyncCompute::semaphoreValue = 0;
+	VkSemaphore AsyncCompute::graphicsSemaphore = VK_NULL_HANDLE;
+	uint64_t AsyncCompute::graphicsSemaphoreValue = 0;
+	std::vector<UploadContext> AsyncCompute::contexts;
+	int32_t AsyncCompute::activeContext = -1;
+	std::deque<ComputeRelease> AsyncCompute::releases;
+
+	void AsyncCompute::setup(const VkDevice& device, const VkQueue& queue, const uint32_t queueFamilyIndex) {
+		AsyncCompute::device = device;
+		AsyncCompute::queue = queue;
+		AsyncCompute::queueFamilyIndex = queueFamilyIndex;
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		poolInfo.queueFamilyIndex = queueFamilyIndex;
+		VK_CHECK_MSG(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool), "Failed to create async compute command pool.");
+
+		VkSemaphoreTypeCreateInfo timelineSemaphoreInfo{};
+		timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		timelineSemaphoreInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		timelineSemaphoreInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &timelineSemaphoreInfo;
+		VK_CHECK_MSG(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore), "Failed to create async compute timeline semaphore.");
+		VK_CHECK_MSG(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &graphicsSemaphore), "Failed to create graphics timeline semaphore.");
+		semaphoreValue = 0;
+		graphicsSemaphoreValue = 0;
+	}
+
+	void AsyncCompute::cleanup() {
+		wait(getLastToken());
+		update();
+		vkDestroySemaphore(device, semaphore, nullptr);
+		vkDestroySemaphore(device, graphicsSemaphore, nullptr);
+		vkDestroyCommandPool(device, commandPool, nullptr);
+		contexts.clear();
+		activeContext = -1;
+	}
+
+	VkCommandBuffer AsyncCompute::begin() {
+		DEBUG_ASSERT_MSG(activeContext < 0, "Async compute command buffer already open.");
+
+		// Reuse a command buffer whose previous submission has completed.
+		uint64_t completedValue;
+		VK_CHECK(vkGetSemaphoreCounterValue(device, semaphore, &completedValue));
+		for (size_t i = 0; i < contexts.size() && activeContext < 0; i++) {
+			if (contexts[i].timelineValue <= completedValue) activeContext = static_cast<int32_t>(i);
+		}
+
+		// Otherwise allocate a new one.
+		if (activeContext < 0) {
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandPool = commandPool;
+			allocInfo.commandBufferCount = 1;
+
+			UploadContext context{};
+			VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &context.commandBuffer));
+			contexts.push_back(context);
+			activeContext = static_cast<int32_t>(contexts.size() - 1);
+		}
+
+		VkCommandBuffer commandBuffer = contexts[activeContext].commandBuffer;
+		VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+		return commandBuffer;
+	}
+
+	ComputeToken AsyncCompute::submit() {
+		DEBUG_ASSERT_MSG(activeContext >= 0, "No async compute command buffer open.");
+		UploadContext& context = contexts[activeContext];
+		VK_CHECK(vkEndCommandBuffer(context.commandBuffer));
+
+		// Builds read vertex and index buffers, wait for the last upload batch so none of them is still being written.
+		// BLAS refitted in place by graphics frames are read too, wait for the last graphics submission.
+		const UploadToken upload = ResourceAllocator::getLastUploadToken();
+		const VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+		VkSemaphore waitSemaphores[2];
+		uint64_t waitValues[2];
+		uint32_t waitCount = 0;
+		if (upload.value != 0) {
+			waitSemaphores[waitCount] = upload.semaphore;
+			waitValues[waitCount++] = upload.value;
+		}
+		if (graphicsSemaphoreValue != 0) {
+			waitSemaphores[waitCount] = graphicsSemaphore;
+			waitValues[waitCount++] = graphicsSemaphoreValue;
+		}
+
+		const uint64_t signalValue = ++semaphoreValue;
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = waitCount;
+		timelineInfo.pWaitSemaphoreValues = waitValues;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = waitCount;
+		submitInfo.pWaitSemaphores = waitSemaphores;
+		submitInfo.pWaitDstStageMask = waitStages;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &context.commandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+		submitInfo.pNext = &timelineInfo;
+
+		VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		context.timelineValue = signalValue;
+		activeContext = -1;
+		return { semaphore, signalValue };
+	}
+
+	void AsyncCompute::wait(const ComputeToken& token) {
+		if (token.value == 0) return;
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &token.semaphore;
+		waitInfo.pValues = &token.value;
+		VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+	}
+
+	bool AsyncCompute::isComplete(const ComputeToken& token) {
+		uint64_t completedValue;
+		VK_CHECK(vkGetSemaphoreCounterValue(device, token.semaphore, &completedValue));
+		return completedValue >= token.value;
+	}
+
+	void AsyncCompute::releaseAfter(const ComputeToken& token, std::function<void()>&& release) {
+		releases.push_back({ token.value, std::move(release) });
+	}
+
+	void AsyncCompute::update() {
+		// Submissions complete in order, so do their releases.
+		uint64_t completedValue;
+		VK_CHECK(vkGetSemaphoreCounterValue(device, semaphore, &completedValue));
+		while (!releases.empty() && releases.front().timelineValue <= completedValue) {
+			releases.front().release();
+			releases.pop_front();
+		}
+	}
+}
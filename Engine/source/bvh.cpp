@@ -0,0 +1,599 @@
+#include <bvh.h>
+#include <scene.h>
+#include <future>
+#include <thread>
+#include <cmath>
+#include <functional>
+
+namespace core {
+
+	// Leaves hold at most this many primitives.
+	const uint32_t BVH_MAX_LEAF_SIZE = 4;
+	const uint32_t SAH_BIN_COUNT = 16;
+	// Subtrees with fewer primitives are built on the thread that reached them.
+	const uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+	// Deeper nodes fall back to median splits, bounding the depth so traversal stacks cannot overflow.
+	const uint32_t MAX_SAH_DEPTH = 24;
+
+	bool SceneBVH::enabled = false;
+
+	struct BVHBuildContext {
+		const std::vector<BoundingBox>& bounds;
+		std::vector<glm::vec3> centroids;
+		std::vector<uint32_t>& primitiveIndices;
+		uint32_t parallelDepth; // Nodes above this depth build their large subtrees on separate threads.
+	};
+
+	//***************************************************************************************//
+	//                                     Bounding Box                                      //
+	//***************************************************************************************//
+
+	bool BoundingBox::overlaps(const BoundingBox& box) const {
+		return min.x <= box.max.x && max.x >= box.min.x && min.y <= box.max.y && max.y >= box.min.y && min.z <= box.max.z && max.z >= box.min.z;
+	}
+
+	float BoundingBox::getHalfArea() const {
+		glm::vec3 extent = max - min;
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	BoundingBox BoundingBox::transform(const glm::mat4& matrix) const {
+		// Projects the box extents on every axis of the matrix (Arvo's method).
+		BoundingBox box;
+		box.min = box.max = glm::vec3(matrix[3]);
+		for (uint32_t i = 0; i < 3; i++) {
+			glm::vec3 a = glm::vec3(matrix[i]) * min[i];
+			glm::vec3 b = glm::vec3(matrix[i]) * max[i];
+			box.min += glm::min(a, b);
+			box.max += glm::max(a, b);
+		}
+		return box;
+	}
+
+	void RayPacket::setRay(const uint32_t lane, const Ray& ray) {
+		originX[lane] = ray.origin.x;
+		originY[lane] = ray.origin.y;
+		originZ[lane] = ray.origin.z;
+		directionX[lane] = ray.direction.x;
+		directionY[lane] = ray.direction.y;
+		directionZ[lane] = ray.direction.z;
+		tMin[lane] = ray.tMin;
+		tMax[lane] = ray.tMax;
+	}
+
+	Ray RayPacket::getRay(const uint32_t lane) const {
+		Ray ray;
+		ray.origin = glm::vec3(originX[lane], originY[lane], originZ[lane]);
+		ray.direction = glm::vec3(directionX[lane], directionY[lane], directionZ[lane]);
+		ray.tMin = tMin[lane];
+		ray.tMax = tMax[lane];
+		return ray;
+	}
+
+	//***************************************************************************************//
+	//                                      BVH Builder                                      //
+	//***************************************************************************************//
+
+	BoundingBox BVH::getNodeBounds(const BVHNode& node) {
+		BoundingBox box;
+		for (uint32_t slot = 0; slot < 4; slot++) {
+			if (node.children[slot] == INVALID_HANDLE_INDEX) continue;
+			box.grow(glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]));
+			box.grow(glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]));
+		}
+		return box;
+	}
+
+	void BVH::setSlot(BVHNode& node, const uint32_t slot, const BoundingBox& box) {
+		node.minX[slot] = box.min.x;
+		node.minY[slot] = box.min.y;
+		node.minZ[slot] = box.min.z;
+		node.maxX[slot] = box.max.x;
+		node.maxY[slot] = box.max.y;
+		node.maxZ[slot] = box.max.z;
+	}
+
+	void BVH::build(const std::vector<BoundingBox>& bounds, uint32_t threadCount) {
+		nodes.clear();
+		primitiveIndices.resize(bounds.size());
+		if (bounds.empty()) return;
+		for (uint32_t i = 0; i < primitiveIndices.size(); i++) {
+			primitiveIndices[i] = i;
+		}
+
+		// Every node level splits the work four ways, spawn threads until each has a subtree.
+		if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+		uint32_t parallelDepth = 0;
+		for (uint32_t subtrees = 1; subtrees < threadCount; subtrees *= 4) {
+			parallelDepth++;
+		}
+
+		BVHBuildContext context = {bounds, std::vector<glm::vec3>(bounds.size()), primitiveIndices, parallelDepth};
+		for (size_t i = 0; i < bounds.size(); i++) {
+			context.centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+		}
+		buildNode(context, nodes, 0, static_cast<uint32_t>(bounds.size()), 0);
+
+		// Link nodes and primitives to their parents for partial refits.
+		parents.assign(nodes.size(), INVALID_HANDLE_INDEX);
+		primitiveNodes.resize(bounds.size());
+		for (uint32_t i = 0; i < nodes.size(); i++) {
+			for (uint32_t slot = 0; slot < 4; slot++) {
+				if (nodes[i].children[slot] == INVALID_HANDLE_INDEX) continue;
+				if (nodes[i].counts[slot] == 0) {
+					parents[nodes[i].children[slot]] = i;
+					continue;
+				}
+				for (uint32_t k = nodes[i].children[slot]; k < nodes[i].children[slot] + nodes[i].counts[slot]; k++) {
+					primitiveNodes[primitiveIndices[k]] = i;
+				}
+			}
+		}
+	}
+
+	uint32_t BVH::buildNode(BVHBuildContext& context, std::vector<BVHNode>& out, const uint32_t begin, const uint32_t end, const uint32_t depth) {
+		uint32_t nodeIndex = static_cast<uint32_t>(out.size());
+		BVHNode emptyNode{};
+		for (uint32_t slot = 0; slot < 4; slot++) {
+			setSlot(emptyNode, slot, BoundingBox());
+			emptyNode.children[slot] = INVALID_HANDLE_INDEX;
+		}
+		out.push_back(emptyNode);
+
+		// Split the range in up to four children, always splitting the largest one.
+		uint32_t ranges[4][2] = {{begin, end}};
+		uint32_t rangeCount = 1;
+		while (rangeCount < 4) {
+			int32_t largest = -1;
+			for (uint32_t i = 0; i < rangeCount; i++) {
+				uint32_t count = ranges[i][1] - ranges[i][0];
+				if (count > BVH_MAX_LEAF_SIZE && (largest < 0 || count > ranges[largest][1] - ranges[largest][0])) largest = i;
+			}
+			if (largest < 0) break;
+
+			uint32_t mid = split(context, ranges[largest][0], ranges[largest][1], depth);
+			ranges[rangeCount][0] = mid;
+			ranges[rangeCount][1] = ranges[largest][1];
+			ranges[largest][1] = mid;
+			rangeCount++;
+		}
+
+		// Large subtrees near the root are built on their own threads into separate node arrays.
+		struct Subtree {
+			uint32_t slot;
+			std::future<std::vector<BVHNode>> nodes;
+		};
+		std::vector<Subtree> subtrees;
+
+		for (uint32_t slot = 0; slot < rangeCount; slot++) {
+			uint32_t first = ranges[slot][0], last = ranges[slot][1];
+			BoundingBox box;
+			for (uint32_t i = first; i < last; i++) {
+				box.grow(context.bounds[context.primitiveIndices[i]]);
+			}
+			setSlot(out[nodeIndex], slot, box);
+
+			uint32_t count = last - first;
+			if (count <= BVH_MAX_LEAF_SIZE) {
+				out[nodeIndex].children[slot] = first;
+				out[nodeIndex].counts[slot] = count;
+			} else if (depth < context.parallelDepth && count >= PARALLEL_BUILD_THRESHOLD) {
+				subtrees.push_back({slot, std::async(std::launch::async, [&context, first, last, depth]() {
+					std::vector<BVHNode> subtree;
+					buildNode(context, subtree, first, last, depth + 1);
+					return subtree;
+				})});
+			} else {
+				uint32_t child = buildNode(context, out, first, last, depth + 1);
+				out[nodeIndex].children[slot] = child;
+			}
+		}
+
+		// Append the threaded subtrees after the node, relocating their inner child indices.
+		for (auto& subtree : subtrees) {
+			std::vector<BVHNode> subtreeNodes = subtree.nodes.get();
+			uint32_t offset = static_cast<uint32_t>(out.size());
+			for (auto& node : subtreeNodes) {
+				for (uint32_t slot = 0; slot < 4; slot++) {
+					if (node.counts[slot] == 0 && node.children[slot] != INVALID_HANDLE_INDEX) node.children[slot] += offset;
+				}
+			}
+			out.insert(out.end(), subtreeNodes.begin(), subtreeNodes.end());
+			out[nodeIndex].children[subtree.slot] = offset;
+		}
+		return nodeIndex;
+	}
+
+	uint32_t BVH::split(BVHBuildContext& context, const uint32_t begin, const uint32_t end, const uint32_t depth) {
+		std::vector<uint32_t>& indices = context.primitiveIndices;
+		BoundingBox centroidBounds;
+		for (uint32_t i = begin; i < end; i++) {
+			centroidBounds.grow(context.centroids[indices[i]]);
+		}
+		glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+
+		if (depth < MAX_SAH_DEPTH) {
+			struct Bin {
+				BoundingBox bounds;
+				uint32_t count = 0;
+			};
+
+			// Bin the centroids on every axis and keep the split plane of lowest SAH cost.
+			float bestCost = FLT_MAX;
+			int32_t bestAxis = -1;
+			uint32_t bestBin = 0;
+			for (int32_t axis = 0; axis < 3; axis++) {
+				if (extent[axis] <= 0.0f) continue;
+				float scale = SAH_BIN_COUNT / extent[axis];
+
+				Bin bins[SAH_BIN_COUNT];
+				for (uint32_t i = begin; i < end; i++) {
+					uint32_t bin = std::min(static_cast<uint32_t>((context.centroids[indices[i]][axis] - centroidBounds.min[axis]) * scale), SAH_BIN_COUNT - 1);
+					bins[bin].count++;
+					bins[bin].bounds.grow(context.bounds[indices[i]]);
+				}
+
+				// Sweep from the right for the cost of the right side of every plane.
+				float rightArea[SAH_BIN_COUNT - 1];
+				uint32_t rightCount[SAH_BIN_COUNT - 1];
+				BoundingBox right;
+				uint32_t count = 0;
+				for (uint32_t bin = SAH_BIN_COUNT - 1; bin > 0; bin--) {
+					right.grow(bins[bin].bounds);
+					count += bins[bin].count;
+					rightArea[bin - 1] = right.getHalfArea();
+					rightCount[bin - 1] = count;
+				}
+
+				BoundingBox left;
+				count = 0;
+				for (uint32_t bin = 0; bin < SAH_BIN_COUNT - 1; bin++) {
+					left.grow(bins[bin].bounds);
+					count += bins[bin].count;
+					if (count == 0 || rightCount[bin] == 0) continue;
+					float cost = left.getHalfArea() * count + rightArea[bin] * rightCount[bin];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = bin;
+					}
+				}
+			}
+
+			if (bestAxis >= 0) {
+				float scale = SAH_BIN_COUNT / extent[bestAxis];
+				float minimum = centroidBounds.min[bestAxis];
+				auto middle = std::partition(indices.begin() + begin, indices.begin() + end, [&](const uint32_t primitive) {
+					return std::min(static_cast<uint32_t>((context.centroids[primitive][bestAxis] - minimum) * scale), SAH_BIN_COUNT - 1) <= bestBin;
+				});
+				uint32_t mid = static_cast<uint32_t>(middle - indices.begin());
+				if (mid != begin && mid != end) return mid;
+			}
+		}
+
+		// Median split on the longest centroid axis, also used when every centroid is the same.
+		int32_t axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+		uint32_t mid = begin + (end - begin) / 2;
+		std::nth_element(indices.begin() + begin, indices.begin() + mid, indices.begin() + end, [&](const uint32_t a, const uint32_t b) {
+			return context.centroids[a][axis] < context.centroids[b][axis];
+		});
+		return mid;
+	}
+
+	void BVH::refitNode(BVHNode& node, const std::vector<BoundingBox>& bounds) const {
+		for (uint32_t slot = 0; slot < 4; slot++) {
+			if (node.children[slot] == INVALID_HANDLE_INDEX) continue;
+			BoundingBox box;
+			if (node.counts[slot] == 0) {
+				box = getNodeBounds(nodes[node.children[slot]]);
+			} else {
+				for (uint32_t k = node.children[slot]; k < node.children[slot] + node.counts[slot]; k++) {
+					box.grow(bounds[primitiveIndices[k]]);
+				}
+			}
+			setSlot(node, slot, box);
+		}
+	}
+
+	void BVH::refit(const std::vector<BoundingBox>& bounds) {
+		// Children follow their parent, walking backwards visits every child before its parent.
+		for (size_t i = nodes.size(); i-- > 0;) {
+			refitNode(nodes[i], bounds);
+		}
+	}
+
+	void BVH::refit(const std::vector<BoundingBox>& bounds, const std::vector<uint32_t>& primitives) {
+		if (nodes.empty()) return;
+
+		// Gather the nodes between the moved leaves and the root.
+		std::vector<uint32_t> dirty;
+		for (uint32_t primitive : primitives) {
+			for (uint32_t node = primitiveNodes[primitive]; node != INVALID_HANDLE_INDEX; node = parents[node]) {
+				dirty.push_back(node);
+			}
+		}
+
+		// Deepest first, every child is refitted before its parent.
+		std::sort(dirty.begin(), dirty.end(), std::greater<uint32_t>());
+		dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+		for (uint32_t node : dirty) {
+			refitNode(nodes[node], bounds);
+		}
+	}
+
+	//***************************************************************************************//
+	//                                       Mesh BVH                                        //
+	//***************************************************************************************//
+
+	// Moller-Trumbore intersection, returns the distance and barycentrics of hits within [tMin, tMax].
+	static inline bool intersectTriangle(const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, const Ray& ray, float& t, float& u, float& v) {
+		glm::vec3 p = glm::cross(ray.direction, e2);
+		float det = glm::dot(e1, p);
+		if (std::fabs(det) < 1e-12f) return false;
+		float invDet = 1.0f / det;
+
+		glm::vec3 s = ray.origin - v0;
+		u = glm::dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f) return false;
+		glm::vec3 q = glm::cross(s, e1);
+		v = glm::dot(ray.direction, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f) return false;
+		t = glm::dot(e2, q) * invDet;
+		return t >= ray.tMin && t <= ray.tMax;
+	}
+
+#if defined(ENGINE_SSE2)
+	// Moller-Trumbore intersection of one triangle against four rays, returns the lanes hit within [tMin, tMax].
+	static inline uint32_t intersectTriangle4(const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, const RayPacket& packet, const uint32_t laneMask, __m128& t, __m128& u, __m128& v) {
+		const __m128 dx = _mm_load_ps(packet.directionX), dy = _mm_load_ps(packet.directionY), dz = _mm_load_ps(packet.directionZ);
+		const __m128 e1x = _mm_set1_ps(e1.x), e1y = _mm_set1_ps(e1.y), e1z = _mm_set1_ps(e1.z);
+		const __m128 e2x = _mm_set1_ps(e2.x), e2y = _mm_set1_ps(e2.y), e2z = _mm_set1_ps(e2.z);
+
+		// p = cross(d, e2), det = dot(e1, p)
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+		__m128 valid = _mm_cmpge_ps(absDet, _mm_set1_ps(1e-12f));
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+		// s = o - v0, u = dot(s, p) / det
+		__m128 sx = _mm_sub_ps(_mm_load_ps(packet.originX), _mm_set1_ps(v0.x));
+		__m128 sy = _mm_sub_ps(_mm_load_ps(packet.originY), _mm_set1_ps(v0.y));
+		__m128 sz = _mm_sub_ps(_mm_load_ps(packet.originZ), _mm_set1_ps(v0.z));
+		u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+		// q = cross(s, e1), v = dot(d, q) / det, t = dot(e2, q) / det
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+		const __m128 zero = _mm_setzero_ps();
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_load_ps(packet.tMin)));
+		valid = _mm_and_ps(valid, _mm_cmple_ps(t, _mm_load_ps(packet.tMax)));
+		return static_cast<uint32_t>(_mm_movemask_ps(valid)) & laneMask;
+	}
+#endif
+
+	MeshBVH::MeshBVH(const Vertex* vertices, const uint32_t submeshCount, uint32_t** indicesList, const uint32_t* indexCountList) {
+		submeshFirsts.resize(submeshCount);
+		for (uint32_t i = 0; i < submeshCount; i++) {
+			submeshFirsts[i] = static_cast<uint32_t>(indices.size() / 3);
+			indices.insert(indices.end(), indicesList[i], indicesList[i] + (indexCountList[i] / 3) * 3);
+		}
+
+		std::vector<BoundingBox> bounds;
+		setTriangles(vertices, bounds);
+		bvh.build(bounds);
+	}
+
+	void MeshBVH::refit(const Vertex* vertices) {
+		std::vector<BoundingBox> bounds;
+		setTriangles(vertices, bounds);
+		bvh.refit(bounds);
+	}
+
+	void MeshBVH::setTriangles(const Vertex* vertices, std::vector<BoundingBox>& bounds) {
+		uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+		triangles.resize(triangleCount);
+		bounds.resize(triangleCount);
+		for (uint32_t i = 0; i < triangleCount; i++) {
+			const glm::vec3& p0 = vertices[indices[i * 3]].position;
+			const glm::vec3& p1 = vertices[indices[i * 3 + 1]].position;
+			const glm::vec3& p2 = vertices[indices[i * 3 + 2]].position;
+			triangles[i] = {p0, p1 - p0, p2 - p0};
+			bounds[i] = BoundingBox();
+			bounds[i].grow(p0);
+			bounds[i].grow(p1);
+			bounds[i].grow(p2);
+		}
+	}
+
+	void MeshBVH::getTriangleId(const uint32_t triangle, RayHit& hit) const {
+		uint32_t submesh = static_cast<uint32_t>(std::upper_bound(submeshFirsts.begin(), submeshFirsts.end(), triangle) - submeshFirsts.begin()) - 1;
+		hit.submesh = submesh;
+		hit.primitive = triangle - submeshFirsts[submesh];
+	}
+
+	bool MeshBVH::intersect(Ray& ray, RayHit& hit) const {
+		int64_t closest = -1;
+		bvh.traverse(ray, [&](const uint32_t primitive, Ray& current) {
+			const Triangle& triangle = triangles[primitive];
+			float t, u, v;
+			if (intersectTriangle(triangle.v0, triangle.e1, triangle.e2, current, t, u, v)) {
+				current.tMax = t;
+				hit.t = t;
+				hit.u = u;
+				hit.v = v;
+				closest = primitive;
+			}
+			return false;
+		});
+		if (closest < 0) return false;
+		getTriangleId(static_cast<uint32_t>(closest), hit);
+		return true;
+	}
+
+	bool MeshBVH::occluded(const Ray& ray) const {
+		Ray shadowRay = ray;
+		bool hit = false;
+		bvh.traverse(shadowRay, [&](const uint32_t primitive, Ray& current) {
+			const Triangle& triangle = triangles[primitive];
+			float t, u, v;
+			hit = intersectTriangle(triangle.v0, triangle.e1, triangle.e2, current, t, u, v);
+			return hit;
+		});
+		return hit;
+	}
+
+	uint32_t MeshBVH::intersect(RayPacket& packet, RayHit hits[4]) const {
+		int64_t closest[4] = {-1, -1, -1, -1};
+		bvh.traverse(packet, [&](const uint32_t primitive, RayPacket& current, const uint32_t laneMask) {
+			const Triangle& triangle = triangles[primitive];
+#if defined(ENGINE_SSE2)
+			alignas(16) float t[4], u[4], v[4];
+			__m128 t4, u4, v4;
+			uint32_t mask = intersectTriangle4(triangle.v0, triangle.e1, triangle.e2, current, laneMask, t4, u4, v4);
+			if (mask == 0) return;
+			_mm_store_ps(t, t4);
+			_mm_store_ps(u, u4);
+			_mm_store_ps(v, v4);
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				if (!(mask & (1u << lane))) continue;
+				current.tMax[lane] = t[lane];
+				hits[lane].t = t[lane];
+				hits[lane].u = u[lane];
+				hits[lane].v = v[lane];
+				closest[lane] = primitive;
+			}
+#else
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				if (!(laneMask & (1u << lane))) continue;
+				float t, u, v;
+				if (!intersectTriangle(triangle.v0, triangle.e1, triangle.e2, current.getRay(lane), t, u, v)) continue;
+				current.tMax[lane] = t;
+				hits[lane].t = t;
+				hits[lane].u = u;
+				hits[lane].v = v;
+				closest[lane] = primitive;
+			}
+#endif
+		});
+
+		uint32_t mask = 0;
+		for (uint32_t lane = 0; lane < 4; lane++) {
+			if (closest[lane] < 0) continue;
+			getTriangleId(static_cast<uint32_t>(closest[lane]), hits[lane]);
+			mask |= 1u << lane;
+		}
+		return mask;
+	}
+
+	//***************************************************************************************//
+	//                                       Scene BVH                                       //
+	//***************************************************************************************//
+
+	void SceneBVH::build(ResourcePool<Object>& objects, uint32_t threadCount) {
+		instances.clear();
+		bounds.clear();
+		objectInstances.clear();
+		for (uint32_t i = 0; i < objects.size(); i++) {
+			Handle<Object> handle = objects.getHandle(i);
+			Object& obj = objects.at(handle);
+			const MeshBVH* meshBVH = obj.mesh->getBVH();
+			if (meshBVH == nullptr || !meshBVH->getBounds().isValid()) continue;
+
+			if (handle.index >= objectInstances.size()) objectInstances.resize(handle.index + 1, INVALID_HANDLE_INDEX);
+			objectInstances[handle.index] = static_cast<uint32_t>(instances.size());
+			instances.push_back({handle, meshBVH, glm::inverse(obj.transform)});
+			bounds.push_back(meshBVH->getBounds().transform(obj.transform));
+		}
+		bvh.build(bounds, threadCount);
+	}
+
+	void SceneBVH::refit(ResourcePool<Object>& objects, const std::vector<Handle<Object>>& moved) {
+		std::vector<uint32_t> primitives;
+		primitives.reserve(moved.size());
+		for (const auto& handle : moved) {
+			if (handle.index >= objectInstances.size() || objectInstances[handle.index] == INVALID_HANDLE_INDEX) continue;
+			uint32_t instance = objectInstances[handle.index];
+			const Object* obj = objects.get(handle);
+			if (obj == nullptr || instances[instance].object != handle) continue;
+
+			instances[instance].worldToObject = glm::inverse(obj->transform);
+			bounds[instance] = instances[instance].bvh->getBounds().transform(obj->transform);
+			primitives.push_back(instance);
+		}
+		bvh.refit(bounds, primitives);
+	}
+
+	Ray SceneBVH::toObjectSpace(const Ray& ray, const glm::mat4& worldToObject) {
+		// Directions are not renormalized, distances along the ray stay the same in both spaces.
+		Ray objectRay = ray;
+		objectRay.origin = glm::vec3(worldToObject * glm::vec4(ray.origin, 1.0f));
+		objectRay.direction = glm::vec3(worldToObject * glm::vec4(ray.direction, 0.0f));
+		return objectRay;
+	}
+
+	bool SceneBVH::intersect(Ray& ray, RayHit& hit) const {
+		bool found = false;
+		bvh.traverse(ray, [&](const uint32_t primitive, Ray& current) {
+			const Instance& instance = instances[primitive];
+			Ray objectRay = toObjectSpace(current, instance.worldToObject);
+			if (instance.bvh->intersect(objectRay, hit)) {
+				current.tMax = objectRay.tMax;
+				hit.object = instance.object;
+				found = true;
+			}
+			return false;
+		});
+		return found;
+	}
+
+	bool SceneBVH::occluded(const Ray& ray) const {
+		Ray shadowRay = ray;
+		bool hit = false;
+		bvh.traverse(shadowRay, [&](const uint32_t primitive, Ray& current) {
+			const Instance& instance = instances[primitive];
+			hit = instance.bvh->occluded(toObjectSpace(current, instance.worldToObject));
+			return hit;
+		});
+		return hit;
+	}
+
+	uint32_t SceneBVH::intersect(RayPacket& packet, RayHit hits[4]) const {
+		uint32_t found = 0;
+		bvh.traverse(packet, [&](const uint32_t primitive, RayPacket& current, const uint32_t laneMask) {
+			const Instance& instance = instances[primitive];
+
+			// Transform the packet into object space, lanes outside the instance's box are disabled.
+			RayPacket objectPacket;
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				objectPacket.setRay(lane, toObjectSpace(current.getRay(lane), instance.worldToObject));
+				if (!(laneMask & (1u << lane))) objectPacket.tMax[lane] = -FLT_MAX;
+			}
+
+			uint32_t mask = instance.bvh->intersect(objectPacket, hits);
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				if (!(mask & (1u << lane))) continue;
+				current.tMax[lane] = objectPacket.tMax[lane];
+				hits[lane].object = instance.object;
+			}
+			found |= mask;
+		});
+		return found;
+	}
+
+	void SceneBVH::overlap(const BoundingBox& box, std::vector<Handle<Object>>& objects) const {
+		// Leaves hold several instances, test each one's own bounds.
+		bvh.overlap(box, [&](const uint32_t primitive) {
+			if (bounds[primitive].overlaps(box)) objects.push_back(instances[primitive].object);
+		});
+	}
+}
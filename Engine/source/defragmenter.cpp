@@ -0,0 +1,447 @@
+#include <defragmenter.h>
+#include <async_compute.h>
+#include <engine_globals.h>
+#include <algorithm>
+#include <chrono>
+
+namespace core {
+
+	VkDevice Defragmenter::device;
+	VkQueue Defragmenter::queue;
+	VkCommandPool Defragmenter::commandPool = VK_NULL_HANDLE;
+	VkCommandBuffer Defragmenter::commandBuffer = VK_NULL_HANDLE;
+	VkFence Defragmenter::fence = VK_NULL_HANDLE;
+	DefragmentationState Defragmenter::state = DEFRAGMENTATION_STATE_IDLE;
+	bool Defragmenter::requested = false;
+	uint64_t Defragmenter::frameCounter = 0;
+	uint32_t Defragmenter::poolIndex = 0;
+	VmaDefragmentationContext Defragmenter::context = VK_NULL_HANDLE;
+	VmaDefragmentationPassMoveInfo Defragmenter::pass{};
+	std::vector<RelocationMove> Defragmenter::moves;
+	std::unordered_map<VmaAllocation, Relocatable> Defragmenter::relocatables;
+	std::map<uint32_t, RelocationListener> Defragmenter::listeners;
+	uint32_t Defragmenter::nextListenerId = 1;
+
+	// Limits of a single pass, keeps the copies of a frame short.
+	const VkDeviceSize DEFRAGMENTATION_MAX_BYTES_PER_PASS = 16 * 1024 * 1024;
+	const uint32_t DEFRAGMENTATION_MAX_MOVES_PER_PASS = 64;
+	// Number of frames between two fragmentation checks.
+	const uint64_t DEFRAGMENTATION_CHECK_INTERVAL = 300;
+	// A heap is fragmented once this much of its allocated blocks is unused.
+	const double DEFRAGMENTATION_UNUSED_RATIO = 0.25;
+	const VkDeviceSize DEFRAGMENTATION_MIN_UNUSED_BYTES = 32 * 1024 * 1024;
+	// Default pool, then the texture pool.
+	const uint32_t DEFRAGMENTATION_POOL_COUNT = 2;
+
+	void Defragmenter::setup(const VkDevice& device, const VkQueue& queue, const uint32_t queueFamilyIndex) {
+		Defragmenter::device = device;
+		Defragmenter::queue = queue;
+
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		poolInfo.queueFamilyIndex = queueFamilyIndex;
+		VK_CHECK_MSG(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool), "Failed to create defragmentation command pool.");
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer));
+
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+	}
+
+	void Defragmenter::cleanup() {
+		if (state == DEFRAGMENTATION_STATE_COPYING || state == DEFRAGMENTATION_STATE_COPIED) {
+			abortPass();
+		}
+		if (context != VK_NULL_HANDLE) {
+			vmaEndDefragmentation(ResourceAllocator::getAllocator(), context, nullptr);
+			context = VK_NULL_HANDLE;
+		}
+		state = DEFRAGMENTATION_STATE_IDLE;
+		relocatables.clear();
+		listeners.clear();
+
+		vkDestroyFence(device, fence, nullptr);
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+
+	//***************************************************************************************//
+	//                                     Registration                                      //
+	//***************************************************************************************//
+
+	void Defragmenter::registerBuffer(Buffer& buffer, const VkDeviceSize& size, const VkBufferUsageFlags& usage, std::function<void()> onRelocated) {
+		DEBUG_ASSERT_MSG(buffer.mapped == nullptr, "Mapped buffers cannot be relocated.");
+		DEBUG_ASSERT_MSG((usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT), "Relocated buffers must be created with VK_BUFFER_USAGE_TRANSFER_SRC_BIT.");
+
+		Relocatable relocatable{};
+		relocatable.type = RELOCATABLE_TYPE_BUFFER;
+		relocatable.buffer = &buffer;
+		relocatable.bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		relocatable.bufferInfo.size = size;
+		relocatable.bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		ResourceAllocator::setSharingMode(relocatable.bufferInfo);
+		relocatable.onRelocated = std::move(onRelocated);
+		relocatables[buffer.allocation] = std::move(relocatable);
+	}
+
+	void Defragmenter::registerImage(Image& image, const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VkImageUsageFlags& usage, const VkImageLayout& layout, std::function<void()> onRelocated) {
+		DEBUG_ASSERT_MSG((usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT), "Relocated images must be created with VK_IMAGE_USAGE_TRANSFER_SRC_BIT.");
+		DEBUG_ASSERT_MSG(!(usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT), "Depth images cannot be relocated.");
+
+		Relocatable relocatable{};
+		relocatable.type = RELOCATABLE_TYPE_IMAGE;
+		relocatable.image = &image;
+		relocatable.imageInfo = ResourceAllocator::getImage2DCreateInfo(extent, format, mipLevels, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+		relocatable.imageLayout = layout;
+		relocatable.onRelocated = std::move(onRelocated);
+		relocatables[image.allocation] = std::move(relocatable);
+	}
+
+	void Defragmenter::registerAccelerationStructure(AccelerationStructure& accelStruct, const VkDeviceSize& size, const VkAccelerationStructureTypeKHR& type, std::function<void()> onRelocated) {
+		Relocatable relocatable{};
+		relocatable.type = RELOCATABLE_TYPE_ACCELERATION_STRUCTURE;
+		relocatable.accelStruct = &accelStruct;
+		relocatable.bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		relocatable.bufferInfo.size = size;
+		relocatable.bufferInfo.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+		ResourceAllocator::setSharingMode(relocatable.bufferInfo);
+		relocatable.accelStructType = type;
+		relocatable.onRelocated = std::move(onRelocated);
+		relocatables[accelStruct.allocation] = std::move(relocatable);
+	}
+
+	void Defragmenter::unregister(const VmaAllocation& allocation) {
+		// Drop the pending move of the allocation, it must not be applied to a destroyed resource.
+		auto move = std::find_if(moves.begin(), moves.end(), [&allocation](const RelocationMove& relocation) { return relocation.allocation == allocation; });
+		if (move != moves.end()) {
+			VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+			destroyMove(*move);
+			pass.pMoves[move->moveIndex].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+			moves.erase(move);
+		}
+		relocatables.erase(allocation);
+	}
+
+	uint32_t Defragmenter::addListener(std::function<void(const RelocationFlags&)> listener, const RelocationListenerPriority& priority) {
+		uint32_t id = nextListenerId++;
+		listeners[id] = { priority, std::move(listener) };
+		return id;
+	}
+
+	void Defragmenter::removeListener(const uint32_t id) {
+		listeners.erase(id);
+	}
+
+	//***************************************************************************************//
+	//                                    Defragmentation                                    //
+	//***************************************************************************************//
+
+	void Defragmenter::start() {
+		requested = true;
+	}
+
+	bool Defragmenter::update(const double& timeBudgetMs) {
+		frameCounter++;
+
+		if (state == DEFRAGMENTATION_STATE_IDLE) {
+			bool check = (frameCounter % DEFRAGMENTATION_CHECK_INTERVAL) == 0;
+			if (!requested && !(check && isFragmented())) return false;
+			requested = false;
+			poolIndex = 0;
+			beginContext();
+		}
+
+		if (state == DEFRAGMENTATION_STATE_READY) {
+			beginPass(timeBudgetMs);
+		}
+
+		if (state == DEFRAGMENTATION_STATE_COPYING && vkGetFenceStatus(device, fence) == VK_SUCCESS) {
+			state = DEFRAGMENTATION_STATE_COPIED;
+		}
+		return state == DEFRAGMENTATION_STATE_COPIED;
+	}
+
+	void Defragmenter::apply() {
+		DEBUG_ASSERT(state == DEFRAGMENTATION_STATE_COPIED);
+
+		// Async compute work submitted after the copies (TLAS builds, batch builds, compactions) may still read the old memory,
+		// which the end of the pass frees right away.
+		AsyncCompute::wait(AsyncCompute::getLastToken());
+
+		RelocationFlags flags = 0;
+		for (const RelocationMove& relocation : moves) {
+			Relocatable& relocatable = relocatables.at(relocation.allocation);
+			switch (relocatable.type) {
+			case RELOCATABLE_TYPE_BUFFER: {
+				VkBuffer oldBuffer = relocatable.buffer->buffer;
+				relocatable.buffer->buffer = relocation.newBuffer;
+				if (relocatable.bufferInfo.usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+					relocatable.buffer->address = ResourceAllocator::getBufferDeviceAddress(relocation.newBuffer);
+				}
+				if (relocatable.onRelocated) relocatable.onRelocated();
+				ResourceAllocator::deferDestroy([oldBuffer]() { vkDestroyBuffer(device, oldBuffer, nullptr); });
+				flags |= RELOCATION_BUFFER_BIT;
+				break;
+			}
+			case RELOCATABLE_TYPE_IMAGE: {
+				VkImage oldImage = relocatable.image->image;
+				relocatable.image->image = relocation.newImage;
+				if (relocatable.onRelocated) relocatable.onRelocated();
+				ResourceAllocator::deferDestroy([oldImage]() { vkDestroyImage(device, oldImage, nullptr); });
+				flags |= RELOCATION_IMAGE_BIT;
+				break;
+			}
+			case RELOCATABLE_TYPE_ACCELERATION_STRUCTURE: {
+				VkAccelerationStructureKHR oldHandle = relocatable.accelStruct->handle;
+				VkBuffer oldBuffer = relocatable.accelStruct->buffer;
+				relocatable.accelStruct->buffer = relocation.newBuffer;
+				relocatable.accelStruct->handle = relocation.newAccelStruct;
+
+				VkAccelerationStructureDeviceAddressInfoKHR addressInfo{};
+				addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+				addressInfo.accelerationStructure = relocation.newAccelStruct;
+				relocatable.accelStruct->address = vkGetAccelerationStructureDeviceAddressKHR(device, &addressInfo);
+
+				if (relocatable.onRelocated) relocatable.onRelocated();
+				ResourceAllocator::deferDestroy([oldHandle, oldBuffer]() {
+					vkDestroyAccelerationStructureKHR(device, oldHandle, nullptr);
+					vkDestroyBuffer(device, oldBuffer, nullptr);
+				});
+				flags |= RELOCATION_ACCELERATION_STRUCTURE_BIT;
+				break;
+			}
+			}
+		}
+		moves.clear();
+
+		// Swaps the moved allocations to their new memory and frees the old regions.
+		VkResult result = vmaEndDefragmentationPass(ResourceAllocator::getAllocator(), context, &pass);
+		state = DEFRAGMENTATION_STATE_READY;
+		if (result == VK_SUCCESS) {
+			endContext();
+		}
+
+		// Patch state referencing the moved resources (descriptors, device addresses, TLAS instances).
+		// Ids increase with registration, so a stable sort on the priority keeps registration order within a priority.
+		if (flags != 0) {
+			std::vector<RelocationListener*> ordered;
+			for (auto& listener : listeners) ordered.push_back(&listener.second);
+			std::stable_sort(ordered.begin(), ordered.end(), [](const RelocationListener* a, const RelocationListener* b) { return a->priority < b->priority; });
+			for (auto listener : ordered) {
+				listener->notify(flags);
+			}
+		}
+	}
+
+	bool Defragmenter::isFragmented() {
+		VmaAllocator allocator = ResourceAllocator::getAllocator();
+		const VkPhysicalDeviceMemoryProperties* memoryProperties;
+		vmaGetMemoryProperties(allocator, &memoryProperties);
+
+		std::vector<VmaBudget> budgets(memoryProperties->memoryHeapCount);
+		vmaGetHeapBudgets(allocator, budgets.data());
+		for (const VmaBudget& budget : budgets) {
+			VkDeviceSize unusedBytes = budget.statistics.blockBytes - budget.statistics.allocationBytes;
+			if (unusedBytes >= DEFRAGMENTATION_MIN_UNUSED_BYTES && unusedBytes > budget.statistics.blockBytes * DEFRAGMENTATION_UNUSED_RATIO) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Defragmenter::beginContext() {
+		VmaDefragmentationInfo defragInfo{};
+		defragInfo.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+		defragInfo.pool = (poolIndex == 0) ? VK_NULL_HANDLE : ResourceAllocator::getTexturePool();
+		defragInfo.maxBytesPerPass = DEFRAGMENTATION_MAX_BYTES_PER_PASS;
+		defragInfo.maxAllocationsPerPass = DEFRAGMENTATION_MAX_MOVES_PER_PASS;
+		VK_CHECK_MSG(vmaBeginDefragmentation(ResourceAllocator::getAllocator(), &defragInfo, &context), "Failed to begin memory defragmentation.");
+		state = DEFRAGMENTATION_STATE_READY;
+	}
+
+	void Defragmenter::endContext() {
+		vmaEndDefragmentation(ResourceAllocator::getAllocator(), context, nullptr);
+		context = VK_NULL_HANDLE;
+
+		// Continue with the next pool, or stop once every pool was defragmented.
+		if (++poolIndex < DEFRAGMENTATION_POOL_COUNT) {
+			beginContext();
+		} else {
+			state = DEFRAGMENTATION_STATE_IDLE;
+		}
+	}
+
+	void Defragmenter::beginPass(const double& timeBudgetMs) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		VkResult result = vmaBeginDefragmentationPass(ResourceAllocator::getAllocator(), context, &pass);
+		if (result == VK_SUCCESS) {
+			// Nothing left to move in this pool.
+			endContext();
+			return;
+		}
+		if (result != VK_INCOMPLETE) VK_CHECK(result);
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+		VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+		// Wait for earlier submissions writing to the moved resources.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		for (uint32_t i = 0; i < pass.moveCount; i++) {
+			VmaDefragmentationMove& move = pass.pMoves[i];
+			auto relocatable = relocatables.find(move.srcAllocation);
+
+			// Unregistered allocations stay in place, and the remaining moves wait for a later frame once the budget is spent.
+			double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+			if (relocatable == relocatables.end() || elapsedMs > timeBudgetMs) {
+				move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+				continue;
+			}
+
+			RelocationMove relocation{ i, move.srcAllocation };
+			recordMove(move, relocatable->second, relocation);
+			moves.push_back(relocation);
+		}
+
+		// Make the copies visible to later submissions.
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		VK_CHECK(vkEndCommandBuffer(commandBuffer));
+
+		if (moves.empty()) {
+			// Every proposed move was ignored, stop with this pool rather than being offered the same moves again.
+			vmaEndDefragmentationPass(ResourceAllocator::getAllocator(), context, &pass);
+			endContext();
+			return;
+		}
+
+		// Acceleration structures still being built on the async compute queue are copied once complete.
+		ComputeToken compute = AsyncCompute::getLastToken();
+		const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.waitSemaphoreValueCount = 1;
+		timelineInfo.pWaitSemaphoreValues = &compute.value;
+
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &compute.semaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &commandBuffer;
+		submitInfo.pNext = &timelineInfo;
+		VK_CHECK(vkResetFences(device, 1, &fence));
+		VK_CHECK(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		state = DEFRAGMENTATION_STATE_COPYING;
+	}
+
+	void Defragmenter::recordMove(const VmaDefragmentationMove& move, const Relocatable& relocatable, RelocationMove& relocation) {
+		VmaAllocator allocator = ResourceAllocator::getAllocator();
+
+		switch (relocatable.type) {
+		case RELOCATABLE_TYPE_BUFFER: {
+			VK_CHECK(vkCreateBuffer(device, &relocatable.bufferInfo, nullptr, &relocation.newBuffer));
+			VK_CHECK(vmaBindBufferMemory(allocator, move.dstTmpAllocation, relocation.newBuffer));
+
+			VkBufferCopy region{};
+			region.size = relocatable.bufferInfo.size;
+			vkCmdCopyBuffer(commandBuffer, relocatable.buffer->buffer, relocation.newBuffer, 1, &region);
+			break;
+		}
+		case RELOCATABLE_TYPE_IMAGE: {
+			const VkImageCreateInfo& imageInfo = relocatable.imageInfo;
+			VK_CHECK(vkCreateImage(device, &imageInfo, nullptr, &relocation.newImage));
+			VK_CHECK(vmaBindImageMemory(allocator, move.dstTmpAllocation, relocation.newImage));
+
+			VkImageMemoryBarrier barriers[2]{};
+			for (VkImageMemoryBarrier& barrier : barriers) {
+				barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, imageInfo.mipLevels, 0, imageInfo.arrayLayers };
+			}
+			barriers[0].image = relocatable.image->image;
+			barriers[0].oldLayout = relocatable.imageLayout;
+			barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barriers[1].image = relocation.newImage;
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+			std::vector<VkImageCopy> regions(imageInfo.mipLevels);
+			for (uint32_t mip = 0; mip < imageInfo.mipLevels; mip++) {
+				regions[mip].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip, 0, imageInfo.arrayLayers };
+				regions[mip].dstSubresource = regions[mip].srcSubresource;
+				regions[mip].extent = { std::max(1u, imageInfo.extent.width >> mip), std::max(1u, imageInfo.extent.height >> mip), 1 };
+			}
+			vkCmdCopyImage(commandBuffer, relocatable.image->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, relocation.newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+
+			// Both images return to the layout the renderer expects, the old one may still be read until apply().
+			barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barriers[0].newLayout = relocatable.imageLayout;
+			barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barriers[1].newLayout = relocatable.imageLayout;
+			barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+			break;
+		}
+		case RELOCATABLE_TYPE_ACCELERATION_STRUCTURE: {
+			VK_CHECK(vkCreateBuffer(device, &relocatable.bufferInfo, nullptr, &relocation.newBuffer));
+			VK_CHECK(vmaBindBufferMemory(allocator, move.dstTmpAllocation, relocation.newBuffer));
+
+			VkAccelerationStructureCreateInfoKHR createInfo{};
+			createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+			createInfo.type = relocatable.accelStructType;
+			createInfo.size = relocatable.bufferInfo.size;
+			createInfo.buffer = relocation.newBuffer;
+			VK_CHECK(vkCreateAccelerationStructureKHR(device, &createInfo, nullptr, &relocation.newAccelStruct));
+
+			VkCopyAccelerationStructureInfoKHR copyInfo{};
+			copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+			copyInfo.src = relocatable.accelStruct->handle;
+			copyInfo.dst = relocation.newAccelStruct;
+			copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+			vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+			break;
+		}
+		}
+	}
+
+	void Defragmenter::destroyMove(const RelocationMove& relocation) {
+		if (relocation.newAccelStruct != VK_NULL_HANDLE) vkDestroyAccelerationStructureKHR(device, relocation.newAccelStruct, nullptr);
+		if (relocation.newBuffer != VK_NULL_HANDLE) vkDestroyBuffer(device, relocation.newBuffer, nullptr);
+		if (relocation.newImage != VK_NULL_HANDLE) vkDestroyImage(device, relocation.newImage, nullptr);
+	}
+
+	void Defragmenter::abortPass() {
+		VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+		for (const RelocationMove& relocation : moves) {
+			destroyMove(relocation);
+			pass.pMoves[relocation.moveIndex].operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+		}
+		moves.clear();
+		vmaEndDefragmentationPass(ResourceAllocator::getAllocator(), context, &pass);
+		state = DEFRAGMENTATION_STATE_READY;
+	}
+}
@@ -119,7 +119,7 @@ namespace core {
 		bufferWrite.descriptorCount = 1;
 		bufferWrite.dstBinding = binding;
 		bufferWrite.dstSet = handles[set];
-		bufferWrite.pBufferInfo = &writeDescInfo;
+		bufferWrite.pBufferInfo = &bufferInfos.emplace_back(writeDescInfo);
 
 		writes.push_back(bufferWrite);
 	}
@@ -135,7 +135,7 @@ namespace core {
         imageWrite.descriptorCount = 1;
         imageWrite.dstBinding = binding;
 		imageWrite.dstSet = handles[set];
-		imageWrite.pImageInfo = &writeDescInfo;
+		imageWrite.pImageInfo = &imageInfos.emplace_back(writeDescInfo);
 		imageWrite.dstArrayElement = arrayElement;
 
 		writes.push_back(imageWrite);
@@ -152,7 +152,10 @@ namespace core {
         tlasWrite.descriptorCount = writeDescInfo.accelerationStructureCount;
         tlasWrite.dstBinding = binding;
 		tlasWrite.dstSet = handles[set];
-        tlasWrite.pNext = &writeDescInfo;
+		// Keep the acceleration structure handles alive until update().
+		std::vector<VkAccelerationStructureKHR>& accelStructs = accelStructHandles.emplace_back(writeDescInfo.pAccelerationStructures, writeDescInfo.pAccelerationStructures + writeDescInfo.accelerationStructureCount);
+		writeDescInfo.pAccelerationStructures = accelStructs.data();
+        tlasWrite.pNext = &accelStructInfos.emplace_back(writeDescInfo);
 
 		writes.push_back(tlasWrite);
 	}
@@ -160,6 +163,10 @@ namespace core {
 	void DescriptorSet::update() {
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 		writes.clear();
+		bufferInfos.clear();
+		imageInfos.clear();
+		accelStructInfos.clear();
+		accelStructHandles.clear();
 	}
 
 	void DescriptorSet::setName(const std::string& name) {
@@ -14,6 +14,9 @@
 #include <glm/gtx/transform.hpp>
 
 #include <resource_allocator.h>
+#include <defragmenter.h>
+#include <host_acceleration_builder.h>
+#include <async_compute.h>
 
 #include <iostream>
 #include <vector>
@@ -40,10 +43,13 @@ namespace core {
     std::vector<const char*> EngineContext::layers;
 
     PhysicalDeviceProperties EngineContext::physicalDeviceProperties;
+    bool EngineContext::hostAccelerationStructureCommands = false;
     vk::PhysicalDevice EngineContext::physicalDevice = VK_NULL_HANDLE;
     vk::Device EngineContext::device = VK_NULL_HANDLE;
     vk::Queue EngineContext::graphicsQueue = VK_NULL_HANDLE;
     vk::Queue EngineContext::presentQueue = VK_NULL_HANDLE;
+    vk::Queue EngineContext::transferQueue = VK_NULL_HANDLE;
+    vk::Queue EngineContext::computeQueue = VK_NULL_HANDLE;
 
     vk::CommandPool EngineContext::commandPool;
 
@@ -57,7 +63,12 @@ namespace core {
             setupDeviceExtensions();
             selectPhysicalDevice();
             createLogicalDevice();
-            ResourceAllocator::setup(instance, physicalDevice, device, queryQueueFamilies(physicalDevice).graphicsFamily.value());
+            QueueFamilyIndices indices = queryQueueFamilies(physicalDevice);
+            ResourceAllocator::setup(instance, physicalDevice, device, indices.graphicsFamily.value(), indices.transferFamily.value(), indices.computeFamily.value());
+            AsyncCompute::setup(device, computeQueue, indices.computeFamily.value());
+            Defragmenter::setup(device, graphicsQueue, indices.graphicsFamily.value());
+            // Keep a core free for the main thread, which also joins the host builds it waits on.
+            HostAccelerationBuilder::setup(device, hostAccelerationStructureCommands, std::max(1u, std::thread::hardware_concurrency()) - 1);
             Debugger::setup(instance, device);
             createCommandPool();
         }
@@ -81,6 +92,9 @@ namespace core {
         // Destroy all vulkan objects
         device.destroyCommandPool(commandPool);
         Debugger::cleanup();
+        HostAccelerationBuilder::cleanup();
+        AsyncCompute::cleanup();
+        Defragmenter::cleanup();
         ResourceAllocator::cleanup();
         device.destroy();
         vkDestroySurfaceKHR(instance, surface, nullptr);
@@ -210,9 +224,13 @@ namespace core {
         EngineContext::physicalDevice = physicalDevice;
 
         // Fetch all properties.
+        VkPhysicalDeviceIDProperties idProperties{};
+        idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+        idProperties.pNext = nullptr;
+
         VkPhysicalDeviceAccelerationStructurePropertiesKHR accelProperties{};
         accelProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
-        accelProperties.pNext = nullptr;
+        accelProperties.pNext = &idProperties;
 
         VkPhysicalDeviceRayTracingPipelinePropertiesKHR raytracingProperties{};
         raytracingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
@@ -223,7 +241,7 @@ namespace core {
         deviceProperties.pNext = &raytracingProperties;
 
         vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties);
-        EngineContext::physicalDeviceProperties = {deviceProperties.properties, raytracingProperties, accelProperties};
+        EngineContext::physicalDeviceProperties = {deviceProperties.properties, raytracingProperties, accelProperties, idProperties};
     }
 
     void EngineContext::createLogicalDevice() {
@@ -259,9 +277,19 @@ namespace core {
         timeSemFeature.timelineSemaphore = VK_TRUE;
         timeSemFeature.pNext = &descIndexFeature;
 
+        // Host acceleration structure commands are optional, only enable them when supported.
+        VkPhysicalDeviceAccelerationStructureFeaturesKHR supportedAccelFeature{};
+        supportedAccelFeature.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+        VkPhysicalDeviceFeatures2 supportedFeatures{};
+        supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext = &supportedAccelFeature;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+        hostAccelerationStructureCommands = supportedAccelFeature.accelerationStructureHostCommands == VK_TRUE;
+
         VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{};
         accelFeature.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
         accelFeature.accelerationStructure = VK_TRUE;
+        accelFeature.accelerationStructureHostCommands = hostAccelerationStructureCommands ? VK_TRUE : VK_FALSE;
         accelFeature.pNext = &timeSemFeature;
 
         VkPhysicalDeviceRayTracingPipelineFeaturesKHR raytracingFeature{};
@@ -320,6 +348,16 @@ namespace core {
         VkQueue presentQueue;
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
         EngineContext::presentQueue = presentQueue;
+
+        // Cache transfer queue handle.
+        VkQueue transferQueue;
+        vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+        EngineContext::transferQueue = transferQueue;
+
+        // Cache compute queue handle.
+        VkQueue computeQueue;
+        vkGetDeviceQueue(device, indices.computeFamily.value(), 0, &computeQueue);
+        EngineContext::computeQueue = computeQueue;
     }
 
     bool EngineContext::isDeviceSuitable(VkPhysicalDevice device) {
@@ -356,6 +394,32 @@ namespace core {
             i++;
         }
 
+        // Prefer a transfer-only family (DMA engine), then any non-graphics family supporting transfers.
+        for (uint32_t k = 0; k < queueFamilyCount && !indices.transferFamily.has_value(); k++) {
+            if ((queueFamilies[k].queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamilies[k].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+                indices.transferFamily = k;
+            }
+        }
+        for (uint32_t k = 0; k < queueFamilyCount && !indices.transferFamily.has_value(); k++) {
+            if ((queueFamilies[k].queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) && !(queueFamilies[k].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                indices.transferFamily = k;
+            }
+        }
+        // Fallback to the graphics family.
+        if (!indices.transferFamily.has_value()) {
+            indices.transferFamily = indices.graphicsFamily;
+        }
+
+        // Acceleration structures build on a compute family without graphics (async compute), else on the graphics family.
+        for (uint32_t k = 0; k < queueFamilyCount && !indices.computeFamily.has_value(); k++) {
+            if ((queueFamilies[k].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamilies[k].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                indices.computeFamily = k;
+            }
+        }
+        if (!indices.computeFamily.has_value()) {
+            indices.computeFamily = indices.graphicsFamily;
+        }
+
         return indices;
     }
 
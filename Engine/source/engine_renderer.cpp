@@ -1,11 +1,15 @@
 #include <engine_renderer.h>
 #include <engine_context.h>
+#include <debugger.h>
+#include <defragmenter.h>
+#include <async_compute.h>
 #include <SDL2/SDL_vulkan.h>
 #include <renderer/standard_renderer.h>
 #include <renderer/pathtraced_renderer.h>
 #include <pipeline/standard_pipeline.h>
 #include <pipeline/raytracing_pipeline.h>
 #include <pipeline/post_pipeline.h>
+#include <algorithm>
 
 namespace core {
 
@@ -20,9 +24,12 @@ namespace core {
     DescriptorSet* EngineRenderer::cameraDescSet;
     DescriptorSet* EngineRenderer::texturesDescSet;
 
-    // Global Descriptor buffer.
-    Buffer EngineRenderer::cameraDescBuffer;
-    uint32_t EngineRenderer::cameraDescBufferAlignment;
+    // Per-frame scratch memory.
+    FrameSuballocator* EngineRenderer::frameAllocator;
+    uint32_t EngineRenderer::cameraDescOffset;
+
+    // Defragmentation listener patching the texture array.
+    uint32_t EngineRenderer::relocationListener = 0;
 
     // Instances for all the renderers.
     Renderer* EngineRenderer::standardRenderer;
@@ -32,17 +39,19 @@ namespace core {
 	void EngineRenderer::setup(Scene* scene) {
         EngineRenderer::scene = scene;
 		createSwapChain();
+        createFrameAllocator();
         createDescriptorSets();
         createRenderers();
         initDescriptorSets();
 	}
 
     void EngineRenderer::cleanup() {
+        Defragmenter::removeListener(relocationListener);
         // Cleanup renderers.
-        standardRenderer->cleanup();
-        pathtracedRenderer->cleanup();
-        // Cleanup descriptor buffers
-        ResourceAllocator::destroyBuffer(cameraDescBuffer);
+        delete standardRenderer;
+        delete pathtracedRenderer;
+        // Cleanup per-frame scratch memory.
+        delete frameAllocator;
         // Cleanup descriptor sets.
         delete cameraDescSet;
         delete texturesDescSet;
@@ -175,6 +184,22 @@ namespace core {
         // TODO - recreate swapchain
     }
 
+    //***************************************************************************************//
+    //                                   Frame Allocator                                     //
+    //***************************************************************************************//
+
+    const VkDeviceSize FRAME_ALLOCATOR_SIZE = 4 * 1024 * 1024; // 4MB per frame in flight.
+
+    void EngineRenderer::createFrameAllocator() {
+        ALLOCATION_TAG("EngineRenderer::createFrameAllocator");
+        // Every allocation satisfies both uniform and storage offset alignments.
+        const VkPhysicalDeviceLimits& limits = EngineContext::getPhysicalDeviceProperties().deviceProperties.limits;
+        VkDeviceSize alignment = std::max({ limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, VkDeviceSize(16) });
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        frameAllocator = new FrameSuballocator(FRAME_ALLOCATOR_SIZE, alignment, usage);
+        Debugger::setObjectName(frameAllocator->getBuffer().buffer, "Frame Allocator");
+    }
+
     //***************************************************************************************//
     //                                    Descriptor Sets                                    //
     //***************************************************************************************//
@@ -190,7 +215,7 @@ namespace core {
         // Allocate camera descriptor set.
         cameraDescSet = new DescriptorSet();
         // Bind camera descriptor.
-        cameraDescSet->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_RAYGEN_BIT_KHR);
+        cameraDescSet->addDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_RAYGEN_BIT_KHR | VK_SHADER_STAGE_VERTEX_BIT);
         // Create descriptor set.
         cameraDescSet->create(EngineContext::getDevice(), MAX_FRAMES_IN_FLIGHT);
         cameraDescSet->setName("Camera");
@@ -205,41 +230,39 @@ namespace core {
     }
 
     void EngineRenderer::initDescriptorSets() {
-        // Create camera descriptor buffer.
-        CameraDescriptorBuffer cameraUBO{};
-        cameraUBO.viewProj = scene->getMainCamera().getProjectionMatrix() * scene->getMainCamera().getViewMatrix();
-        cameraUBO.viewInverse = scene->getMainCamera().getViewInverseMatrix();
-        cameraUBO.projInverse = scene->getMainCamera().getProjectionInverseMatrix();
-        // TODO - cameraUBO.position = scene->getMainCamera().getWorldPosition();
-
-        // Allocate and map data to camera desc buffer.
-        cameraDescBufferAlignment = static_cast<uint32_t>(alignUp(EngineContext::getPhysicalDeviceProperties().deviceProperties.limits.minUniformBufferOffsetAlignment, sizeof(CameraDescriptorBuffer)));
-        CameraDescriptorBuffer cameraUBOs[MAX_FRAMES_IN_FLIGHT]{ cameraUBO };
-        ResourceAllocator::createBuffer(cameraDescBufferAlignment * MAX_FRAMES_IN_FLIGHT, cameraDescBuffer, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-        ResourceAllocator::mapDataToBuffer(cameraDescBuffer, cameraDescBufferAlignment * MAX_FRAMES_IN_FLIGHT, &cameraUBO);
-
-        // Upload camera descriptor to all descriptor sets.
-        VkDescriptorBufferInfo camDescInfos[MAX_FRAMES_IN_FLIGHT];
+        // Point camera descriptors at the frame allocator, the per-frame offset is bound dynamically.
+        VkDescriptorBufferInfo camDescInfo{};
+        camDescInfo.buffer = frameAllocator->getBuffer().buffer;
+        camDescInfo.offset = 0;
+        camDescInfo.range = sizeof(CameraDescriptorBuffer);
         for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            camDescInfos[i].buffer = cameraDescBuffer.buffer;
-            camDescInfos[i].offset = cameraDescBufferAlignment * i;
-            camDescInfos[i].range = sizeof(CameraDescriptorBuffer);
-            cameraDescSet->writeBuffer(i, 0, camDescInfos[i]);
+            cameraDescSet->writeBuffer(i, 0, camDescInfo);
         }
 
         // Upload texture sampler descriptors.
-        VkDescriptorImageInfo* globalTextureDescInfos = new VkDescriptorImageInfo[scene->getTextures().size()];
-        for (uint32_t i = 0; i < scene->getTextures().size(); i++) {
-            globalTextureDescInfos[i].sampler = scene->getTextures()[i]->getSampler();
-            globalTextureDescInfos[i].imageView = scene->getTextures()[i]->getImageView();
-            globalTextureDescInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            texturesDescSet->writeImage(0, 0, globalTextureDescInfos[i], i);
-        }
+        writeTextureArrayDescriptor();
 
         // Update global desc sets.
         cameraDescSet->update();
         texturesDescSet->update();
-        delete[] globalTextureDescInfos;
+
+        // Moved textures get new image views.
+        relocationListener = Defragmenter::addListener([](const RelocationFlags& flags) {
+            if (flags & RELOCATION_IMAGE_BIT) {
+                writeTextureArrayDescriptor();
+                texturesDescSet->update();
+            }
+        }, RELOCATION_LISTENER_PRIORITY_DESCRIPTORS);
+    }
+
+    void EngineRenderer::writeTextureArrayDescriptor() {
+        for (uint32_t i = 0; i < scene->getTextures().size(); i++) {
+            VkDescriptorImageInfo textureDescInfo{};
+            textureDescInfo.sampler = scene->getTextures()[i]->getSampler();
+            textureDescInfo.imageView = scene->getTextures()[i]->getImageView();
+            textureDescInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            texturesDescSet->writeImage(0, 0, textureDescInfo, i);
+        }
     }
 
     void EngineRenderer::updateDescriptorSets() {
@@ -255,8 +278,8 @@ namespace core {
         cameraUBO.projInverse = scene->getMainCamera().getProjectionInverseMatrix();
         // TODO - cameraUBO.position = scene->getMainCamera().getWorldPosition();
 
-        // Map new camera descriptor buffer data to current frame's camera descriptor buffer.
-        ResourceAllocator::mapDataToBuffer(cameraDescBuffer, sizeof(CameraDescriptorBuffer), &cameraUBO, cameraDescBufferAlignment * currentSwapchainIndex);
+        // Write camera descriptor buffer data into the current frame's scratch memory.
+        cameraDescOffset = static_cast<uint32_t>(frameAllocator->push(cameraUBO).offset);
     }
 
     void EngineRenderer::updateTextureArrayDescriptor() {
@@ -274,7 +297,25 @@ namespace core {
         pathtracedRenderer = new PathTracedRenderer(EngineContext::getDevice(), EngineContext::getGraphicsQueue(), EngineContext::getPresentQueue(), EngineRenderer::getSwapchain(), std::vector<DescriptorSet*>{ cameraDescSet, texturesDescSet });
     }
 
+    const double DEFRAGMENTATION_TIME_BUDGET_MS = 0.5; // CPU time spent preparing moves each frame.
+
     void EngineRenderer::render(const bool raytrace) {
+        // Wait until no renderer is still using this frame's resources, then recycle its scratch memory and retire deletions and finished async builds.
+        standardRenderer->waitForFrame(currentSwapchainIndex);
+        pathtracedRenderer->waitForFrame(currentSwapchainIndex);
+        frameAllocator->beginFrame(currentSwapchainIndex);
+        ResourceAllocator::beginFrame();
+        AsyncCompute::update();
+
+        // Advance memory defragmentation, moved resources are swapped in once no frame in flight or async compute submission can use the old ones.
+        if (Defragmenter::update(DEFRAGMENTATION_TIME_BUDGET_MS)) {
+            for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                standardRenderer->waitForFrame(i);
+                pathtracedRenderer->waitForFrame(i);
+            }
+            Defragmenter::apply();
+        }
+
         // Update all descriptors.
         updateDescriptorSets();
 
@@ -1,5 +1,6 @@
 #include <file_reader.h>
 #include <debugger.h>
+#include <image_converter.h>
 #include <iostream>
 #include <fstream>
 
@@ -48,6 +49,7 @@ namespace core {
 	};
 
 	Mesh* FileReader::readMeshFile(std::string filename) {
+		ALLOCATION_TAG("FileReader::readMeshFile");
 		const bool logReader = false;
 
 		// Read binary file
@@ -133,8 +135,12 @@ namespace core {
 	}
 
 	Texture* FileReader::readImageFile(std::string filename, const ColorSpace& colorSpace) {
+		ALLOCATION_TAG("FileReader::readImageFile");
 		// Read image file
 		std::string fullpathname = (IMAGE_FOLDER_PATH + filename);
+		if (stbi_is_hdr(fullpathname.c_str())) {
+			return readHdrImageFile(filename);
+		}
 		int width, height, colorChannels;
 		unsigned char* data = stbi_load(fullpathname.c_str(), &width, &height, &colorChannels, 4);
 
@@ -159,6 +165,50 @@ namespace core {
 		return texture;
 	}
 
+	Texture* FileReader::readHdrImageFile(std::string filename, const HdrEncoding& encoding) {
+		ALLOCATION_TAG("FileReader::readHdrImageFile");
+		// Read image file as 32-bit floats.
+		std::string fullpathname = (IMAGE_FOLDER_PATH + filename);
+		int width, height, colorChannels;
+		float* data = stbi_loadf(fullpathname.c_str(), &width, &height, &colorChannels, 4);
+		if (data == nullptr) {
+			std::cerr << "Error: HDR image " << filename.c_str() << " could not be loaded: " << stbi_failure_reason() << std::endl;
+			return nullptr;
+		}
+
+		// Pack texels into a smaller floating point format before uploading.
+		size_t texelCount = static_cast<size_t>(width) * static_cast<size_t>(height);
+		VkExtent2D extent = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+		VkFormat format;
+		void* packed;
+		switch (encoding) {
+			case HDR_ENCODING_HALF_FLOAT:
+				format = VK_FORMAT_R16G16B16A16_SFLOAT;
+				packed = new uint16_t[texelCount * 4];
+				ImageConverter::toHalfFloat(data, (uint16_t*)packed, texelCount);
+				break;
+			case HDR_ENCODING_SHARED_EXPONENT:
+				format = VK_FORMAT_E5B9G9R9_UFLOAT_PACK32;
+				packed = new uint32_t[texelCount];
+				ImageConverter::toSharedExponent(data, (uint32_t*)packed, texelCount);
+				break;
+			default: std::cerr << "Error: HDR image encoding is invalid." << std::endl; stbi_image_free(data); return nullptr;
+		}
+		stbi_image_free(data);
+
+		// Package data into Texture
+		Texture* texture = new Texture(extent, packed, format, VK_SAMPLER_ADDRESS_MODE_REPEAT, 1, VK_TRUE, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+		Debugger::setObjectName(texture->getImage().image, "[Image] " + filename);
+		Debugger::setObjectName(texture->getImageView(), "[ImageView] " + filename);
+		Debugger::setObjectName(texture->getSampler(), "[Sampler] " + filename);
+
+		// Free packed texels.
+		if (encoding == HDR_ENCODING_HALF_FLOAT) delete[] (uint16_t*)packed;
+		else delete[] (uint32_t*)packed;
+
+		return texture;
+	}
+
 	char* FileReader::readBytes(const std::string& filepath, size_t* size) {
 		// Open file stream.
 		std::ifstream stream(filepath, std::ios::binary | std::ios::ate);
@@ -0,0 +1,125 @@
+#include <host_acceleration_builder.h>
+#include <engine_globals.h>
+#include <algorithm>
+
+namespace core {
+
+	VkDevice HostAccelerationBuilder::device = VK_NULL_HANDLE;
+	bool HostAccelerationBuilder::supported = false;
+	bool HostAccelerationBuilder::enabled = false;
+	bool HostAccelerationBuilder::stopping = false;
+	std::vector<std::thread> HostAccelerationBuilder::workers;
+	std::list<HostBuild> HostAccelerationBuilder::builds;
+	std::mutex HostAccelerationBuilder::mutex;
+	std::condition_variable HostAccelerationBuilder::condition;
+
+	void HostAccelerationBuilder::setup(const VkDevice& device, const bool supported, const uint32_t threadCount) {
+		HostAccelerationBuilder::device = device;
+		HostAccelerationBuilder::supported = supported;
+		if (!supported) return;
+
+		stopping = false;
+		for (uint32_t i = 0; i < threadCount; i++) {
+			workers.emplace_back(workerLoop);
+		}
+	}
+
+	void HostAccelerationBuilder::cleanup() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+
+		// Every build is released by wait(), destroy the ones nobody waited on.
+		for (auto& build : builds) {
+			vkDestroyDeferredOperationKHR(device, build.operation, nullptr);
+		}
+		builds.clear();
+		enabled = false;
+	}
+
+	HostBuild* HostAccelerationBuilder::build(const uint32_t infoCount, const VkAccelerationStructureBuildGeometryInfoKHR* pInfos, const VkAccelerationStructureBuildRangeInfoKHR* const* ppRangeInfos) {
+		DEBUG_ASSERT_MSG(enabled, "Host acceleration structure builds are not enabled.");
+		VkDeferredOperationKHR operation;
+		VK_CHECK(vkCreateDeferredOperationKHR(device, nullptr, &operation));
+
+		// The driver may complete small builds immediately instead of deferring them.
+		VkResult result = vkBuildAccelerationStructuresKHR(device, operation, infoCount, pInfos, ppRangeInfos);
+		if (result != VK_OPERATION_DEFERRED_KHR && result != VK_OPERATION_NOT_DEFERRED_KHR) {
+			vkDestroyDeferredOperationKHR(device, operation, nullptr);
+			throw std::runtime_error("Failed to start host acceleration structure build.");
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		HostBuild& build = builds.emplace_back();
+		build.operation = operation;
+		build.maxConcurrency = std::max(1u, vkGetDeferredOperationMaxConcurrencyKHR(device, operation));
+		build.joinable = result == VK_OPERATION_DEFERRED_KHR;
+		lock.unlock();
+
+		// Wake the workers to join the new operation.
+		condition.notify_all();
+		return &build;
+	}
+
+	bool HostAccelerationBuilder::isComplete(HostBuild* build) {
+		return vkGetDeferredOperationResultKHR(device, build->operation) != VK_NOT_READY;
+	}
+
+	void HostAccelerationBuilder::wait(HostBuild* build) {
+		std::unique_lock<std::mutex> lock(mutex);
+		// Help the workers until the operation has no more work to hand out.
+		while (build->joinable) {
+			if (join(*build, lock) == VK_THREAD_IDLE_KHR) {
+				lock.unlock();
+				std::this_thread::yield();
+				lock.lock();
+			}
+		}
+		// Workers may still be finishing their part of the operation.
+		condition.wait(lock, [build]() { return build->joiners == 0; });
+
+		VkResult result = vkGetDeferredOperationResultKHR(device, build->operation);
+		vkDestroyDeferredOperationKHR(device, build->operation, nullptr);
+		builds.remove_if([build](const HostBuild& other) { return &other == build; });
+		lock.unlock();
+
+		VK_CHECK_MSG(result, "Host acceleration structure build failed.");
+	}
+
+	VkResult HostAccelerationBuilder::join(HostBuild& build, std::unique_lock<std::mutex>& lock) {
+		build.joiners++;
+		lock.unlock();
+		VkResult result = vkDeferredOperationJoinKHR(device, build.operation);
+		lock.lock();
+		build.joiners--;
+
+		// VK_THREAD_IDLE_KHR means more work may become available later, anything else ends the operation's parallelism.
+		if (result != VK_THREAD_IDLE_KHR) {
+			build.joinable = false;
+		}
+		condition.notify_all();
+		return result;
+	}
+
+	void HostAccelerationBuilder::workerLoop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopping) {
+			auto build = std::find_if(builds.begin(), builds.end(), [](const HostBuild& build) { return build.joinable && build.joiners < build.maxConcurrency; });
+			if (build == builds.end()) {
+				condition.wait(lock);
+				continue;
+			}
+			if (join(*build, lock) == VK_THREAD_IDLE_KHR) {
+				lock.unlock();
+				std::this_thread::yield();
+				lock.lock();
+			}
+		}
+	}
+}
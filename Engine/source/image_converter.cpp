@@ -0,0 +1,181 @@
+#include <image_converter.h>
+#include <engine_globals.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#if defined(ENGINE_SSE2)
+	#include <emmintrin.h>
+	#include <xmmintrin.h>
+#endif
+
+namespace core {
+
+	// Largest value representable by VK_FORMAT_E5B9G9R9_UFLOAT_PACK32: (2^9 - 1) / 2^9 * 2^(31 - 15).
+	const float SHARED_EXPONENT_MAX = 65408.0f;
+
+	//***************************************************************************************//
+	//                                    Scalar Kernels                                     //
+	//***************************************************************************************//
+
+	uint16_t ImageConverter::toHalfFloat(const float value) {
+		uint32_t f;
+		memcpy(&f, &value, sizeof(float));
+		uint32_t sign = f & 0x80000000u;
+		f ^= sign;
+
+		uint32_t out;
+		if (f >= 0x47800000u) {
+			// Infinity or NaN (keep NaNs quiet).
+			out = (f > 0x7F800000u) ? 0x7E00u : 0x7C00u;
+		} else if (f < 0x38800000u) {
+			// Subnormal or zero: let the FPU round the mantissa using a magic value.
+			const uint32_t magicBits = 0x3F000000u;
+			float magic, tmp;
+			memcpy(&magic, &magicBits, sizeof(float));
+			memcpy(&tmp, &f, sizeof(float));
+			tmp += magic;
+			memcpy(&out, &tmp, sizeof(float));
+			out -= magicBits;
+		} else {
+			// Normal: rebias exponent and round mantissa to nearest even.
+			uint32_t mantissaOdd = (f >> 13) & 1u;
+			f += 0xC8000FFFu;
+			f += mantissaOdd;
+			out = f >> 13;
+		}
+		return static_cast<uint16_t>(out | (sign >> 16));
+	}
+
+	uint32_t ImageConverter::toSharedExponent(const float r, const float g, const float b) {
+		// Clamp each channel to [0, SHARED_EXPONENT_MAX], NaN becomes 0.
+		auto clampChannel = [](float c) { return c > 0.0f ? std::min(c, SHARED_EXPONENT_MAX) : 0.0f; };
+		float rc = clampChannel(r);
+		float gc = clampChannel(g);
+		float bc = clampChannel(b);
+		float maxc = std::max(rc, std::max(gc, bc));
+
+		// Preliminary shared exponent: max(-B - 1, floor(log2(maxc))) + 1 + B.
+		uint32_t maxBits;
+		memcpy(&maxBits, &maxc, sizeof(float));
+		int32_t expP = std::max(-16, static_cast<int32_t>(maxBits >> 23) - 127) + 16;
+
+		// Bump the exponent when the largest channel rounds up to 2^N.
+		float scale = std::ldexp(1.0f, 24 - expP);
+		if (static_cast<uint32_t>(maxc * scale + 0.5f) >= 512) {
+			expP++;
+			scale *= 0.5f;
+		}
+
+		uint32_t rs = static_cast<uint32_t>(rc * scale + 0.5f);
+		uint32_t gs = static_cast<uint32_t>(gc * scale + 0.5f);
+		uint32_t bs = static_cast<uint32_t>(bc * scale + 0.5f);
+		return rs | (gs << 9) | (bs << 18) | (static_cast<uint32_t>(expP) << 27);
+	}
+
+	//***************************************************************************************//
+	//                                     SIMD Kernels                                      //
+	//***************************************************************************************//
+
+#if defined(ENGINE_SSE2)
+	// Converts four floats into four halfs (stored in the low 16 bits of each lane, sign extended).
+	static inline __m128i toHalfFloat4(const __m128 value) {
+		const __m128i signMask = _mm_set1_epi32(0x80000000);
+		const __m128i halfMax = _mm_set1_epi32(0x47800000);
+		const __m128i minNormal = _mm_set1_epi32(0x38800000);
+		const __m128i subnormalMagic = _mm_set1_epi32(0x3F000000);
+		const __m128i normalBias = _mm_set1_epi32(static_cast<int>(0xC8000FFFu));
+		const __m128i nanBit = _mm_set1_epi32(0x200);
+		const __m128i infinity = _mm_set1_epi32(0x7C00);
+
+		__m128 sign = _mm_and_ps(_mm_castsi128_ps(signMask), value);
+		__m128 absValue = _mm_xor_ps(value, sign);
+		__m128i absBits = _mm_castps_si128(absValue);
+
+		// Special values (infinity or NaN).
+		__m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absValue, absValue));
+		__m128i isRegular = _mm_cmpgt_epi32(halfMax, absBits);
+		__m128i special = _mm_or_si128(_mm_and_si128(isNaN, nanBit), infinity);
+
+		// Subnormal path.
+		__m128i isSubnormal = _mm_cmpgt_epi32(minNormal, absBits);
+		__m128 subnormalSum = _mm_add_ps(absValue, _mm_castsi128_ps(subnormalMagic));
+		__m128i subnormal = _mm_sub_epi32(_mm_castps_si128(subnormalSum), subnormalMagic);
+
+		// Normal path (round to nearest even).
+		__m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(absBits, 18), 31);
+		__m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absBits, normalBias), mantissaOdd), 13);
+
+		// Merge all paths and apply sign.
+		__m128i nonSpecial = _mm_or_si128(_mm_and_si128(isSubnormal, subnormal), _mm_andnot_si128(isSubnormal, normal));
+		__m128i merged = _mm_or_si128(_mm_and_si128(isRegular, nonSpecial), _mm_andnot_si128(isRegular, special));
+		return _mm_or_si128(merged, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+	}
+#endif
+
+	void ImageConverter::toHalfFloat(const float* src, uint16_t* dst, const size_t texelCount) {
+		size_t i = 0;
+#if defined(ENGINE_SSE2)
+		// Two RGBA texels per iteration, packed into 16 bytes of halfs.
+		for (; i + 2 <= texelCount; i += 2) {
+			__m128i h0 = toHalfFloat4(_mm_loadu_ps(src + i * 4));
+			__m128i h1 = toHalfFloat4(_mm_loadu_ps(src + i * 4 + 4));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_packs_epi32(h0, h1));
+		}
+#endif
+		for (; i < texelCount; i++) {
+			for (uint32_t c = 0; c < 4; c++) {
+				dst[i * 4 + c] = toHalfFloat(src[i * 4 + c]);
+			}
+		}
+	}
+
+	void ImageConverter::toSharedExponent(const float* src, uint32_t* dst, const size_t texelCount) {
+		size_t i = 0;
+#if defined(ENGINE_SSE2)
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 channelMax = _mm_set1_ps(SHARED_EXPONENT_MAX);
+		const __m128i minExponent = _mm_set1_epi32(-16);
+		const __m128i maxMantissa = _mm_set1_epi32(511);
+		const __m128i halveScale = _mm_set1_epi32(-(1 << 23));
+
+		// Four RGBA texels per iteration, transposed into R, G, B and A lanes.
+		for (; i + 4 <= texelCount; i += 4) {
+			__m128 r = _mm_loadu_ps(src + i * 4);
+			__m128 g = _mm_loadu_ps(src + i * 4 + 4);
+			__m128 b = _mm_loadu_ps(src + i * 4 + 8);
+			__m128 a = _mm_loadu_ps(src + i * 4 + 12);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+
+			// Clamp channels, max() returns the second operand for NaNs.
+			r = _mm_min_ps(_mm_max_ps(r, zero), channelMax);
+			g = _mm_min_ps(_mm_max_ps(g, zero), channelMax);
+			b = _mm_min_ps(_mm_max_ps(b, zero), channelMax);
+			__m128 maxc = _mm_max_ps(r, _mm_max_ps(g, b));
+
+			// Preliminary shared exponent from the float exponent bits.
+			__m128i exponent = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(maxc), 23), _mm_set1_epi32(127));
+			__m128i belowMin = _mm_cmpgt_epi32(minExponent, exponent);
+			exponent = _mm_or_si128(_mm_and_si128(belowMin, minExponent), _mm_andnot_si128(belowMin, exponent));
+			__m128i expP = _mm_add_epi32(exponent, _mm_set1_epi32(16));
+
+			// Scale of 2^(24 - expP) built directly from exponent bits.
+			__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(151), expP), 23));
+			__m128i maxS = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(maxc, scale), half));
+			__m128i overflow = _mm_cmpgt_epi32(maxS, maxMantissa);
+			expP = _mm_sub_epi32(expP, overflow);
+			scale = _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(scale), _mm_and_si128(overflow, halveScale)));
+
+			__m128i rs = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half));
+			__m128i gs = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half));
+			__m128i bs = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half));
+			__m128i packed = _mm_or_si128(_mm_or_si128(rs, _mm_slli_epi32(gs, 9)), _mm_or_si128(_mm_slli_epi32(bs, 18), _mm_slli_epi32(expP, 27)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+		}
+#endif
+		for (; i < texelCount; i++) {
+			dst[i] = toSharedExponent(src[i * 4], src[i * 4 + 1], src[i * 4 + 2]);
+		}
+	}
+}
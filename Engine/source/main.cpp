@@ -8,6 +8,9 @@
 #include <scene.h>
 #include <resource_primitives.h>
 #include <file_reader.h>
+#include <host_acceleration_builder.h>
+#include <bvh.h>
+#include <rtime.h>
 
 #include <iostream>
 #include <Vulkan/vulkan.h>
@@ -34,6 +37,7 @@ int main() {
     // Print queue indices.
     std::cout << "Graphics Queue: " << EngineContext::getGraphicsQueue() << std::endl;
     std::cout << "Present Queue:  " << EngineContext::getPresentQueue() << std::endl;
+    std::cout << "Transfer Queue: " << EngineContext::getTransferQueue() << std::endl;
 
     // Print Device Properties.
     std::cout << "Max Bound Descriptor Sets: " << EngineContext::getPhysicalDeviceProperties().deviceProperties.limits.maxBoundDescriptorSets << std::endl;
@@ -43,6 +47,15 @@ int main() {
     std::cout << "Max Instance Count: " << EngineContext::getPhysicalDeviceProperties().accelStructProperties.maxInstanceCount << std::endl;
     std::cout << "Min Uniform Buffer Offset Alignment: " << EngineContext::getPhysicalDeviceProperties().deviceProperties.limits.minUniformBufferOffsetAlignment << std::endl;
 
+    // Build acceleration structures on the CPU worker threads when the driver supports host commands.
+    HostAccelerationBuilder::setEnabled(true);
+    std::cout << "Host Acceleration Structure Builds: " << (HostAccelerationBuilder::isEnabled() ? "enabled" : "unsupported") << std::endl;
+    // Meshes keep a CPU BVH for scene queries.
+    SceneBVH::setEnabled(true);
+
+    // Record all scene resource uploads into a single batch.
+    ResourceAllocator::beginUploadBatch();
+
     // Create Meshes.
     Mesh* anvil = FileReader::readMeshFile("anvil");
     Mesh* quad = ResourcePrimitives::createQuad(2.0f);
@@ -57,18 +70,21 @@ int main() {
     // Create Scene.
     Scene* scene = new Scene();
     // Create Materials.
-    Material* cubeMat =   scene->addMaterial(riverDirtDiffuse, glm::vec3(1.0f, 0.0f, 0.0f), nullptr, 0.0f, 0.5f, riverDirtNormal, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
-    Material* mirrorMat = scene->addMaterial(testTex, glm::vec3(0.0f, 1.0f, 0.0f), nullptr, 0.0f, 0.5f, nullptr, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
-    Material* floorMat =  scene->addMaterial(testTex, glm::vec3(0.0f, 0.0f, 1.0f), nullptr, 0.0f, 0.5f, nullptr, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
-    Material* anvilMat =  scene->addMaterial(riverDirtDiffuse, glm::vec3(1.0f, 0.0f, 1.0f), nullptr, 0.0f, 0.5f, riverDirtNormal, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
+    Handle<Material> cubeMat =   scene->addMaterial(riverDirtDiffuse, glm::vec3(1.0f, 0.0f, 0.0f), nullptr, 0.0f, 0.5f, riverDirtNormal, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
+    Handle<Material> mirrorMat = scene->addMaterial(testTex, glm::vec3(0.0f, 1.0f, 0.0f), nullptr, 0.0f, 0.5f, nullptr, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
+    Handle<Material> floorMat =  scene->addMaterial(testTex, glm::vec3(0.0f, 0.0f, 1.0f), nullptr, 0.0f, 0.5f, nullptr, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
+    Handle<Material> anvilMat =  scene->addMaterial(riverDirtDiffuse, glm::vec3(1.0f, 0.0f, 1.0f), nullptr, 0.0f, 0.5f, riverDirtNormal, glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 0.0f));
     // Create Objects.
     glm::mat4 mirrorRotation = glm::rotate(glm::mat4(1.0f), glm::radians(5.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-    Object* mirror1  = scene->addObject(quad, std::vector{mirrorMat}, glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.0f, -7.5f))* (glm::rotate(glm::mat4(1.0f), glm::radians(-45.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * mirrorRotation), 0);
-    Object* mirror2  = scene->addObject(quad, std::vector{mirrorMat}, glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f,  0.0f, -2.5f)) * (glm::rotate(glm::mat4(1.0f), glm::radians(135.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * mirrorRotation), 0);
-    Object* demoCube = scene->addObject(cube, std::vector{ cubeMat }, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, -5.0f)), 0);
-    Object* floor    = scene->addObject(plane, std::vector{ floorMat }, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -2.0f, -5.0f)), 0);
-    Object* anvilObj = scene->addObject(anvil, std::vector{ anvilMat }, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -2.0f, -2.0f)), 0);
-    Camera* camera   = scene->addCamera(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 5.0f)), 60.0f, EngineContext::getWindow().getAspectRatio());
+    Handle<Object> mirror1  = scene->addObject(quad, std::vector{mirrorMat}, glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, 0.0f, -7.5f))* (glm::rotate(glm::mat4(1.0f), glm::radians(-45.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * mirrorRotation), 0, true);
+    Handle<Object> mirror2  = scene->addObject(quad, std::vector{mirrorMat}, glm::translate(glm::mat4(1.0f), glm::vec3(-3.0f,  0.0f, -2.5f)) * (glm::rotate(glm::mat4(1.0f), glm::radians(135.0f), glm::vec3(0.0f, 1.0f, 0.0f)) * mirrorRotation), 0, true);
+    Handle<Object> demoCube = scene->addObject(cube, std::vector{ cubeMat }, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, -5.0f)), 0);
+    Handle<Object> floor    = scene->addObject(plane, std::vector{ floorMat }, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -2.0f, -5.0f)), 0, true);
+    Handle<Object> anvilObj = scene->addObject(anvil, std::vector{ anvilMat }, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -2.0f, -2.0f)), 0);
+    Handle<Camera> camera   = scene->addCamera(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 5.0f)), 60.0f, EngineContext::getWindow().getAspectRatio());
+    // Submit scene resource uploads, graphics and async compute submissions that follow are ordered after them.
+    ResourceAllocator::submitUploadBatch();
+
     // Setup Scene.
     scene->setup();
 
@@ -91,6 +107,23 @@ int main() {
             raytrace = false;
         }
 
+        // Dump GPU memory statistics.
+        if (Input::getKeyDown(INPUT_KEY_M)) {
+            ResourceAllocator::dumpMemoryStats("memory_stats.json");
+#if(ALLOCATION_TRACING_ENABLED)
+            AllocationTracer::printLeakReport();
+            AllocationTracer::exportTimeline("allocation_trace.json");
+#endif
+        }
+        // Defragment GPU memory.
+        if (Input::getKeyDown(INPUT_KEY_F)) {
+            Defragmenter::start();
+        }
+
+        // Spin the demo cube, its TLAS instance is refitted without rebuilding the scene.
+        float cubeAngle = static_cast<float>(Time::getElapsedTime()) * glm::radians(30.0f);
+        scene->setTransform(demoCube, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, -5.0f)) * glm::rotate(glm::mat4(1.0f), cubeAngle, glm::vec3(0.0f, 1.0f, 0.0f)));
+
         // Update scene.
         scene->update();
 
@@ -1,4 +1,5 @@
 #include <material.h>
+#include <utility>
 
 namespace core {
 
@@ -19,29 +20,68 @@ namespace core {
 		this->albedoMapIndex = 0xFFFF;
 		this->metallicMapIndex = 0xFFFF;
 		this->normalMapIndex = 0xFFFF;
+		this->materialPool = nullptr;
 	}
 
 	Material::~Material() { 
 		cleanup(); 
 	}
 
+	Material::Material(Material&& other) noexcept {
+		materialPool = nullptr;
+		*this = std::move(other);
+	}
+
+	Material& Material::operator=(Material&& other) noexcept {
+		if (this == &other) return *this;
+		cleanup();
+		albedoMap = other.albedoMap;
+		albedo = other.albedo;
+		metallicMap = other.metallicMap;
+		metallic = other.metallic;
+		smoothness = other.smoothness;
+		normalMap = other.normalMap;
+		tilling = other.tilling;
+		offset = other.offset;
+		albedoMapIndex = other.albedoMapIndex;
+		metallicMapIndex = other.metallicMapIndex;
+		normalMapIndex = other.normalMapIndex;
+		materialPool = other.materialPool;
+		materialRegion = other.materialRegion;
+		// The moved-from material no longer owns the region.
+		other.materialPool = nullptr;
+		other.materialRegion = BufferRegion();
+		return *this;
+	}
+
 	void Material::cleanup() {
-		ResourceAllocator::destroyBuffer(materialBuffer);
+		// Material region is owned by the scene's material pool.
+		if (materialPool != nullptr && materialRegion.isValid()) {
+			materialPool->free(materialRegion);
+		}
+		materialRegion = BufferRegion();
+		materialPool = nullptr;
+	}
+
+	VkDeviceSize Material::getDataSize() {
+		return sizeof(MaterialData);
 	}
 
-	void Material::setup(uint16_t albedoMapIndex, uint16_t metallicMapIndex, uint16_t normalMapIndex) {
+	void Material::setup(PoolSuballocator* pool, uint16_t albedoMapIndex, uint16_t metallicMapIndex, uint16_t normalMapIndex) {
 		this->albedoMapIndex = albedoMapIndex;
 		this->metallicMapIndex = metallicMapIndex;
 		this->normalMapIndex = normalMapIndex;
-		createMaterialBuffer(materialBuffer);
+		this->materialPool = pool;
+		this->materialRegion = pool->allocate();
+		uploadMaterialData(materialRegion);
 	}
 
-	void Material::createMaterialBuffer(Buffer& buffer) {
+	void Material::uploadMaterialData(const BufferRegion& region) {
 		// Create material data.
 		MaterialData data{albedo, albedoMapIndex, metallicMapIndex, normalMapIndex, metallic, smoothness, tilling, offset};
 
-		// Create and stage buffer.
-		ResourceAllocator::createAndStageBuffer(sizeof(MaterialData), &data, buffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+		// Stage data into the material's region.
+		ResourceAllocator::uploadToBuffer(region.buffer, region.offset, sizeof(MaterialData), &data);
 	}
 
 }
\ No newline at end of file
@@ -1,11 +1,46 @@
 #include <mesh.h>
 #include <engine_context.h>
+#include <defragmenter.h>
+#include <host_acceleration_builder.h>
+#include <bvh.h>
+#include <scene.h>
+#include <algorithm>
 
 namespace core {
 
-	Mesh::Submesh::Submesh(uint32_t* indices, uint32_t indexCount) {
+	// Index regions are aligned for index buffer binding and acceleration structure build inputs.
+	const VkDeviceSize INDEX_REGION_ALIGNMENT = 16;
+	const VkBufferUsageFlags INDEX_BUFFER_USAGE = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+	// Refitting keeps the BVH topology, so its quality degrades as triangles move away from where they were built.
+	// Deformable BLAS are rebuilt after this many refits, or once their bounds grew past this ratio of the built bounds.
+	const uint32_t BLAS_REBUILD_INTERVAL = 120;
+	const float BLAS_REBUILD_AREA_RATIO = 1.5f;
+
+	// Total size of all index regions, used to fit the mesh's indices in a single block.
+	static VkDeviceSize getIndexBlockSize(uint32_t submeshCount, uint32_t* indexCountList) {
+		VkDeviceSize size = 0;
+		for (uint32_t i = 0; i < submeshCount; i++) {
+			size += ((sizeof(uint32_t) * indexCountList[i] + INDEX_REGION_ALIGNMENT - 1) / INDEX_REGION_ALIGNMENT) * INDEX_REGION_ALIGNMENT;
+		}
+		return std::max<VkDeviceSize>(size, INDEX_REGION_ALIGNMENT);
+	}
+
+	// 64-bit FNV-1a, chained through the seed.
+	static uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xCBF29CE484222325ull) {
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++) {
+			seed = (seed ^ bytes[i]) * 0x100000001B3ull;
+		}
+		return seed;
+	}
+
+	Mesh::Submesh::Submesh(const BufferRegion& indexRegion, uint32_t indexCount, uint32_t* indices) {
 		this->indexCount = indexCount;
-		createIndexBuffer(indices, indexCount, this->indexBuffer);
+		this->indexRegion = indexRegion;
+		// Host builds read the indices from host memory.
+		if (HostAccelerationBuilder::isEnabled()) {
+			this->indices.assign(indices, indices + indexCount);
+		}
 	}
 
 	Mesh::Submesh::~Submesh() {
@@ -13,21 +48,38 @@ namespace core {
 	}
 
 	void Mesh::Submesh::cleanup() {
-		ResourceAllocator::destroyBuffer(indexBuffer);
+		Scene::cancelCompaction(&blas);
+		Defragmenter::unregister(blas.allocation);
 		ResourceAllocator::destroyAccelerationStructure(blas);
 	}
 
-	Mesh::Mesh(float* vertices, uint32_t vertexCount, uint32_t submeshCount, uint32_t** indicesList, uint32_t* indexCountList) {
+	Mesh::Mesh(float* vertices, uint32_t vertexCount, uint32_t submeshCount, uint32_t** indicesList, uint32_t* indexCountList, const bool deformable)
+		: indexAllocator(getIndexBlockSize(submeshCount, indexCountList), INDEX_REGION_ALIGNMENT, INDEX_BUFFER_USAGE, MEMORY_USAGE_GPU_ONLY) {
 		// Create vertices
 		this->vertexCount = vertexCount;
-		createVertexBuffer((Vertex*)vertices, vertexCount, this->vertexBuffer);
+		createVertexBuffer((Vertex*)vertices, vertexCount, this->vertexBuffer, !deformable);
+		this->contentHash = hashBytes(vertices, sizeof(Vertex) * vertexCount);
+
+		// Deformable meshes and host builds keep the vertices on the host.
+		this->deformable = deformable;
+		if (deformable || HostAccelerationBuilder::isEnabled()) {
+			this->vertices.assign((Vertex*)vertices, (Vertex*)vertices + vertexCount);
+			this->builtSurfaceArea = getSurfaceArea();
+		}
+
+		// Build the CPU query BVH while the indices are still around.
+		if (SceneBVH::isEnabled()) {
+			this->bvh = new MeshBVH((Vertex*)vertices, submeshCount, indicesList, indexCountList);
+		}
 
 		// Create Submeshes
 		this->submeshCount = submeshCount;
 		this->submeshes = new Submesh*[submeshCount];
 		for (uint32_t i = 0; i < submeshCount; i++) {
-			// Create submesh object using indices array and index count
-			this->submeshes[i] = new Submesh(indicesList[i], indexCountList[i]);
+			// Create submesh object using its region of the index buffer
+			this->submeshes[i] = new Submesh(createIndexRegion(indicesList[i], indexCountList[i], indexAllocator), indexCountList[i], indicesList[i]);
+			this->contentHash = hashBytes(&indexCountList[i], sizeof(uint32_t), this->contentHash);
+			this->contentHash = hashBytes(indicesList[i], sizeof(uint32_t) * indexCountList[i], this->contentHash);
 			// Delete indices array after copied into submesh buffer
 			delete indicesList[i];
 		}
@@ -38,19 +90,77 @@ namespace core {
 	}
 
 	void Mesh::cleanup() {
+		Defragmenter::unregister(vertexBuffer.allocation);
 		ResourceAllocator::destroyBuffer(vertexBuffer);
 		for (uint32_t i = 0; i < submeshCount; i++) 
 			delete submeshes[i];
 		delete[] submeshes;
+		indexAllocator.cleanup();
+		delete bvh;
+		bvh = nullptr;
+	}
+
+	void Mesh::updateVertices(const Vertex* vertices) {
+		DEBUG_ASSERT_MSG(deformable, "Only deformable meshes can update their vertices.");
+		this->vertices.assign(vertices, vertices + vertexCount);
+		this->pendingVertices = true;
+		if (bvh != nullptr) bvh->refit(vertices);
+	}
+
+	bool Mesh::hasHostGeometry() {
+		for (uint32_t i = 0; i < submeshCount; i++) {
+			if (submeshes[i]->getIndices().size() != submeshes[i]->getIndexCount()) return false;
+		}
+		return vertices.size() == vertexCount;
+	}
+
+	void Mesh::releaseHostGeometry() {
+		// Deformable meshes still upload their vertices every frame.
+		if (!deformable) {
+			std::vector<Vertex>().swap(vertices);
+		}
+		for (uint32_t i = 0; i < submeshCount; i++) {
+			std::vector<uint32_t>().swap(submeshes[i]->getIndices());
+		}
+	}
+
+	bool Mesh::consumePendingVertices() {
+		pendingVertices = false;
+		float surfaceArea = getSurfaceArea();
+		if (refitCount >= BLAS_REBUILD_INTERVAL || surfaceArea > builtSurfaceArea * BLAS_REBUILD_AREA_RATIO) {
+			refitCount = 0;
+			builtSurfaceArea = surfaceArea;
+			return true;
+		}
+		refitCount++;
+		return false;
+	}
+
+	float Mesh::getSurfaceArea() {
+		if (vertices.empty()) return 0.0f;
+		glm::vec3 min = vertices[0].position;
+		glm::vec3 max = vertices[0].position;
+		for (const auto& vertex : vertices) {
+			min = glm::min(min, vertex.position);
+			max = glm::max(max, vertex.position);
+		}
+		glm::vec3 extent = max - min;
+		return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
 	}
 
-	void Mesh::createVertexBuffer(Vertex* vertices, uint32_t vertexCount, Buffer& vertexBuffer) {
+	void Mesh::createVertexBuffer(Vertex* vertices, uint32_t vertexCount, Buffer& vertexBuffer, const bool relocatable) {
 		VkDeviceSize bufferSize = sizeof(vertices[0]) * vertexCount;
-		ResourceAllocator::createAndStageBuffer(bufferSize, vertices, vertexBuffer, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+		VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+		ResourceAllocator::createAndStageBuffer(bufferSize, vertices, vertexBuffer, usage);
+		// Vertex buffers may be moved by the defragmenter, the scene picks up the new address.
+		// Deformable vertices are rewritten every frame, a relocation would swap in a stale copy.
+		if (relocatable) Defragmenter::registerBuffer(vertexBuffer, bufferSize, usage);
 	}
 
-	void Mesh::createIndexBuffer(uint32_t* indices, uint32_t indexCount, Buffer& indexBuffer) {
-		VkDeviceSize bufferSize = sizeof(indices[0]) * indexCount;
-		ResourceAllocator::createAndStageBuffer(bufferSize, indices, indexBuffer, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+	BufferRegion Mesh::createIndexRegion(uint32_t* indices, uint32_t indexCount, LinearSuballocator& indexAllocator) {
+		VkDeviceSize regionSize = sizeof(indices[0]) * indexCount;
+		BufferRegion region = indexAllocator.allocate(regionSize);
+		ResourceAllocator::uploadToBuffer(region.buffer, region.offset, region.size, indices);
+		return region;
 	}
 }
\ No newline at end of file
@@ -128,6 +128,7 @@ namespace core {
 	}
 
 	void RayTracingPipeline::createShaderBindingTable() {
+		ALLOCATION_TAG("RayTracingPipeline::createShaderBindingTable");
 		uint32_t missCount = 1;
 		uint32_t hitCount = 1;
 		uint32_t handleCount = 1 + missCount + hitCount;
@@ -149,39 +150,41 @@ namespace core {
 			throw std::runtime_error("Failed to get shader group handles.");
 		}
 
-		// Create SBT buffer.
-		VkDeviceSize sbtSize = sbt.rgenRegion.size + sbt.missRegion.size + sbt.hitRegion.size + sbt.callRegion.size;
-		VkBufferUsageFlags stbBufferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR;
-		ResourceAllocator::createBuffer(sbtSize, sbt.buffer, stbBufferUsage);
-		Debugger::setObjectName(sbt.buffer.buffer, "SBT");
-		
-		// Find the SBT addresses of each group.
-		VkDeviceAddress sbtAddress = sbt.buffer.getDeviceAddress();
-		sbt.rgenRegion.deviceAddress = sbtAddress;
-		sbt.missRegion.deviceAddress = sbtAddress + sbt.rgenRegion.size;
-		sbt.hitRegion.deviceAddress  = sbtAddress + sbt.rgenRegion.size + sbt.missRegion.size;
-
 		// Helper to retrieve the handle data
 		auto getHandle = [&] (int i) { return handles.data() + i * handleSize; };
 
-		// Map SBT buffer with SBT handles.
+		// Lay out SBT handles on the host.
+		VkDeviceSize sbtSize = sbt.rgenRegion.size + sbt.missRegion.size + sbt.hitRegion.size + sbt.callRegion.size;
+		std::vector<uint8_t> sbtData(sbtSize, 0);
+		uint8_t* pData = sbtData.data();
 		uint32_t offset = 0;
 		uint32_t handleIndex = 0; 
 
 		// Raygen
 		offset = 0;
-		ResourceAllocator::mapDataToBuffer(sbt.buffer, handleSize, getHandle(handleIndex++), offset);
+		memcpy(pData + offset, getHandle(handleIndex++), handleSize);
 		// Miss
 		offset = static_cast<uint32_t>(sbt.rgenRegion.size);
 		for (uint32_t i = 0; i < missCount; i++) {
-			ResourceAllocator::mapDataToBuffer(sbt.buffer, handleSize, getHandle(handleIndex++), offset);
+			memcpy(pData + offset, getHandle(handleIndex++), handleSize);
 			offset += static_cast<uint32_t>(sbt.missRegion.stride);
 		}
 		// Hit
 		offset = static_cast<uint32_t>(sbt.rgenRegion.size + sbt.missRegion.size);
 		for (uint32_t i = 0; i < hitCount; i++) {
-			ResourceAllocator::mapDataToBuffer(sbt.buffer, handleSize, getHandle(handleIndex++), offset);
+			memcpy(pData + offset, getHandle(handleIndex++), handleSize);
 			offset += static_cast<uint32_t>(sbt.hitRegion.stride);
 		}
+
+		// Create and stage SBT buffer into device-local memory.
+		VkBufferUsageFlags stbBufferUsage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR;
+		ResourceAllocator::createAndStageBuffer(sbtSize, sbtData.data(), sbt.buffer, stbBufferUsage);
+		Debugger::setObjectName(sbt.buffer.buffer, "SBT");
+
+		// Find the SBT addresses of each group.
+		VkDeviceAddress sbtAddress = sbt.buffer.getDeviceAddress();
+		sbt.rgenRegion.deviceAddress = sbtAddress;
+		sbt.missRegion.deviceAddress = sbtAddress + sbt.rgenRegion.size;
+		sbt.hitRegion.deviceAddress  = sbtAddress + sbt.rgenRegion.size + sbt.missRegion.size;
 	}
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include <renderer/pathtraced_renderer.h>
 #include <engine_context.h>
+#include <async_compute.h>
+#include <defragmenter.h>
 
 namespace core {
 
@@ -19,6 +21,7 @@ namespace core {
     }
 
     void PathTracedRenderer::cleanup() {
+        Defragmenter::removeListener(relocationListener);
         // Cleanup pipelines.
         delete static_cast<RayTracingPipeline*>(this->rtPipeline);
         delete static_cast<PostPipeline*>(this->postPipeline);
@@ -148,16 +151,10 @@ namespace core {
     }
 
     void PathTracedRenderer::initDescriptorSets(Scene& scene) {
+        ALLOCATION_TAG("PathTracedRenderer::initDescriptorSets");
         // Initialize descriptors for every frames in flight.
         VkDescriptorImageInfo imageDescInfos[MAX_FRAMES_IN_FLIGHT];
         for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            // Upload TLAS descriptor.
-            VkWriteDescriptorSetAccelerationStructureKHR tlasDescInfo{};
-            tlasDescInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
-            tlasDescInfo.accelerationStructureCount = 1;
-            tlasDescInfo.pAccelerationStructures = &scene.getTLAS().handle;
-            rtDescSet->writeAccelerationStructureKHR(i, 0, tlasDescInfo);
-
             // Upload ray-tracing render pass output image uniform.
             Texture* outTexture = new Texture(swapChain.extent, nullptr, VK_FORMAT_R32G32B32A32_SFLOAT, VK_SAMPLER_ADDRESS_MODE_REPEAT, 1, VK_FALSE, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
             EngineContext::transitionImageLayout(outTexture->getImage().image, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
@@ -168,6 +165,30 @@ namespace core {
             imageDescInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
             rtDescSet->writeImage(i, 1, imageDescInfos[i]);
             postDescSet->writeImage(i, 0, imageDescInfos[i]);
+        }
+        // Upload scene descriptors.
+        writeSceneDescriptors(scene);
+        // Update descriptor sets.
+        rtDescSet->update();
+        postDescSet->update();
+
+        // The scene rebuilds its TLAS and object descriptions when the defragmenter moves their inputs, rebind them afterwards.
+        relocationListener = Defragmenter::addListener([this, &scene](const RelocationFlags& flags) {
+            if (flags & (RELOCATION_ACCELERATION_STRUCTURE_BIT | RELOCATION_BUFFER_BIT)) {
+                writeSceneDescriptors(scene);
+                rtDescSet->update();
+            }
+        }, RELOCATION_LISTENER_PRIORITY_DESCRIPTORS);
+    }
+
+    void PathTracedRenderer::writeSceneDescriptors(Scene& scene) {
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            // Upload TLAS descriptor.
+            VkWriteDescriptorSetAccelerationStructureKHR tlasDescInfo{};
+            tlasDescInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+            tlasDescInfo.accelerationStructureCount = 1;
+            tlasDescInfo.pAccelerationStructures = &scene.getTLAS().handle;
+            rtDescSet->writeAccelerationStructureKHR(i, 0, tlasDescInfo);
 
             // Upload objects description buffer.
             VkDescriptorBufferInfo objDescInfo{};
@@ -176,13 +197,19 @@ namespace core {
             objDescInfo.range = VK_WHOLE_SIZE;
             rtDescSet->writeBuffer(i, 2, objDescInfo);
         }
-        // Update descriptor sets.
-        rtDescSet->update();
-        postDescSet->update();
+        writtenTLAS = scene.getTLAS().handle;
+        writtenObjDescriptions = scene.getObjDescriptions().buffer;
     }
 
-    void PathTracedRenderer::updateDescriptorSets() {
-        // TODO
+    void PathTracedRenderer::updateDescriptorSets(Scene& scene) {
+        // The scene rebuilt its TLAS and object descriptions after its topology changed.
+        if (scene.getTLAS().handle != writtenTLAS || scene.getObjDescriptions().buffer != writtenObjDescriptions) {
+            for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                waitForFrame(i);
+            }
+            writeSceneDescriptors(scene);
+            rtDescSet->update();
+        }
     }
 
     void PathTracedRenderer::createPipeline(VkDevice device) {
@@ -209,12 +236,16 @@ namespace core {
 
         VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+        // Refit acceleration structures for objects moved and meshes deformed since the last frame.
+        scene.recordAccelerationStructureUpdate(commandBuffer, EngineRenderer::getFrameAllocator());
+
         // Bind pipeline.
         vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, this->rtPipeline->getHandle());
 
         // Bind descriptor sets.
         std::vector<VkDescriptorSet> descSets{ this->globalDescSets[0]->getHandle(currentFrame), this->globalDescSets[1]->getHandle(0), this->rtDescSet->getHandle(currentFrame) };
-        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, this->rtPipeline->getLayout(), 0, static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
+        uint32_t cameraOffset = EngineRenderer::getCameraDescOffset();
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, this->rtPipeline->getLayout(), 0, static_cast<uint32_t>(descSets.size()), descSets.data(), 1, &cameraOffset);
 
         // Upload push constants.
         RayTracingPushConstant constant;
@@ -272,6 +303,10 @@ namespace core {
         VK_CHECK(vkEndCommandBuffer(commandBuffer));
     }
 
+    void PathTracedRenderer::waitForFrame(const uint32_t currentFrame) {
+        VK_CHECK(vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX));
+    }
+
     void PathTracedRenderer::render(const uint32_t currentFrame, Scene& scene) {
         // Initialize descriptor sets on first render.
         if (firstRender) {
@@ -280,7 +315,7 @@ namespace core {
         }
 
         // Update descriptor sets.
-        updateDescriptorSets();
+        updateDescriptorSets(scene);
 
         // Wait until previous frame has finished.
         VK_CHECK(vkWaitForFences(device, 1, (VkFence*)&inFlightFences[currentFrame], VK_TRUE, UINT64_MAX));
@@ -297,19 +332,36 @@ namespace core {
         recordCommandBuffer((VkCommandBuffer&)commandBuffers[currentFrame], currentFrame, imageIndex, scene);
 
         // Submit command buffer.
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
+        // Tracing and refits wait for the acceleration structure builds on the async compute queue, other work overlaps them.
+        ComputeToken compute = AsyncCompute::getLastToken();
+        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR };
+        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame], compute.semaphore };
+        uint64_t waitValues[] = { 0, compute.value }; // Binary semaphore values are ignored.
+        // Later async compute submissions read the BLAS this frame refits, they wait on its graphics token.
+        ComputeToken graphics = AsyncCompute::signalFromGraphics();
+        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame], graphics.semaphore };
+        uint64_t signalValues[] = { 0, graphics.value };
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 2;
+        timelineInfo.pWaitSemaphoreValues = waitValues;
+        timelineInfo.signalSemaphoreValueCount = 2;
+        timelineInfo.pSignalSemaphoreValues = signalValues;
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.waitSemaphoreCount = 2;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
-        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.signalSemaphoreCount = 2;
         submitInfo.pSignalSemaphores = signalSemaphores;
+        submitInfo.pNext = &timelineInfo;
+
+        // Make this frame's scratch writes visible to the device.
+        EngineRenderer::getFrameAllocator().flush();
 
         VK_CHECK_MSG(vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]), "Failed to submit draw ray-traced command buffer.");
 
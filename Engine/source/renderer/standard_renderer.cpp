@@ -1,6 +1,7 @@
 #include <renderer/standard_renderer.h>
 #include <engine_globals.h>
 #include <engine_context.h>
+#include <async_compute.h>
 #include <pipeline/standard_pipeline.h>
 
 namespace core {
@@ -37,11 +38,13 @@ namespace core {
     }
 
     void StandardRenderer::createDepthBuffer() {
+        ALLOCATION_TAG("StandardRenderer::createDepthBuffer");
         // Select supported depth image format.
         this->depthImageFormat = VK_FORMAT_D32_SFLOAT;
 
         // Create depth image.
-        ResourceAllocator::createImage2D(swapChain.extent, depthImageFormat, 1, depthImage, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        // Depth is never stored, so it can live in transient (lazily allocated) memory.
+        ResourceAllocator::createImage2D(swapChain.extent, depthImageFormat, 1, depthImage, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
         ResourceAllocator::createImageView2D(depthImage.image, depthImageView, depthImageFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
         EngineContext::transitionImageLayout(depthImage.image, depthImageFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
     }
@@ -175,6 +178,9 @@ namespace core {
 
         VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
 
+        // Upload deformed vertices, acceleration structures are kept in sync for the path tracer.
+        scene.recordAccelerationStructureUpdate(commandBuffer, EngineRenderer::getFrameAllocator());
+
         // Render pass clear values
         std::array<VkClearValue, 2> clearValues{};
         clearValues[0].color = {0.1f, 0.1f, 0.1f, 1.0f};
@@ -212,9 +218,8 @@ namespace core {
 
         // Bind descriptor sets.
         std::vector<VkDescriptorSet> descSets = { this->globalDescSets[0]->getHandle(currentFrame), this->globalDescSets[1]->getHandle(0) };
-        if (descSets.size() > 0) {
-            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipeline->getLayout(), 0, static_cast<uint32_t>(descSets.size()), descSets.data(), 0, nullptr);
-        }
+        uint32_t cameraOffset = EngineRenderer::getCameraDescOffset();
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, this->pipeline->getLayout(), 0, static_cast<uint32_t>(descSets.size()), descSets.data(), 1, &cameraOffset);
 
         for (const auto& object : scene.getObjects()) {
             // Bind vertex buffer
@@ -223,16 +228,17 @@ namespace core {
             vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 
             for (uint32_t i = 0; i < object.mesh->getSubmeshCount() && i < object.materials.size(); i++) {
-                // Upload push constants
+                // Write draw data to frame memory and upload its address as push constant
+                StandardDrawData drawData;
+                drawData.world = object.transform;
+                drawData.materialAddress = scene.getMaterials().at(object.materials.at(i)).getRegion().address;
                 StandardPushConstant constant;
-                constant.world = object.transform;
-                constant.view = scene.getMainCamera().getViewMatrix();
-                constant.proj = scene.getMainCamera().getProjectionMatrix();
-                constant.materialAddress = object.materials.at(i)->getBuffer().getDeviceAddress();
+                constant.drawDataAddress = EngineRenderer::getFrameAllocator().push(drawData).address;
                 vkCmdPushConstants(commandBuffer, this->pipeline->getLayout(), VK_SHADER_STAGE_VERTEX_BIT, 0, constant.getSize(), &constant);
 
                 // Bind index buffer
-                vkCmdBindIndexBuffer(commandBuffer, object.mesh->getSubmesh(i).getIndexBuffer().buffer, 0, VK_INDEX_TYPE_UINT32);
+                BufferRegion& indexRegion = object.mesh->getSubmesh(i).getIndexRegion();
+                vkCmdBindIndexBuffer(commandBuffer, indexRegion.buffer.buffer, indexRegion.offset, VK_INDEX_TYPE_UINT32);
 
                 // Draw
                 vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(object.mesh->getSubmesh(i).getIndexCount()), 1, 0, 0, 0);
@@ -245,6 +251,10 @@ namespace core {
         VK_CHECK(vkEndCommandBuffer(commandBuffer));
     }
 
+    void StandardRenderer::waitForFrame(const uint32_t currentFrame) {
+        VK_CHECK(vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX));
+    }
+
     void StandardRenderer::render(const uint32_t currentFrame, Scene& scene) {
         // Update descriptor sets.
         updateDescriptorSets();
@@ -264,19 +274,36 @@ namespace core {
         recordCommandBuffer(commandBuffers[currentFrame], currentFrame, imageIndex, scene);
 
         // Submit command buffer.
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
+        // Refits wait for the acceleration structure builds on the async compute queue, rasterization overlaps them.
+        ComputeToken compute = AsyncCompute::getLastToken();
+        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR };
+        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame], compute.semaphore };
+        uint64_t waitValues[] = { 0, compute.value }; // Binary semaphore values are ignored.
+        // Later async compute submissions read the BLAS this frame refits, they wait on its graphics token.
+        ComputeToken graphics = AsyncCompute::signalFromGraphics();
+        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame], graphics.semaphore };
+        uint64_t signalValues[] = { 0, graphics.value };
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 2;
+        timelineInfo.pWaitSemaphoreValues = waitValues;
+        timelineInfo.signalSemaphoreValueCount = 2;
+        timelineInfo.pSignalSemaphoreValues = signalValues;
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.waitSemaphoreCount = 2;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
-        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.signalSemaphoreCount = 2;
         submitInfo.pSignalSemaphores = signalSemaphores;
+        submitInfo.pNext = &timelineInfo;
+
+        // Make this frame's scratch writes visible to the device.
+        EngineRenderer::getFrameAllocator().flush();
 
         VK_CHECK_MSG(vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]), "Failed to submit draw rasterized command buffer.");
 
@@ -1,38 +1,266 @@
 #include <resource_allocator.h>
 #include <engine_globals.h>
 #include <engine_context.h>
+#include <allocation_tracer.h>
+#include <algorithm>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <iostream>
 
 namespace core {
 
     VkDevice ResourceAllocator::device;
 	VkCommandPool ResourceAllocator::commandPool;
+	VkCommandPool ResourceAllocator::acquireCommandPool;
 	VkQueue ResourceAllocator::transferQueue;
+	VkQueue ResourceAllocator::graphicsQueue;
+	uint32_t ResourceAllocator::transferFamilyIndex;
+	std::vector<uint32_t> ResourceAllocator::sharedFamilyIndices;
+	uint32_t ResourceAllocator::graphicsFamilyIndex;
 	VmaAllocator ResourceAllocator::allocator;
+    VmaPool ResourceAllocator::texturePool = VK_NULL_HANDLE;
+    uint32_t ResourceAllocator::texturePoolMemoryType = 0;
+    Buffer ResourceAllocator::stagingBuffer;
+    uint8_t* ResourceAllocator::stagingData = nullptr;
+    VkDeviceSize ResourceAllocator::stagingHead = 0;
+    VkDeviceSize ResourceAllocator::stagingTail = 0;
+    VkDeviceSize ResourceAllocator::stagingSubmitted = 0;
+    std::deque<StagingSubmission> ResourceAllocator::stagingSubmissions;
+    VkSemaphore ResourceAllocator::uploadSemaphore;
+    uint64_t ResourceAllocator::uploadSemaphoreValue = 0;
+    VkSemaphore ResourceAllocator::acquireSemaphore;
+    uint64_t ResourceAllocator::acquireSemaphoreValue = 0;
+    UploadToken ResourceAllocator::lastUploadToken;
+    std::vector<UploadContext> ResourceAllocator::uploadContexts;
+    std::vector<UploadContext> ResourceAllocator::acquireContexts;
+    int32_t ResourceAllocator::activeUpload = -1;
+    std::vector<VkImageMemoryBarrier> ResourceAllocator::pendingImageBarriers;
+    std::vector<VkImageMemoryBarrier> ResourceAllocator::pendingImageTransitions;
+    uint64_t ResourceAllocator::frameCounter = 0;
+    std::deque<DeferredDeletion> ResourceAllocator::deletionQueue;
+    std::unordered_map<VmaAllocation, AllocationCategory> ResourceAllocator::allocationCategories;
+    CategoryStats ResourceAllocator::categoryStats[ALLOCATION_CATEGORY_COUNT];
+    uint32_t ResourceAllocator::frameAllocations = 0;
+    uint32_t ResourceAllocator::frameFrees = 0;
+    uint32_t ResourceAllocator::lastFrameAllocations = 0;
+    uint32_t ResourceAllocator::lastFrameFrees = 0;
+
+    // Rounds offset up to a multiple of alignment (which need not be a power of two).
+    static VkDeviceSize alignOffset(const VkDeviceSize offset, const VkDeviceSize alignment) {
+        return ((offset + alignment - 1) / alignment) * alignment;
+    }
 
-    VkDeviceAddress Buffer::getDeviceAddress() {
-        return ResourceAllocator::getBufferDeviceAddress(this->buffer);
+    static VkImageAspectFlags getImageAspect(const VkFormat& format) {
+        switch (format) {
+            case VK_FORMAT_D32_SFLOAT: case VK_FORMAT_D16_UNORM: return VK_IMAGE_ASPECT_DEPTH_BIT;
+            case VK_FORMAT_D32_SFLOAT_S8_UINT: case VK_FORMAT_D24_UNORM_S8_UINT: return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+            default: return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
     }
 
-    bool Buffer::isCreated() {
-        return !(this->buffer == VK_NULL_HANDLE);
+    VkImageCreateInfo ResourceAllocator::getImage2DCreateInfo(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VkImageUsageFlags& usage) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.extent.width = extent.width;
+        imageInfo.extent.height = extent.height;
+        imageInfo.extent.depth = 1;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = usage;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        return imageInfo;
     }
 
-    VkDeviceAddress AccelerationStructure::getDeviceAddress() {
-        return ResourceAllocator::getBufferDeviceAddress(this->buffer);
+    bool Buffer::isCreated() {
+        return !(this->buffer == VK_NULL_HANDLE);
     }
 
-    void ResourceAllocator::setup(const VkInstance& instance, const VkPhysicalDevice& physicalDevice, const VkDevice& device, const uint32_t familyQueueIndex) {
+    void ResourceAllocator::setup(const VkInstance& instance, const VkPhysicalDevice& physicalDevice, const VkDevice& device, const uint32_t graphicsFamilyIndex, const uint32_t transferFamilyIndex, const uint32_t computeFamilyIndex) {
         ResourceAllocator::device = device;
+        ResourceAllocator::graphicsFamilyIndex = graphicsFamilyIndex;
+        ResourceAllocator::transferFamilyIndex = transferFamilyIndex;
+        // Uploaded on the transfer family, built on the compute family and traced on the graphics family.
+        std::set<uint32_t> sharedFamilies = { graphicsFamilyIndex, transferFamilyIndex, computeFamilyIndex };
+        sharedFamilyIndices.assign(sharedFamilies.begin(), sharedFamilies.end());
         createAllocator(instance, physicalDevice);
-        fetchQueue(device, familyQueueIndex);
-        createCommandPool(familyQueueIndex);
+        createTexturePool();
+        fetchQueues(device);
+        createCommandPools();
+        createStagingBuffer();
+        createUploadSemaphores();
     }
 
     void ResourceAllocator::cleanup() {
+        waitForTransfer(uploadSemaphoreValue);
+        waitForUploadBatch({ acquireSemaphore, acquireSemaphoreValue });
+        destroyBuffer(stagingBuffer);
+        flushDeletionQueue();
+        vkDestroySemaphore(device, uploadSemaphore, nullptr);
+        vkDestroySemaphore(device, acquireSemaphore, nullptr);
         vkDestroyCommandPool(device, commandPool, nullptr);
+        vkDestroyCommandPool(device, acquireCommandPool, nullptr);
+        uploadContexts.clear();
+        acquireContexts.clear();
+        stagingSubmissions.clear();
+        vmaDestroyPool(allocator, texturePool);
+#if(ALLOCATION_TRACING_ENABLED)
+        // Every allocation still alive at this point was never destroyed by its owner.
+        AllocationTracer::printLeakReport();
+#endif
         vmaDestroyAllocator(allocator);
     }
 
+    //***************************************************************************************//
+    //                                   Deferred Deletion                                   //
+    //***************************************************************************************//
+
+    void ResourceAllocator::beginFrame() {
+        frameCounter++;
+        lastFrameAllocations = frameAllocations;
+        lastFrameFrees = frameFrees;
+        frameAllocations = 0;
+        frameFrees = 0;
+        // Frames up to (frameCounter - MAX_FRAMES_IN_FLIGHT) have completed once the current frame's fence was waited on.
+        while (!deletionQueue.empty() && deletionQueue.front().frame + MAX_FRAMES_IN_FLIGHT <= frameCounter) {
+            deletionQueue.front().destroy();
+            deletionQueue.pop_front();
+        }
+#if(ALLOCATION_TRACING_ENABLED)
+        AllocationTracer::collect();
+#endif
+    }
+
+    void ResourceAllocator::deferDestroy(std::function<void()>&& destroy) {
+        deletionQueue.push_back({ frameCounter, std::move(destroy) });
+    }
+
+    void ResourceAllocator::flushDeletionQueue() {
+        for (auto& deletion : deletionQueue) {
+            deletion.destroy();
+        }
+        deletionQueue.clear();
+    }
+
+    //***************************************************************************************//
+    //                                      Statistics                                       //
+    //***************************************************************************************//
+
+    AllocationCategory ResourceAllocator::getBufferCategory(const VkBufferUsageFlags& usage, const MemoryUsage& memoryUsage) {
+        if (usage & VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR) return ALLOCATION_CATEGORY_ACCELERATION_STRUCTURE;
+        if (usage & (VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT)) return ALLOCATION_CATEGORY_GEOMETRY;
+        if (usage & VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR) return ALLOCATION_CATEGORY_ACCELERATION_STRUCTURE;
+        if (memoryUsage == MEMORY_USAGE_UPLOAD || memoryUsage == MEMORY_USAGE_READBACK) return ALLOCATION_CATEGORY_STAGING;
+        // GPU-only storage that is never uploaded to is scratch memory.
+        if ((usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) && !(usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) && memoryUsage == MEMORY_USAGE_GPU_ONLY) return ALLOCATION_CATEGORY_OTHER;
+        if (usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR)) return ALLOCATION_CATEGORY_DESCRIPTOR;
+        return ALLOCATION_CATEGORY_OTHER;
+    }
+
+    AllocationCategory ResourceAllocator::getImageCategory(const VkImageUsageFlags& usage) {
+        if (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT)) return ALLOCATION_CATEGORY_RENDER_TARGET;
+        return ALLOCATION_CATEGORY_TEXTURE;
+    }
+
+    void ResourceAllocator::trackAllocation(const VmaAllocation& allocation, const AllocationCategory& category, const AllocationResourceType& resourceType, const uint32_t usage) {
+        VmaAllocationInfo allocInfo;
+        vmaGetAllocationInfo(allocator, allocation, &allocInfo);
+        allocationCategories[allocation] = category;
+        categoryStats[category].allocationCount++;
+        categoryStats[category].allocationBytes += allocInfo.size;
+        frameAllocations++;
+#if(ALLOCATION_TRACING_ENABLED)
+        AllocationTracer::record(ALLOCATION_EVENT_CREATE, resourceType, reinterpret_cast<uint64_t>(allocation), allocInfo.size, usage, category, frameCounter);
+#endif
+    }
+
+    void ResourceAllocator::untrackAllocation(const VmaAllocation& allocation, const AllocationResourceType& resourceType) {
+        auto it = allocationCategories.find(allocation);
+        if (it == allocationCategories.end()) return;
+        VmaAllocationInfo allocInfo;
+        vmaGetAllocationInfo(allocator, allocation, &allocInfo);
+        categoryStats[it->second].allocationCount--;
+        categoryStats[it->second].allocationBytes -= allocInfo.size;
+#if(ALLOCATION_TRACING_ENABLED)
+        AllocationTracer::record(ALLOCATION_EVENT_DESTROY, resourceType, reinterpret_cast<uint64_t>(allocation), allocInfo.size, 0, it->second, frameCounter);
+#endif
+        allocationCategories.erase(it);
+        frameFrees++;
+    }
+
+    const char* ResourceAllocator::getAllocationCategoryName(const AllocationCategory& category) {
+        switch (category) {
+            case ALLOCATION_CATEGORY_GEOMETRY: return "geometry";
+            case ALLOCATION_CATEGORY_TEXTURE: return "textures";
+            case ALLOCATION_CATEGORY_RENDER_TARGET: return "renderTargets";
+            case ALLOCATION_CATEGORY_ACCELERATION_STRUCTURE: return "accelerationStructures";
+            case ALLOCATION_CATEGORY_STAGING: return "staging";
+            case ALLOCATION_CATEGORY_DESCRIPTOR: return "descriptors";
+            default: return "other";
+        }
+    }
+
+    MemoryStats ResourceAllocator::getMemoryStats() {
+        MemoryStats stats{};
+        const VkPhysicalDeviceMemoryProperties* memoryProperties;
+        vmaGetMemoryProperties(allocator, &memoryProperties);
+        stats.heapBudgets.resize(memoryProperties->memoryHeapCount);
+        vmaGetHeapBudgets(allocator, stats.heapBudgets.data());
+        vmaCalculateStatistics(allocator, &stats.totals);
+        for (uint32_t i = 0; i < ALLOCATION_CATEGORY_COUNT; i++) {
+            stats.categories[i] = categoryStats[i];
+        }
+        stats.frameAllocations = lastFrameAllocations;
+        stats.frameFrees = lastFrameFrees;
+        return stats;
+    }
+
+    std::string ResourceAllocator::getMemoryStatsJson() {
+        MemoryStats stats = getMemoryStats();
+        std::ostringstream json;
+        json << "{\n  \"heaps\": [";
+        for (size_t i = 0; i < stats.heapBudgets.size(); i++) {
+            const VmaBudget& budget = stats.heapBudgets[i];
+            json << (i == 0 ? "\n" : ",\n")
+                 << "    { \"index\": " << i
+                 << ", \"usage\": " << budget.usage
+                 << ", \"budget\": " << budget.budget
+                 << ", \"blockBytes\": " << budget.statistics.blockBytes
+                 << ", \"allocationBytes\": " << budget.statistics.allocationBytes
+                 << ", \"blockCount\": " << budget.statistics.blockCount
+                 << ", \"allocationCount\": " << budget.statistics.allocationCount << " }";
+        }
+        json << "\n  ],\n  \"total\": { \"blockBytes\": " << stats.totals.total.statistics.blockBytes
+             << ", \"allocationBytes\": " << stats.totals.total.statistics.allocationBytes
+             << ", \"blockCount\": " << stats.totals.total.statistics.blockCount
+             << ", \"allocationCount\": " << stats.totals.total.statistics.allocationCount
+             << ", \"unusedRangeCount\": " << stats.totals.total.unusedRangeCount << " },\n  \"categories\": {";
+        for (uint32_t i = 0; i < ALLOCATION_CATEGORY_COUNT; i++) {
+            json << (i == 0 ? "\n" : ",\n")
+                 << "    \"" << getAllocationCategoryName(static_cast<AllocationCategory>(i)) << "\": { \"allocationCount\": " << stats.categories[i].allocationCount
+                 << ", \"allocationBytes\": " << stats.categories[i].allocationBytes << " }";
+        }
+        json << "\n  },\n  \"frame\": { \"index\": " << frameCounter
+             << ", \"allocations\": " << stats.frameAllocations
+             << ", \"frees\": " << stats.frameFrees << " }\n}\n";
+        return json.str();
+    }
+
+    void ResourceAllocator::dumpMemoryStats(const std::string& filepath) {
+        std::ofstream stream(filepath);
+        if (!stream) {
+            std::cerr << "Error: File '" << filepath << "' could not be written." << std::endl;
+            return;
+        }
+        stream << getMemoryStatsJson();
+        std::cout << "Memory statistics written to '" << filepath << "'." << std::endl;
+    }
+
     void ResourceAllocator::createAllocator(const VkInstance& instance, const VkPhysicalDevice physicalDevice) {
         VmaAllocatorCreateInfo allocatorInfo{};
         allocatorInfo.vulkanApiVersion = ENGINE_GRAPHICS_API_VERSION;
@@ -45,77 +273,531 @@ namespace core {
         VK_CHECK_MSG(vmaCreateAllocator(&allocatorInfo, &allocator), "Failed to create memory allocator.");
     }
 
-    void ResourceAllocator::fetchQueue(const VkDevice& device, const uint32_t familyQueueIndex) {
-        vkGetDeviceQueue(device, familyQueueIndex, 0, &transferQueue);
+    VmaAllocationCreateInfo ResourceAllocator::getAllocationCreateInfo(const MemoryUsage& memoryUsage) {
+        VmaAllocationCreateInfo allocCreateInfo{};
+        switch (memoryUsage) {
+            case MEMORY_USAGE_GPU_ONLY:
+                allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+                allocCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+                break;
+            case MEMORY_USAGE_UPLOAD:
+                allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+                allocCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                break;
+            case MEMORY_USAGE_READBACK:
+                allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+                allocCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                break;
+            case MEMORY_USAGE_DYNAMIC:
+                allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+                allocCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+                break;
+        }
+        return allocCreateInfo;
     }
 
-    void ResourceAllocator::createCommandPool(const uint32_t familyQueueIndex) {
+    void ResourceAllocator::createTexturePool() {
+        // Find the memory type of a typical sampled texture.
+        VkImageCreateInfo imageInfo = getImage2DCreateInfo({ 512, 512 }, VK_FORMAT_R8G8B8A8_SRGB, 1, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+        VK_CHECK(vmaFindMemoryTypeIndexForImageInfo(allocator, &imageInfo, &allocInfo, &texturePoolMemoryType));
+
+        VmaPoolCreateInfo poolInfo{};
+        poolInfo.memoryTypeIndex = texturePoolMemoryType;
+        poolInfo.blockSize = TEXTURE_POOL_BLOCK_SIZE;
+        VK_CHECK_MSG(vmaCreatePool(allocator, &poolInfo, &texturePool), "Failed to create texture memory pool.");
+        vmaSetPoolName(allocator, texturePool, "Texture Pool");
+    }
+
+    VmaAllocationCreateInfo ResourceAllocator::getImageAllocationCreateInfo(const VkImageCreateInfo& imageInfo) {
+        // Query size and dedicated allocation preference without creating the image.
+        VkMemoryDedicatedRequirements dedicatedRequirements{};
+        dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+        VkMemoryRequirements2 requirements{};
+        requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+        requirements.pNext = &dedicatedRequirements;
+        VkDeviceImageMemoryRequirements requirementsInfo{};
+        requirementsInfo.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+        requirementsInfo.pCreateInfo = &imageInfo;
+        vkGetDeviceImageMemoryRequirements(device, &requirementsInfo, &requirements);
+        const VkMemoryRequirements& memoryRequirements = requirements.memoryRequirements;
+        const bool driverDedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+        if (imageInfo.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) {
+            // Transient attachments use lazily allocated memory where available (tile memory on mobile GPUs).
+            allocInfo.preferredFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        } else if (imageInfo.usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT)) {
+            // Large render targets get their own allocation, VMA also honors the driver's preference.
+            if (memoryRequirements.size >= DEDICATED_IMAGE_THRESHOLD) {
+                allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+            }
+        } else if (!driverDedicated && (memoryRequirements.memoryTypeBits & (1u << texturePoolMemoryType)) && memoryRequirements.size <= TEXTURE_POOL_BLOCK_SIZE / 2) {
+            // Sampled textures are suballocated from the shared texture pool.
+            allocInfo.pool = texturePool;
+        }
+        return allocInfo;
+    }
+
+    void ResourceAllocator::fetchQueues(const VkDevice& device) {
+        vkGetDeviceQueue(device, transferFamilyIndex, 0, &transferQueue);
+        vkGetDeviceQueue(device, graphicsFamilyIndex, 0, &graphicsQueue);
+    }
+
+    void ResourceAllocator::createCommandPools() {
         VkCommandPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
         poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        poolInfo.queueFamilyIndex = familyQueueIndex;
 
+        // Upload commands are recorded on the transfer family, ownership acquires on the graphics family.
+        poolInfo.queueFamilyIndex = transferFamilyIndex;
         VK_CHECK_MSG(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool), "Failed to create resource allocator command pool.");
+        poolInfo.queueFamilyIndex = graphicsFamilyIndex;
+        VK_CHECK_MSG(vkCreateCommandPool(device, &poolInfo, nullptr, &acquireCommandPool), "Failed to create resource allocator acquire command pool.");
+    }
+
+    void ResourceAllocator::createStagingBuffer() {
+        ALLOCATION_TAG("ResourceAllocator::createStagingBuffer");
+        VkBufferCreateInfo bufferCreateInfo{};
+        bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferCreateInfo.size = STAGING_BUFFER_SIZE;
+        bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VmaAllocationCreateInfo allocCreateInfo = getAllocationCreateInfo(MEMORY_USAGE_UPLOAD);
+
+        // Staging buffer stays mapped for the lifetime of the allocator.
+        VmaAllocationInfo allocInfo;
+        VK_CHECK_MSG(vmaCreateBuffer(allocator, &bufferCreateInfo, &allocCreateInfo, &stagingBuffer.buffer, &stagingBuffer.allocation, &allocInfo), "Failed to create staging buffer.");
+        trackAllocation(stagingBuffer.allocation, ALLOCATION_CATEGORY_STAGING, ALLOCATION_RESOURCE_BUFFER, bufferCreateInfo.usage);
+        stagingData = static_cast<uint8_t*>(allocInfo.pMappedData);
+    }
+
+    void ResourceAllocator::createUploadSemaphores() {
+        VkSemaphoreTypeCreateInfo timelineSemaphoreInfo{};
+        timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timelineSemaphoreInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        timelineSemaphoreInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &timelineSemaphoreInfo;
+
+        VK_CHECK_MSG(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uploadSemaphore), "Failed to create upload timeline semaphore.");
+        VK_CHECK_MSG(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &acquireSemaphore), "Failed to create acquire timeline semaphore.");
+        uploadSemaphoreValue = 0;
+        acquireSemaphoreValue = 0;
+    }
+
+    //***************************************************************************************//
+    //                                    Staging Uploads                                    //
+    //***************************************************************************************//
+
+    VkCommandBuffer ResourceAllocator::beginContext(std::vector<UploadContext>& contexts, const VkCommandPool& pool, const VkSemaphore& semaphore, int32_t& index) {
+        // Reuse a command buffer whose previous submission has completed.
+        uint64_t completedValue;
+        VK_CHECK(vkGetSemaphoreCounterValue(device, semaphore, &completedValue));
+        index = -1;
+        for (size_t i = 0; i < contexts.size(); i++) {
+            if (contexts[i].timelineValue <= completedValue) {
+                index = static_cast<int32_t>(i);
+                break;
+            }
+        }
+
+        // Otherwise allocate a new one.
+        if (index < 0) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandPool = pool;
+            allocInfo.commandBufferCount = 1;
+
+            UploadContext context{};
+            VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &context.commandBuffer));
+            contexts.push_back(context);
+            index = static_cast<int32_t>(contexts.size() - 1);
+        }
+
+        // Record command buffer.
+        VkCommandBuffer commandBuffer = contexts[index].commandBuffer;
+        VK_CHECK(vkResetCommandBuffer(commandBuffer, 0));
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+        return commandBuffer;
+    }
+
+    void ResourceAllocator::beginUploadBatch() {
+        DEBUG_ASSERT_MSG(activeUpload < 0, "Upload batch already open.");
+        beginContext(uploadContexts, commandPool, uploadSemaphore, activeUpload);
+    }
+
+    uint64_t ResourceAllocator::submitTransferCommands() {
+        UploadContext& context = uploadContexts[activeUpload];
+        VK_CHECK(vkEndCommandBuffer(context.commandBuffer));
+
+        const uint64_t signalValue = ++uploadSemaphoreValue;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &context.commandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &uploadSemaphore;
+        submitInfo.pNext = &timelineInfo;
+
+        VK_CHECK(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+        // Staging memory written by this submission is released once the signal value is reached.
+        context.timelineValue = signalValue;
+        if (stagingHead > stagingSubmitted) {
+            stagingSubmissions.push_back({ signalValue, stagingHead });
+            stagingSubmitted = stagingHead;
+        }
+        activeUpload = -1;
+        return signalValue;
+    }
+
+    UploadToken ResourceAllocator::submitUploadBatch() {
+        DEBUG_ASSERT_MSG(activeUpload >= 0, "No upload batch open.");
+        VkCommandBuffer commandBuffer = getUploadCommandBuffer();
+
+        if (transferFamilyIndex == graphicsFamilyIndex) {
+            // Single family: make all copies visible and move images to their final layouts in one barrier.
+            VkMemoryBarrier memoryBarrier{};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            pendingImageBarriers.insert(pendingImageBarriers.end(), pendingImageTransitions.begin(), pendingImageTransitions.end());
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr, static_cast<uint32_t>(pendingImageBarriers.size()), pendingImageBarriers.data());
+
+            pendingImageBarriers.clear();
+            pendingImageTransitions.clear();
+            lastUploadToken = { uploadSemaphore, submitTransferCommands() };
+            return lastUploadToken;
+        }
+
+        // Release ownership of every uploaded image to the graphics family.
+        // Buffers are shared concurrently, the semaphore wait below makes their copies visible.
+        for (auto& barrier : pendingImageBarriers) barrier.dstAccessMask = 0;
+        if (!pendingImageBarriers.empty()) {
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr,
+                static_cast<uint32_t>(pendingImageBarriers.size()), pendingImageBarriers.data());
+        }
+        const uint64_t transferValue = submitTransferCommands();
+
+        // Acquire ownership on the graphics queue once the transfer completed.
+        for (auto& barrier : pendingImageBarriers) {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        }
+        pendingImageBarriers.insert(pendingImageBarriers.end(), pendingImageTransitions.begin(), pendingImageTransitions.end());
+
+        int32_t acquireIndex;
+        VkCommandBuffer acquireCommandBuffer = beginContext(acquireContexts, acquireCommandPool, acquireSemaphore, acquireIndex);
+        if (!pendingImageBarriers.empty()) {
+            vkCmdPipelineBarrier(acquireCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr,
+                static_cast<uint32_t>(pendingImageBarriers.size()), pendingImageBarriers.data());
+        }
+        VK_CHECK(vkEndCommandBuffer(acquireCommandBuffer));
+
+        const uint64_t signalValue = ++acquireSemaphoreValue;
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &transferValue;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &uploadSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &acquireCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &acquireSemaphore;
+        submitInfo.pNext = &timelineInfo;
+
+        VK_CHECK(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+        acquireContexts[acquireIndex].timelineValue = signalValue;
+
+        pendingImageBarriers.clear();
+        pendingImageTransitions.clear();
+        lastUploadToken = { acquireSemaphore, signalValue };
+        return lastUploadToken;
+    }
+
+    void ResourceAllocator::waitForUploadBatch(const UploadToken& token) {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &token.semaphore;
+        waitInfo.pValues = &token.value;
+        VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+        retireStaging();
+    }
+
+    bool ResourceAllocator::isUploadBatchComplete(const UploadToken& token) {
+        uint64_t completedValue;
+        VK_CHECK(vkGetSemaphoreCounterValue(device, token.semaphore, &completedValue));
+        return completedValue >= token.value;
+    }
+
+    void ResourceAllocator::waitForTransfer(const uint64_t value) {
+        waitForUploadBatch({ uploadSemaphore, value });
+    }
+
+    VkCommandBuffer ResourceAllocator::getUploadCommandBuffer() {
+        DEBUG_ASSERT_MSG(activeUpload >= 0, "No upload batch open.");
+        return uploadContexts[activeUpload].commandBuffer;
+    }
+
+    void ResourceAllocator::uploadToBuffer(const Buffer& buffer, const VkDeviceSize& offset, const VkDeviceSize& size, const void* data) {
+        const bool ownsBatch = activeUpload < 0;
+        if (ownsBatch) beginUploadBatch();
+        // Upload targets are shared concurrently with the graphics family (see setSharingMode), no ownership transfer is needed.
+        // The transfer queue is not ordered against rendering, the range must not be read by a frame in flight.
+        stageBufferData(size, data, buffer, offset);
+
+        if (ownsBatch) waitForUploadBatch(submitUploadBatch());
+    }
+
+    void ResourceAllocator::uploadToImage2D(const Image& image, const VkExtent2D& extent, const VkFormat& format, const void* data, const VkImageLayout& finalLayout) {
+        const bool ownsBatch = activeUpload < 0;
+        if (ownsBatch) beginUploadBatch();
+        stageImageData(extent, format, data, image);
+
+        // Queue ownership transfer (or visibility) barrier, moving the image to its final layout.
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = finalLayout;
+        barrier.srcQueueFamilyIndex = (transferFamilyIndex == graphicsFamilyIndex) ? VK_QUEUE_FAMILY_IGNORED : transferFamilyIndex;
+        barrier.dstQueueFamilyIndex = (transferFamilyIndex == graphicsFamilyIndex) ? VK_QUEUE_FAMILY_IGNORED : graphicsFamilyIndex;
+        barrier.image = image.image;
+        barrier.subresourceRange = { getImageAspect(format), 0, 1, 0, 1 };
+        pendingImageBarriers.push_back(barrier);
+
+        if (ownsBatch) waitForUploadBatch(submitUploadBatch());
+    }
+
+    void ResourceAllocator::transitionImageLayout(const Image& image, const VkFormat& format, const VkImageLayout& oldLayout, const VkImageLayout& newLayout) {
+        const bool ownsBatch = activeUpload < 0;
+        if (ownsBatch) beginUploadBatch();
+
+        // Transitions are recorded on the graphics queue once the batch uploads are available.
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image.image;
+        barrier.subresourceRange = { getImageAspect(format), 0, 1, 0, 1 };
+        pendingImageTransitions.push_back(barrier);
+
+        if (ownsBatch) waitForUploadBatch(submitUploadBatch());
+    }
+
+    void ResourceAllocator::retireStaging() {
+        uint64_t completedValue;
+        VK_CHECK(vkGetSemaphoreCounterValue(device, uploadSemaphore, &completedValue));
+        while (!stagingSubmissions.empty() && stagingSubmissions.front().timelineValue <= completedValue) {
+            stagingTail = stagingSubmissions.front().stagingHead;
+            stagingSubmissions.pop_front();
+        }
+    }
+
+    VkDeviceSize ResourceAllocator::allocateStaging(const VkDeviceSize& size, const VkDeviceSize& alignment) {
+        DEBUG_ASSERT(size <= STAGING_BUFFER_SIZE / 2);
+        retireStaging();
+
+        while (true) {
+            // Align within the ring and skip to the start when the region would wrap.
+            VkDeviceSize ringStart = stagingHead - (stagingHead % STAGING_BUFFER_SIZE);
+            VkDeviceSize ringOffset = alignOffset(stagingHead % STAGING_BUFFER_SIZE, alignment);
+            if (ringOffset + size > STAGING_BUFFER_SIZE) {
+                ringStart += STAGING_BUFFER_SIZE;
+                ringOffset = 0;
+            }
+
+            if (ringStart + ringOffset + size - stagingTail <= STAGING_BUFFER_SIZE) {
+                stagingHead = ringStart + ringOffset + size;
+                return ringOffset;
+            }
+
+            // Ring is full: submit copies still holding staging memory, then wait for the oldest upload.
+            if (stagingHead > stagingSubmitted) {
+                submitTransferCommands();
+                beginUploadBatch();
+            }
+            // Every staged copy is submitted by now, without a submission holding the ring all of it is free.
+            if (stagingSubmissions.empty()) {
+                stagingTail = stagingHead;
+                continue;
+            }
+            waitForTransfer(stagingSubmissions.front().timelineValue);
+        }
+    }
+
+    void ResourceAllocator::stageBufferData(const VkDeviceSize& size, const void* data, const Buffer& dstBuffer, const VkDeviceSize& dstOffset) {
+        // Copy in chunks so uploads larger than the ring can stream through it.
+        const VkDeviceSize chunkSize = STAGING_BUFFER_SIZE / 2;
+        for (VkDeviceSize copied = 0; copied < size; copied += chunkSize) {
+            VkDeviceSize copySize = std::min(chunkSize, size - copied);
+            VkDeviceSize stagingOffset = allocateStaging(copySize, 16);
+            memcpy(stagingData + stagingOffset, static_cast<const uint8_t*>(data) + copied, copySize);
+            VK_CHECK(vmaFlushAllocation(allocator, stagingBuffer.allocation, stagingOffset, copySize));
+
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = stagingOffset;
+            copyRegion.dstOffset = dstOffset + copied;
+            copyRegion.size = copySize;
+            vkCmdCopyBuffer(getUploadCommandBuffer(), stagingBuffer.buffer, dstBuffer.buffer, 1, &copyRegion);
+        }
+    }
+
+    void ResourceAllocator::stageImageData(const VkExtent2D& extent, const VkFormat& format, const void* data, const Image& dstImage) {
+        // Transition image layout.
+        EngineContext::transitionImageLayout(getUploadCommandBuffer(), dstImage.image, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+        // Buffer offsets of image copies must be a multiple of both the texel size and 4.
+        const VkDeviceSize texelSize = getTexelSize(format);
+        const VkDeviceSize alignment = (texelSize % 4 == 0) ? texelSize : (texelSize % 2 == 0) ? texelSize * 2 : texelSize * 4;
+        const VkDeviceSize rowSize = extent.width * texelSize;
+        const uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, (STAGING_BUFFER_SIZE / 2) / rowSize));
+        DEBUG_ASSERT(rowSize <= STAGING_BUFFER_SIZE / 2);
+
+        // Copy data in chunks of rows from the staging ring to the destination image.
+        for (uint32_t row = 0; row < extent.height; row += rowsPerChunk) {
+            uint32_t rowCount = std::min(rowsPerChunk, extent.height - row);
+            VkDeviceSize copySize = rowSize * rowCount;
+            VkDeviceSize stagingOffset = allocateStaging(copySize, alignment);
+            memcpy(stagingData + stagingOffset, static_cast<const uint8_t*>(data) + rowSize * row, copySize);
+            VK_CHECK(vmaFlushAllocation(allocator, stagingBuffer.allocation, stagingOffset, copySize));
+
+            VkBufferImageCopy copyRegion{};
+            copyRegion.bufferOffset = stagingOffset;
+            copyRegion.bufferRowLength = 0;
+            copyRegion.bufferImageHeight = 0;
+            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegion.imageSubresource.mipLevel = 0; // TODO - copy region for each mip levels.
+            copyRegion.imageSubresource.baseArrayLayer = 0;
+            copyRegion.imageSubresource.layerCount = 1;
+            copyRegion.imageOffset = {0, static_cast<int32_t>(row), 0};
+            copyRegion.imageExtent = {extent.width, rowCount, 1};
+            vkCmdCopyBufferToImage(getUploadCommandBuffer(), stagingBuffer.buffer, dstImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+        }
     }
 
     //***************************************************************************************//
     //                                   Buffer Allocation                                   //
     //***************************************************************************************//
 
-    void ResourceAllocator::createBuffer(const VkDeviceSize& size, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage) {
+    void ResourceAllocator::setSharingMode(VkBufferCreateInfo& bufferInfo) {
+        // Concurrent sharing avoids queue family ownership transfers between uploads, builds and traces.
+        // Upload targets are shared too, so sub-range uploads never touch the ownership of the rest of the buffer.
+        const VkBufferUsageFlags sharedUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+        if ((bufferInfo.usage & sharedUsage) && sharedFamilyIndices.size() > 1) {
+            bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(sharedFamilyIndices.size());
+            bufferInfo.pQueueFamilyIndices = sharedFamilyIndices.data();
+        } else {
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            bufferInfo.queueFamilyIndexCount = 0;
+            bufferInfo.pQueueFamilyIndices = nullptr;
+        }
+    }
+
+    void ResourceAllocator::createBuffer(const VkDeviceSize& size, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage) {
         VkBufferCreateInfo bufferCreateInfo{};
 		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferCreateInfo.size = size;
 		bufferCreateInfo.usage = usage;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		setSharingMode(bufferCreateInfo);
         
-        VmaAllocationCreateInfo allocCreateInfo{};
-        allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        allocCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        VmaAllocationCreateInfo allocCreateInfo = getAllocationCreateInfo(memoryUsage);
 
         VmaAllocationInfo allocInfo;
         VK_CHECK(vmaCreateBuffer(allocator, &bufferCreateInfo, &allocCreateInfo, &buffer, &allocation, &allocInfo));
+        trackAllocation(allocation, getBufferCategory(usage, memoryUsage), ALLOCATION_RESOURCE_BUFFER, usage);
     }
 
-    void ResourceAllocator::createBuffer(const VkDeviceSize& size, Buffer& buffer, VkBufferUsageFlags usage) {
-        createBuffer(size, buffer.buffer, buffer.allocation, usage);
+    void ResourceAllocator::createBuffer(const VkDeviceSize& size, Buffer& buffer, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage) {
+        createBuffer(size, buffer.buffer, buffer.allocation, usage, memoryUsage);
+
+        // Cache persistently mapped pointer and device address.
+        VmaAllocationInfo allocInfo;
+        vmaGetAllocationInfo(allocator, buffer.allocation, &allocInfo);
+        buffer.mapped = allocInfo.pMappedData;
+        buffer.address = (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? getBufferDeviceAddress(buffer.buffer) : 0;
     }
 
-    void ResourceAllocator::createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage) {
+    void ResourceAllocator::createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, VkBuffer& buffer, VmaAllocation& allocation, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage) {
         VkBufferCreateInfo bufferCreateInfo{};
 		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 		bufferCreateInfo.size = size;
 		bufferCreateInfo.usage = usage;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		setSharingMode(bufferCreateInfo);
         
-        VmaAllocationCreateInfo allocCreateInfo{};
-        allocCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        allocCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        VmaAllocationCreateInfo allocCreateInfo = getAllocationCreateInfo(memoryUsage);
 
         VmaAllocationInfo allocInfo;
         VK_CHECK(vmaCreateBufferWithAlignment(allocator, &bufferCreateInfo, &allocCreateInfo, minAlignment, &buffer, &allocation, &allocInfo));
+        trackAllocation(allocation, getBufferCategory(usage, memoryUsage), ALLOCATION_RESOURCE_BUFFER, usage);
     }
 
-    void ResourceAllocator::createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, Buffer& buffer, VkBufferUsageFlags usage) {
-        createBufferWithAlignment(size, minAlignment, buffer.buffer, buffer.allocation, usage);
+    void ResourceAllocator::createBufferWithAlignment(const VkDeviceSize& size, const VkDeviceSize& minAlignment, Buffer& buffer, VkBufferUsageFlags usage, const MemoryUsage& memoryUsage) {
+        createBufferWithAlignment(size, minAlignment, buffer.buffer, buffer.allocation, usage, memoryUsage);
+
+        // Cache persistently mapped pointer and device address.
+        VmaAllocationInfo allocInfo;
+        vmaGetAllocationInfo(allocator, buffer.allocation, &allocInfo);
+        buffer.mapped = allocInfo.pMappedData;
+        buffer.address = (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? getBufferDeviceAddress(buffer.buffer) : 0;
     }
 
     void ResourceAllocator::mapDataToBuffer(const Buffer& buffer, const VkDeviceSize& size, const void* data, const uint32_t& offset) {
-        uint8_t* location;
-        vmaMapMemory(allocator, buffer.allocation, (void**)&location);
-        memcpy(location+offset, data, size);
-        vmaUnmapMemory(allocator, buffer.allocation);
+        if (buffer.mapped != nullptr) {
+            memcpy(static_cast<uint8_t*>(buffer.mapped) + offset, data, size);
+        } else {
+            uint8_t* location;
+            VK_CHECK(vmaMapMemory(allocator, buffer.allocation, (void**)&location));
+            memcpy(location+offset, data, size);
+            vmaUnmapMemory(allocator, buffer.allocation);
+        }
+        flushBuffer(buffer, offset, size);
+    }
+
+    void ResourceAllocator::flushBuffer(const Buffer& buffer, const VkDeviceSize& offset, const VkDeviceSize& size) {
+        // No-op for host-coherent memory.
+        VK_CHECK(vmaFlushAllocation(allocator, buffer.allocation, offset, size));
     }
 
     void ResourceAllocator::createAndStageBuffer(const VkCommandBuffer& commandBuffer, const VkDeviceSize& size, const void* data, Buffer& srcBuffer, Buffer& dstBuffer, VkBufferUsageFlags usage) {
         // Create source buffer.
-        createBuffer(size, srcBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        createBuffer(size, srcBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD);
         
         // Map data to source buffer.
         mapDataToBuffer(srcBuffer, size, data);
 
         // Create destination buffer.
-        createBuffer(size, dstBuffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage);
+        createBuffer(size, dstBuffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, MEMORY_USAGE_GPU_ONLY);
 
         // Copy data from source buffer to destination buffer.
         VkBufferCopy copyRegion{};
@@ -126,69 +808,11 @@ namespace core {
     }
 
     void ResourceAllocator::createAndStageBuffer(const VkDeviceSize& size, const void* data, Buffer& buffer, VkBufferUsageFlags usage) {
-        // Create new command buffer.
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = commandPool;
-        allocInfo.commandBufferCount = 1;
-
-        VkCommandBuffer commandBuffer;
-        VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer));
-
-        // Create memory transfer semaphore.
-        VkSemaphoreTypeCreateInfo timelineSemaphoreInfo{};
-        timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
-        timelineSemaphoreInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
-        timelineSemaphoreInfo.initialValue = 0;
-
-        VkSemaphoreCreateInfo semaphoreInfo{};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        semaphoreInfo.pNext = &timelineSemaphoreInfo;
-        
-        VkSemaphore memoryTransferComplete;
-        VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &memoryTransferComplete));
-
-        // Record command buffer.
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-
-        Buffer srcBuffer;
-        createAndStageBuffer(commandBuffer, size, data, srcBuffer, buffer, usage);
-
-        VK_CHECK(vkEndCommandBuffer(commandBuffer));
-
-        const uint64_t signalValue = 1;
-        VkTimelineSemaphoreSubmitInfo timelineInfo{};
-        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
-        timelineInfo.signalSemaphoreValueCount = 1;
-        timelineInfo.pSignalSemaphoreValues = &signalValue;
-
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &memoryTransferComplete;
-        submitInfo.pNext = &timelineInfo;
-
-        VK_CHECK(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
-
-        // Wait for memory transfer to complete.
-        const uint64_t waitValue = 1;
-        VkSemaphoreWaitInfo waitInfo{};
-        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
-        waitInfo.semaphoreCount = 1;
-        waitInfo.pSemaphores = &memoryTransferComplete;
-        waitInfo.pValues = &waitValue;
-        VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+        // Create destination buffer.
+        createBuffer(size, buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, MEMORY_USAGE_GPU_ONLY);
 
-        // Destroy staging buffer, command buffer, and semaphore.
-        destroyBuffer(srcBuffer);
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-        vkDestroySemaphore(device, memoryTransferComplete, nullptr);
+        // Copy data from the staging ring to destination buffer.
+        uploadToBuffer(buffer, 0, size, data);
     }
 
     VkDeviceAddress ResourceAllocator::getBufferDeviceAddress(const VkBuffer& buffer) {
@@ -200,11 +824,12 @@ namespace core {
     }
 
     VkDeviceAddress ResourceAllocator::getBufferDeviceAddress(const Buffer& buffer) {
-        return getBufferDeviceAddress(buffer.buffer);
+        return buffer.address;
     }
 
     void ResourceAllocator::destroyBuffer(const VkBuffer& buffer, const VmaAllocation& allocation) {
-        vmaDestroyBuffer(allocator, buffer, allocation);
+        if (buffer == VK_NULL_HANDLE) return;
+        deferDestroy([buffer, allocation]() { untrackAllocation(allocation, ALLOCATION_RESOURCE_BUFFER); vmaDestroyBuffer(allocator, buffer, allocation); });
     }
 
 	void ResourceAllocator::destroyBuffer(const Buffer& buffer) {
@@ -216,97 +841,66 @@ namespace core {
     //***************************************************************************************//
 
     void ResourceAllocator::createImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, Image& image, const VkImageUsageFlags& usage) {
-        VkImageCreateInfo imageInfo{};
-        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageInfo.format = format;
-        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageInfo.mipLevels = mipLevels;
-        imageInfo.arrayLayers = 1;
-        imageInfo.extent.width = extent.width;
-        imageInfo.extent.height = extent.height;
-        imageInfo.extent.depth = 1;
-        imageInfo.usage = usage;
-        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        
-        VmaAllocationCreateInfo imageAllocInfo{};
-        imageAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-        imageAllocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-
+        VkImageCreateInfo imageInfo = getImage2DCreateInfo(extent, format, mipLevels, usage);
+        VmaAllocationCreateInfo imageAllocInfo = getImageAllocationCreateInfo(imageInfo);
         VK_CHECK(vmaCreateImage(allocator, &imageInfo, &imageAllocInfo, &image.image, &image.allocation, nullptr));
+        trackAllocation(image.allocation, getImageCategory(usage), ALLOCATION_RESOURCE_IMAGE, usage);
     }
 
-    void ResourceAllocator::createAndStageImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const void* data, Image& image, VkImageUsageFlags usage) {
-        // Create new command buffer.
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = commandPool;
-        allocInfo.commandBufferCount = 1;
-
-        VkCommandBuffer commandBuffer;
-        VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer));
-
-        // Create memory transfer semaphore.
-        VkSemaphoreTypeCreateInfo timelineSemaphoreInfo{};
-        timelineSemaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
-        timelineSemaphoreInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
-        timelineSemaphoreInfo.initialValue = 0;
-
-        VkSemaphoreCreateInfo semaphoreInfo{};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        semaphoreInfo.pNext = &timelineSemaphoreInfo;
-        
-        VkSemaphore memoryTransferComplete;
-        VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &memoryTransferComplete));
-
-        // Record command buffer.
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-        VK_CHECK(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-        
-        Buffer srcBuffer;
-        createAndStageImage2D(commandBuffer, extent, format, mipLevels, data, srcBuffer, image, usage);
-
-        VK_CHECK(vkEndCommandBuffer(commandBuffer));
+    VkMemoryRequirements ResourceAllocator::getImage2DMemoryRequirements(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VkImageUsageFlags& usage) {
+        VkImageCreateInfo imageInfo = getImage2DCreateInfo(extent, format, mipLevels, usage);
+        VkDeviceImageMemoryRequirements requirementsInfo{};
+        requirementsInfo.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+        requirementsInfo.pCreateInfo = &imageInfo;
+        VkMemoryRequirements2 requirements{};
+        requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+        vkGetDeviceImageMemoryRequirements(device, &requirementsInfo, &requirements);
+        return requirements.memoryRequirements;
+    }
 
-        const uint64_t signalValue = 1;
-        VkTimelineSemaphoreSubmitInfo timelineInfo{};
-        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
-        timelineInfo.signalSemaphoreValueCount = 1;
-        timelineInfo.pSignalSemaphoreValues = &signalValue;
+    VmaAllocation ResourceAllocator::allocateAliasingMemory(const std::vector<VkMemoryRequirements>& requirements) {
+        // Memory must be large and aligned enough for every image, and of a type they all support.
+        VkMemoryRequirements combined{ 0, 1, ~0u };
+        for (const auto& requirement : requirements) {
+            combined.size = std::max(combined.size, requirement.size);
+            combined.alignment = std::max(combined.alignment, requirement.alignment);
+            combined.memoryTypeBits &= requirement.memoryTypeBits;
+        }
+        DEBUG_ASSERT_MSG(combined.memoryTypeBits != 0, "Aliased images have no memory type in common.");
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        VmaAllocation memory;
+        VK_CHECK(vmaAllocateMemory(allocator, &combined, &allocInfo, &memory, nullptr));
+        trackAllocation(memory, ALLOCATION_CATEGORY_RENDER_TARGET, ALLOCATION_RESOURCE_MEMORY, 0);
+        return memory;
+    }
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &memoryTransferComplete;
-        submitInfo.pNext = &timelineInfo;
+    void ResourceAllocator::createAliasedImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const VmaAllocation& memory, Image& image, const VkImageUsageFlags& usage) {
+        VkImageCreateInfo imageInfo = getImage2DCreateInfo(extent, format, mipLevels, usage);
+        VK_CHECK(vmaCreateAliasingImage(allocator, memory, &imageInfo, &image.image));
+        // The image does not own its memory, destroyImage() only destroys the handle.
+        image.allocation = VK_NULL_HANDLE;
+    }
 
-        VK_CHECK(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+    void ResourceAllocator::freeAliasingMemory(const VmaAllocation& memory) {
+        if (memory == VK_NULL_HANDLE) return;
+        // Queued after the destruction of the images bound to it, which go through the same queue.
+        deferDestroy([memory]() { untrackAllocation(memory, ALLOCATION_RESOURCE_MEMORY); vmaFreeMemory(allocator, memory); });
+    }
 
-        // Wait for memory transfer to complete.
-        const uint64_t waitValue = 1;
-        VkSemaphoreWaitInfo waitInfo{};
-        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
-        waitInfo.semaphoreCount = 1;
-        waitInfo.pSemaphores = &memoryTransferComplete;
-        waitInfo.pValues = &waitValue;
-        VK_CHECK(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+    void ResourceAllocator::createAndStageImage2D(const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const void* data, Image& image, VkImageUsageFlags usage) {
+        // Create destination image.
+        createImage2D(extent, format, mipLevels, image, VK_IMAGE_USAGE_TRANSFER_DST_BIT | usage);
 
-        // Destroy staging buffer, command buffer, and semaphore.
-        destroyBuffer(srcBuffer);
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-        vkDestroySemaphore(device, memoryTransferComplete, nullptr);
+        // Copy data from the staging ring to destination image, ready to be sampled.
+        uploadToImage2D(image, extent, format, data, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
     }
 
     void ResourceAllocator::createAndStageImage2D(const VkCommandBuffer& commandBuffer, const VkExtent2D& extent, const VkFormat& format, const uint32_t mipLevels, const void* data, Buffer& srcBuffer, Image& dstImage, VkImageUsageFlags usage) {
         // Create source buffer.
-        VkDeviceSize size = extent.width * extent.height * 4;
-        createBuffer(size, srcBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * getTexelSize(format);
+        createBuffer(size, srcBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD);
         
         // Map data to source buffer.
         mapDataToBuffer(srcBuffer, size, data);
@@ -373,7 +967,8 @@ namespace core {
     }
 
     void ResourceAllocator::destroyImage(const VkImage& image, const VmaAllocation& allocation) {
-        vmaDestroyImage(allocator, image, allocation);
+        if (image == VK_NULL_HANDLE) return;
+        deferDestroy([image, allocation]() { untrackAllocation(allocation, ALLOCATION_RESOURCE_IMAGE); vmaDestroyImage(allocator, image, allocation); });
     }
 
 	void ResourceAllocator::destroyImage(const Image& image) {
@@ -381,19 +976,36 @@ namespace core {
     }
 
     void ResourceAllocator::destroyImageView(const VkImageView& view) {
-        vkDestroyImageView(device, view, nullptr);
+        if (view == VK_NULL_HANDLE) return;
+        deferDestroy([view]() { vkDestroyImageView(device, view, nullptr); });
     }
 
     void ResourceAllocator::destroySampler(const VkSampler& sampler) {
-        vkDestroySampler(device, sampler, nullptr);
+        if (sampler == VK_NULL_HANDLE) return;
+        deferDestroy([sampler]() { vkDestroySampler(device, sampler, nullptr); });
+    }
+
+    VkDeviceSize ResourceAllocator::getTexelSize(const VkFormat& format) {
+        switch (format) {
+            case VK_FORMAT_R8_UNORM: case VK_FORMAT_R8_SRGB: return 1;
+            case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R8G8_SRGB: return 2;
+            case VK_FORMAT_R8G8B8_UNORM: case VK_FORMAT_R8G8B8_SRGB: return 3;
+            case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB: return 4;
+            case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_B8G8R8A8_SRGB: return 4;
+            case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32: return 4;
+            case VK_FORMAT_D32_SFLOAT: return 4;
+            case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+            case VK_FORMAT_R32G32B32A32_SFLOAT: return 16;
+            default: throw std::runtime_error("Unsupported texel format.");
+        }
     }
 
     //***************************************************************************************//
     //                          Acceleration Structure Allocation                            //
     //***************************************************************************************//
 
-    void ResourceAllocator::createAccelerationStructure(const VkDeviceSize& size, AccelerationStructure& accelStruct, const VkAccelerationStructureTypeKHR& type) {
-        createBuffer(size, accelStruct.buffer, accelStruct.allocation, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
+    void ResourceAllocator::createAccelerationStructure(const VkDeviceSize& size, AccelerationStructure& accelStruct, const VkAccelerationStructureTypeKHR& type, const MemoryUsage& memoryUsage) {
+        createBuffer(size, accelStruct.buffer, accelStruct.allocation, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, memoryUsage);
 		
         VkAccelerationStructureCreateInfoKHR createInfo{};
 		createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
@@ -402,12 +1014,19 @@ namespace core {
         createInfo.buffer = accelStruct.buffer;
 
 		VK_CHECK(vkCreateAccelerationStructureKHR(device, &createInfo, nullptr, &accelStruct.handle));
+
+        // Cache acceleration structure device address.
+        VkAccelerationStructureDeviceAddressInfoKHR addressInfo{};
+        addressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        addressInfo.accelerationStructure = accelStruct.handle;
+        accelStruct.address = vkGetAccelerationStructureDeviceAddressKHR(device, &addressInfo);
     }
 
 	void ResourceAllocator::destroyAccelerationStructure(const AccelerationStructure& accelStruct) {
         if (accelStruct.handle != VK_NULL_HANDLE) {
+            VkAccelerationStructureKHR handle = accelStruct.handle;
+            deferDestroy([handle]() { vkDestroyAccelerationStructureKHR(device, handle, nullptr); });
             destroyBuffer(accelStruct.buffer, accelStruct.allocation);
-            vkDestroyAccelerationStructureKHR(device, accelStruct.handle, nullptr);
         }
     }
-}
\ No newline at end of file
+}
@@ -4,6 +4,7 @@
 namespace core {
 
 	Mesh* ResourcePrimitives::createQuad(const float& edgeLength) {
+		ALLOCATION_TAG("ResourcePrimitives::createQuad");
         float half = (edgeLength / 2.0f);
         uint32_t vertexCount = 4;
         Vertex* vertices = new Vertex[vertexCount]{
@@ -24,6 +25,7 @@ namespace core {
 	}
 
 	Mesh* ResourcePrimitives::createPlane(const uint32_t& edgeCount, const float& edgeLength) {
+		ALLOCATION_TAG("ResourcePrimitives::createPlane");
         // Check that edgeCount is even and greater than 0.
         if (edgeCount%2 != 0 || edgeCount == 0) return nullptr;
 
@@ -67,6 +69,7 @@ namespace core {
 	}
 
 	Mesh* ResourcePrimitives::createCube(const float& edgeLength) {
+		ALLOCATION_TAG("ResourcePrimitives::createCube");
         float half = (edgeLength / 2.0f);
         uint32_t vertexCount = 24;
         Vertex* vertices = new Vertex[vertexCount]{
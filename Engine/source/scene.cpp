@@ -1,57 +1,152 @@
 #include <scene.h>
 #include <engine_context.h>
 #include <engine_globals.h>
+#include <defragmenter.h>
+#include <host_acceleration_builder.h>
+#include <acceleration_structure_cache.h>
+#include <async_compute.h>
 #include <iostream>
 #include <algorithm>
+#include <tuple>
+#include <future>
+#include <thread>
+#include <cstring>
+
+#if defined(ENGINE_SSE2)
+	#include <xmmintrin.h>
+#endif
 
 namespace core {
 
-	Scene::Scene() {}
+	// Number of materials packed into each material pool buffer.
+	const uint32_t MATERIALS_PER_BLOCK = 1024;
+	// Static objects whose meshes have at most this many triangles are merged into static batches.
+	const uint32_t STATIC_BATCH_MAX_MESH_TRIANGLES = 4096;
+	// Geometries per merged BLAS, also bounded by the device's maxGeometryCount.
+	const uint32_t STATIC_BATCH_MAX_GEOMETRIES = 256;
+	// Objects are grouped by the grid cell of their position, keeping merged BLASes spatially compact.
+	// Cells are centered on the origin, objects placed around it would otherwise land in eight different cells.
+	const float STATIC_BATCH_CELL_SIZE = 32.0f;
+
+	std::vector<Scene*> Scene::scenes;
+
+	Scene::Scene() : materialPool(Material::getDataSize(), MATERIALS_PER_BLOCK, 16, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MEMORY_USAGE_GPU_ONLY) {
+		scenes.push_back(this);
+	}
 
 	Scene::~Scene() {
 		cleanup();
+		scenes.erase(std::remove(scenes.begin(), scenes.end(), this), scenes.end());
 	}
 
 	void Scene::setup() {
-		buildAccelerationStructure(objects, meshes);
+		// Upload object descriptions while the acceleration structures are being built.
+		ResourceAllocator::beginUploadBatch();
+		createStaticBatches(objects);
 		createObjectDescriptions(objects);
+		UploadToken upload = ResourceAllocator::submitUploadBatch();
+		buildAccelerationStructure(objects, meshes);
+		ResourceAllocator::waitForUploadBatch(upload);
+
+		relocationListener = Defragmenter::addListener([this](const RelocationFlags& flags) { onResourcesRelocated(flags); }, RELOCATION_LISTENER_PRIORITY_RESOURCES);
 	}
 
 	void Scene::cleanup() {
-		// Delete all scene materials.
-		for (auto& material : materials) delete material;
+		Defragmenter::removeListener(relocationListener);
+		// Destroy all scene objects, materials and cameras.
+		objects.clear();
 		materials.clear();
-		// Delete all scene cameras.
-		for (auto& camera : cameras) delete camera;
+		materialPool.cleanup();
 		cameras.clear();
+		mainCamera = {};
 
+		destroyStaticBatches();
 		ResourceAllocator::destroyAccelerationStructure(tlas);
+		ResourceAllocator::destroyBuffer(instanceBuffer);
+		ResourceAllocator::destroyBuffer(tlasScratchBuffer);
+		ResourceAllocator::destroyBuffer(instanceUploadBuffer);
+		ResourceAllocator::destroyBuffer(blasScratchBuffer);
 		ResourceAllocator::destroyBuffer(objDescBuffer);
+		pendingCacheMeshes.clear();
+		for (auto& compaction : pendingCompactions) {
+			AsyncCompute::wait(compaction.token);
+			vkDestroyQueryPool(EngineContext::getDevice(), compaction.queryPool, nullptr);
+		}
+		pendingCompactions.clear();
+		tlas = {};
+		instanceBuffer = {};
+		tlasScratchBuffer = {};
+		instanceUploadBuffer = {};
+		instanceUploadCapacity = 0;
+		blasScratchBuffer = {};
+		blasScratchSize = 0;
+		objDescBuffer = {};
 	}
 
 	void Scene::update() {
 		// Update all cameras.
 		for (auto& camera : cameras) {
-			camera->update();
+			camera.update();
+		}
+
+		// Objects were added after setup, rebuild instead of refitting.
+		if (topologyChanged && tlas.handle != VK_NULL_HANDLE) {
+			rebuildAccelerationStructure(objects, meshes);
+		}
+
+		// Compact BLAS whose build completed, the TLAS must then reference the compacted copies.
+		if (compactPendingBLAS()) {
+			buildTLAS(objects);
+			if (!pendingCacheMeshes.empty()) pendingCacheToken = AsyncCompute::getLastToken();
+		}
+
+		// Store streamed BLASes once built and compacted, serializing them earlier would wait on the builds.
+		if (!pendingCacheMeshes.empty() && pendingCompactions.empty() && AsyncCompute::isComplete(pendingCacheToken)) {
+			AccelerationStructureCache::store(pendingCacheMeshes);
+			pendingCacheMeshes.clear();
 		}
 	}
 
-	Camera* Scene::addCamera(glm::mat4 transform, const float& fov, const float& aspectRatio, const float& n, const float& f) {
-		Camera* cam = new Camera(transform, fov, aspectRatio, n, f);
-		cameras.push_back(cam);
-		if (cameras.size() == 1) this->mainCamera = cameras[0];
-		return cameras[cameras.size()-1];
+	Handle<Camera> Scene::addCamera(glm::mat4 transform, const float& fov, const float& aspectRatio, const float& n, const float& f) {
+		Handle<Camera> camera = cameras.create(transform, fov, aspectRatio, n, f);
+		if (cameras.size() == 1) this->mainCamera = camera;
+		return camera;
 	}
 
-	Object* Scene::addObject(Mesh* mesh, std::vector<Material*> mats, glm::mat4 transform, uint32_t shader) {
-		Object obj = {mesh, mats, transform, shader};
-		objects.push_back(obj);
+	Handle<Object> Scene::addObject(Mesh* mesh, std::vector<Handle<Material>> mats, glm::mat4 transform, uint32_t shader, const bool isStatic) {
 		meshes.insert(mesh);
-		return &objects[objects.size()-1];
+		topologyChanged = true;
+		queryBVHChanged = true;
+		return objects.create(Object{mesh, mats, transform, shader, 0, isStatic});
 	}
 	
+	void Scene::removeObject(const Handle<Object>& object) {
+		if (!objects.isAlive(object)) return;
+		objects.destroy(object);
+		topologyChanged = true;
+		queryBVHChanged = true;
+	}
+
+	void Scene::removeMaterial(const Handle<Material>& material) {
+		if (!materials.isAlive(material)) return;
+		DEBUG_ASSERT_MSG(std::none_of(objects.begin(), objects.end(), [&material](const Object& obj) {
+			return std::find(obj.materials.begin(), obj.materials.end(), material) != obj.materials.end();
+		}), "Removed material is still used by an object.");
+		// The material's destructor returns its region to the material pool.
+		materials.destroy(material);
+	}
+
+	void Scene::removeCamera(const Handle<Camera>& camera) {
+		if (!cameras.isAlive(camera)) return;
+		cameras.destroy(camera);
+		if (mainCamera == camera) {
+			mainCamera = cameras.empty() ? Handle<Camera>() : cameras.getHandle(0);
+		}
+	}
+
 	uint16_t nextTextureIndex = 0;
-	Material* Scene::addMaterial(Texture* albedoMap, glm::vec3 albedo, Texture* metallicMap, float metallic, float smoothness, Texture* normalMap, glm::vec2 tilling, glm::vec2 offset) {
+	Handle<Material> Scene::addMaterial(Texture* albedoMap, glm::vec3 albedo, Texture* metallicMap, float metallic, float smoothness, Texture* normalMap, glm::vec2 tilling, glm::vec2 offset) {
+		ALLOCATION_TAG("Scene::addMaterial");
 		// Lambda expresion to find texture index.
 		auto findTextureIndex = [](Texture* pTexture, std::map<Texture*, uint16_t>& textureIndices, std::vector<Texture*>& textures) {
 			uint32_t textureIndex = 0xFFFF;
@@ -63,7 +158,6 @@ namespace core {
 					textureIndex = nextTextureIndex++;
 					textureIndices.emplace(pTexture, textureIndex);
 					textures.push_back(pTexture);
-					EngineContext::transitionImageLayout(pTexture->getImage().image, pTexture->getFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 				}
 			}
 			return textureIndex;
@@ -75,32 +169,57 @@ namespace core {
 		uint16_t normalMapIndex = findTextureIndex(normalMap, textureIndices, textures);
 		
 		// Create and setup material.
-		Material* material = new Material(albedoMap, albedo, metallicMap, metallic, smoothness, normalMap, tilling, offset);
-		material->setup(albedoMapIndex, metallicMapIndex, normalMapIndex);
-		materials.push_back(material);
+		Handle<Material> material = materials.create(albedoMap, albedo, metallicMap, metallic, smoothness, normalMap, tilling, offset);
+		materials.at(material).setup(&materialPool, albedoMapIndex, metallicMapIndex, normalMapIndex);
 		return material;
 	}
 
-	void Scene::setMainCamera(Camera* camera) {
+	void Scene::setMainCamera(const Handle<Camera>& camera) {
 		// Check if camera is part of the scene before setting as main camera.
-		if (std::find(cameras.begin(), cameras.end(), camera) != cameras.end()) {
+		if (cameras.isAlive(camera)) {
 			this->mainCamera = camera; 
 		}
 	}
 
-	void Scene::createObjectDescriptions(std::vector<Object>& objects) {
-		for (auto obj : objects) {
+	void Scene::createObjectDescriptions(ResourcePool<Object>& objects) {
+		ALLOCATION_TAG("Scene::createObjectDescriptions");
+		fetchObjectDescriptions(objects);
+		// Keeps the buffer valid once every object was removed.
+		if (objDescriptions.empty()) objDescriptions.emplace_back();
+		VkDeviceSize size = sizeof(ObjDesc) * static_cast<uint64_t>(objDescriptions.size());
+		ResourceAllocator::createAndStageBuffer(size, objDescriptions.data(), objDescBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	}
+
+	void Scene::fetchObjectDescriptions(ResourcePool<Object>& objects) {
+		// Instanced objects first, in the order buildTLAS assigns their instance custom indices.
+		objDescriptions.clear();
+		for (auto& obj : objects) {
+			if (obj.batched) continue;
 			for (uint32_t k = 0; k < obj.mesh->getSubmeshCount() && k < obj.materials.size(); k++) {
 				VkDeviceAddress vertexAddress = obj.mesh->getVertexBuffer().getDeviceAddress();
-				VkDeviceAddress indexAddress = obj.mesh->getSubmesh(k).getIndexBuffer().getDeviceAddress();
-				VkDeviceAddress materialAddress = obj.materials.at(k)->getBuffer().getDeviceAddress();
-				ObjDesc desc = {vertexAddress, indexAddress, materialAddress};
+				VkDeviceAddress indexAddress = obj.mesh->getSubmesh(k).getIndexRegion().address;
+				VkDeviceAddress materialAddress = materials.at(obj.materials.at(k)).getRegion().address;
+				ObjDesc desc = {vertexAddress, indexAddress, materialAddress, 0};
 				objDescriptions.push_back(desc);
 			}
 		}
 
-		VkDeviceSize size = sizeof(ObjDesc) * static_cast<uint64_t>(objDescriptions.size());
-		ResourceAllocator::createAndStageBuffer(size, objDescriptions.data(), objDescBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		// Then every static batch's geometries, in BLAS geometry order.
+		for (auto& batch : staticBatches) {
+			batch.firstDescription = static_cast<uint32_t>(objDescriptions.size());
+			VkDeviceAddress transformAddress = batch.transformBuffer.getDeviceAddress();
+			for (const auto& handle : batch.objects) {
+				Object& obj = objects.at(handle);
+				for (uint32_t k = 0; k < obj.mesh->getSubmeshCount() && k < obj.materials.size(); k++) {
+					VkDeviceAddress vertexAddress = obj.mesh->getVertexBuffer().getDeviceAddress();
+					VkDeviceAddress indexAddress = obj.mesh->getSubmesh(k).getIndexRegion().address;
+					VkDeviceAddress materialAddress = materials.at(obj.materials.at(k)).getRegion().address;
+					ObjDesc desc = {vertexAddress, indexAddress, materialAddress, transformAddress};
+					objDescriptions.push_back(desc);
+					transformAddress += sizeof(VkTransformMatrixKHR);
+				}
+			}
+		}
 	}
 
     //***************************************************************************************//
@@ -108,65 +227,242 @@ namespace core {
     //***************************************************************************************//
 
 	struct BottomLevelAccelerationStructureCreateInfo {
-		VkAccelerationStructureGeometryKHR geometry;
-		VkAccelerationStructureBuildRangeInfoKHR offset;
+		std::vector<VkAccelerationStructureGeometryKHR> geometries; // One per submesh, merged static batches hold several.
+		std::vector<VkAccelerationStructureBuildRangeInfoKHR> offsets;
 		AccelerationStructure* pBLAS;
+		VkBuildAccelerationStructureFlagsKHR flags;
+		const void* hostVertices; // Host copies of the geometry for host builds, nullptr when not kept.
+		const void* hostIndices;
 	};
 
+	BottomLevelAccelerationStructureCreateInfo fetchBottomLevelAccelerationStructureCreateInfo(Mesh* mesh, uint32_t submeshIndex) {
+		// Fetch vertex and index buffer addresses
+		VkDeviceAddress vertexAddress = mesh->getVertexBuffer().getDeviceAddress();
+		VkDeviceAddress indexAddress = mesh->getSubmesh(submeshIndex).getIndexRegion().address;
+		uint32_t maxPrimitiveCount = mesh->getSubmesh(submeshIndex).getIndexCount()/3;
+		
+		// Create acceleration gtructure geometry triangles data
+		VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
+		triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+		triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+		triangles.vertexData.deviceAddress = vertexAddress;
+		triangles.vertexStride = sizeof(Vertex);
+		triangles.indexType = VK_INDEX_TYPE_UINT32;
+		triangles.indexData.deviceAddress = indexAddress;
+		triangles.maxVertex = mesh->getVertexCount();
+
+		// Create acceleration structure geometry
+		VkAccelerationStructureGeometryKHR geometry{};
+		geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+		geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
+		geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
+		geometry.geometry.triangles = triangles;
+
+		// Create acceleration structure build range info
+		VkAccelerationStructureBuildRangeInfoKHR offset{};
+		offset.primitiveCount = maxPrimitiveCount;
+		offset.primitiveOffset = 0;
+		offset.firstVertex = 0;
+		offset.transformOffset = 0;
+
+		// Static BLAS are compacted, deformable ones are refitted every frame.
+		VkBuildAccelerationStructureFlagsKHR flags = mesh->isDeformable() ?
+			VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR :
+			VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+
+		// Host geometry for host builds.
+		const void* hostVertices = mesh->hasHostGeometry() ? mesh->getVertices().data() : nullptr;
+		const void* hostIndices = mesh->hasHostGeometry() ? mesh->getSubmesh(submeshIndex).getIndices().data() : nullptr;
+
+		return BottomLevelAccelerationStructureCreateInfo{{geometry}, {offset}, &mesh->getSubmesh(submeshIndex).getBLAS(), flags, hostVertices, hostIndices};
+	}
+
 	std::vector<BottomLevelAccelerationStructureCreateInfo> fetchAllBottomLevelAccelerationStructureCreateInfo(std::unordered_set<Mesh*>& meshes) {
 		std::vector<BottomLevelAccelerationStructureCreateInfo> createInfos;
 		createInfos.reserve(meshes.size());
 
 		for (auto mesh : meshes) {
-			// Fetch vertex buffer address
-			VkDeviceAddress vertexAddress = mesh->getVertexBuffer().getDeviceAddress();
-
 			for (uint32_t submeshIndex = 0; submeshIndex < mesh->getSubmeshCount(); submeshIndex++) {
-				// Fetch index buffer address
-				VkDeviceAddress indexAddress = mesh->getSubmesh(submeshIndex).getIndexBuffer().getDeviceAddress();
-				uint32_t maxPrimitiveCount = mesh->getSubmesh(submeshIndex).getIndexCount()/3;
-				
-				// Create acceleration gtructure geometry triangles data
-				VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
-				triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-				triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-				triangles.vertexData.deviceAddress = vertexAddress;
-				triangles.vertexStride = sizeof(Vertex);
-				triangles.indexType = VK_INDEX_TYPE_UINT32;
-				triangles.indexData.deviceAddress = indexAddress;
-				triangles.maxVertex = mesh->getVertexCount();
-
-				// Create acceleration structure geometry
-				VkAccelerationStructureGeometryKHR geometry{};
-				geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-				geometry.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
-				geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
-				geometry.geometry.triangles = triangles;
-
-				// Create acceleration structure build range info
-				VkAccelerationStructureBuildRangeInfoKHR offset{};
-				offset.primitiveCount = maxPrimitiveCount;
-				offset.primitiveOffset = 0;
-				offset.firstVertex = 0;
-				offset.transformOffset = 0;
-
 				// Add new BottomLevelAccelerationStructureCreateInfo to list
-				createInfos.emplace_back(BottomLevelAccelerationStructureCreateInfo{geometry, offset, &mesh->getSubmesh(submeshIndex).getBLAS()});
+				createInfos.emplace_back(fetchBottomLevelAccelerationStructureCreateInfo(mesh, submeshIndex));
 			}
 		}
 
 		return createInfos;
 	}
 
-	void buildBLAS(std::vector<BottomLevelAccelerationStructureCreateInfo>& input) {
+	// Builds the BLAS on the CPU through deferred host operations, then moves them into device-local memory.
+	// Host-built BLAS are only valid for host commands, they reach the device in their serialized form.
+	// Returns the BLAS whose serialized form the device rejected, these must be built on the device.
+	std::vector<BottomLevelAccelerationStructureCreateInfo> buildBLASOnHost(std::vector<BottomLevelAccelerationStructureCreateInfo>& input) {
+		ALLOCATION_TAG("Scene::buildBLASOnHost");
+		VkDevice device = EngineContext::getDevice();
+		uint32_t blasCount = static_cast<uint32_t>(input.size());
+		std::vector<BottomLevelAccelerationStructureCreateInfo> rejected;
+
+		// Geometry is read from the meshes' host copies.
+		std::vector<VkAccelerationStructureGeometryKHR> geometries(blasCount);
+		std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(blasCount);
+		std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos(blasCount);
+		std::vector<VkAccelerationStructureBuildSizesInfoKHR> sizeInfos(blasCount);
+		for (uint32_t i = 0; i < blasCount; i++) {
+			geometries[i] = input[i].geometries[0];
+			geometries[i].geometry.triangles.vertexData.hostAddress = input[i].hostVertices;
+			geometries[i].geometry.triangles.indexData.hostAddress = input[i].hostIndices;
+
+			buildInfos[i].sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+			buildInfos[i].type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+			buildInfos[i].mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+			buildInfos[i].flags = input[i].flags;
+			buildInfos[i].geometryCount = 1;
+			buildInfos[i].pGeometries = &geometries[i];
+			rangeInfos[i] = input[i].offsets.data();
+
+			sizeInfos[i].sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+			vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR, &buildInfos[i], &input[i].offsets[0].primitiveCount, &sizeInfos[i]);
+		}
+
+		// Batch builds to bound the host-visible memory holding uncompacted BLAS.
+		std::vector<uint32_t> indices;
+		VkDeviceSize batchSize = 0;
+		VkDeviceSize batchLimit = 256'000'000; // 256 MB
+		for (uint32_t i = 0; i < blasCount; i++) {
+			indices.push_back(i);
+			batchSize += sizeInfos[i].accelerationStructureSize + sizeInfos[i].buildScratchSize;
+			if (batchSize < batchLimit && i != blasCount - 1) continue;
+
+			// Host-built BLAS live in host-visible memory, every build gets its own range of the scratch memory.
+			uint32_t batchCount = static_cast<uint32_t>(indices.size());
+			std::vector<AccelerationStructure> hostBLAS(batchCount);
+			std::vector<VkDeviceSize> scratchOffsets(batchCount);
+			VkDeviceSize scratchSize = 0;
+			for (uint32_t j = 0; j < batchCount; j++) {
+				scratchOffsets[j] = scratchSize;
+				scratchSize += (sizeInfos[indices[j]].buildScratchSize + 255) & ~VkDeviceSize(255);
+			}
+			std::vector<uint8_t> scratch(scratchSize);
+
+			std::vector<VkAccelerationStructureBuildGeometryInfoKHR> batchInfos(batchCount);
+			std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> batchRanges(batchCount);
+			for (uint32_t j = 0; j < batchCount; j++) {
+				uint32_t idx = indices[j];
+				ResourceAllocator::createAccelerationStructure(sizeInfos[idx].accelerationStructureSize, hostBLAS[j], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, MEMORY_USAGE_UPLOAD);
+				batchInfos[j] = buildInfos[idx];
+				batchInfos[j].dstAccelerationStructure = hostBLAS[j].handle;
+				batchInfos[j].scratchData.hostAddress = scratch.data() + scratchOffsets[j];
+				batchRanges[j] = rangeInfos[idx];
+			}
+
+			// Worker threads join the build, the calling thread helps until it completed.
+			HostBuild* build = HostAccelerationBuilder::build(batchCount, batchInfos.data(), batchRanges.data());
+			HostAccelerationBuilder::wait(build);
+
+			// Compact on the host, the compacted sizes are readable right after the build.
+			for (uint32_t j = 0; j < batchCount; j++) {
+				if (!(input[indices[j]].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR)) continue;
+				VkDeviceSize compactSize;
+				VK_CHECK(vkWriteAccelerationStructuresPropertiesKHR(device, 1, &hostBLAS[j].handle, VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, sizeof(VkDeviceSize), &compactSize, sizeof(VkDeviceSize)));
+
+				AccelerationStructure compacted;
+				ResourceAllocator::createAccelerationStructure(compactSize, compacted, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, MEMORY_USAGE_UPLOAD);
+				VkCopyAccelerationStructureInfoKHR copyInfo{};
+				copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+				copyInfo.src = hostBLAS[j].handle;
+				copyInfo.dst = compacted.handle;
+				copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+				VK_CHECK(vkCopyAccelerationStructureKHR(device, VK_NULL_HANDLE, &copyInfo));
+
+				ResourceAllocator::destroyAccelerationStructure(hostBLAS[j]);
+				hostBLAS[j] = compacted;
+			}
+
+			// Serialize every BLAS into one upload buffer at aligned offsets.
+			std::vector<VkAccelerationStructureKHR> handles(batchCount);
+			for (uint32_t j = 0; j < batchCount; j++) handles[j] = hostBLAS[j].handle;
+			std::vector<VkDeviceSize> serializedSizes(batchCount);
+			VK_CHECK(vkWriteAccelerationStructuresPropertiesKHR(device, batchCount, handles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, batchCount * sizeof(VkDeviceSize), serializedSizes.data(), sizeof(VkDeviceSize)));
+
+			std::vector<VkDeviceSize> offsets(batchCount);
+			VkDeviceSize stagingSize = 0;
+			for (uint32_t j = 0; j < batchCount; j++) {
+				offsets[j] = stagingSize;
+				stagingSize += (serializedSizes[j] + 255) & ~VkDeviceSize(255);
+			}
+			Buffer stagingBuffer;
+			ResourceAllocator::createBufferWithAlignment(stagingSize, 256, stagingBuffer, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MEMORY_USAGE_UPLOAD);
+			for (uint32_t j = 0; j < batchCount; j++) {
+				VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+				copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+				copyInfo.src = hostBLAS[j].handle;
+				copyInfo.dst.hostAddress = (uint8_t*)stagingBuffer.mapped + offsets[j];
+				copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+				VK_CHECK(vkCopyAccelerationStructureToMemoryKHR(device, VK_NULL_HANDLE, &copyInfo));
+			}
+			ResourceAllocator::flushBuffer(stagingBuffer);
+
+			// Deserialize each BLAS into device-local memory. Serialized data the device can't read is built on the device instead.
+			std::vector<VkDeviceSize> deserializedSizes(batchCount, 0);
+			VkCommandBuffer cmdBuffer = AsyncCompute::begin();
+			for (uint32_t j = 0; j < batchCount; j++) {
+				BottomLevelAccelerationStructureCreateInfo& info = input[indices[j]];
+				SerializedAccelerationStructureHeader serialized;
+				memcpy(&serialized, (const uint8_t*)stagingBuffer.mapped + offsets[j], sizeof(SerializedAccelerationStructureHeader));
+
+				VkAccelerationStructureVersionInfoKHR versionInfo{};
+				versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+				versionInfo.pVersionData = serialized.driverUUID;
+				VkAccelerationStructureCompatibilityKHR compatibility;
+				vkGetDeviceAccelerationStructureCompatibilityKHR(device, &versionInfo, &compatibility);
+				if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+					rejected.push_back(info);
+					continue;
+				}
+
+				deserializedSizes[j] = serialized.deserializedSize;
+				ResourceAllocator::createAccelerationStructure(serialized.deserializedSize, *info.pBLAS, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+
+				VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+				copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+				copyInfo.src.deviceAddress = stagingBuffer.getDeviceAddress() + offsets[j];
+				copyInfo.dst = info.pBLAS->handle;
+				copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+				vkCmdCopyMemoryToAccelerationStructureKHR(cmdBuffer, &copyInfo);
+			}
+
+			// The deserialized BLAS are read by later builds and copies.
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			ComputeToken token = AsyncCompute::submit();
+
+			// The host BLAS are not read by the device, only the serialized data must outlive the submission.
+			AsyncCompute::releaseAfter(token, [stagingBuffer]() { ResourceAllocator::destroyBuffer(stagingBuffer); });
+			for (uint32_t j = 0; j < batchCount; j++) {
+				ResourceAllocator::destroyAccelerationStructure(hostBLAS[j]);
+				if (deserializedSizes[j] != 0 && !(input[indices[j]].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+					Defragmenter::registerAccelerationStructure(*input[indices[j]].pBLAS, deserializedSizes[j], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+				}
+			}
+
+			// Reset
+			batchSize = 0;
+			indices.clear();
+		}
+		return rejected;
+	}
+
+	// BLAS requesting compaction are handed to compactions, they are compacted once their batch completed.
+	void buildBLASOnDevice(std::vector<BottomLevelAccelerationStructureCreateInfo>& input, std::vector<PendingCompaction>& compactions) {
+		ALLOCATION_TAG("Scene::buildBLASOnDevice");
 		uint32_t blasCount = static_cast<uint32_t>(input.size());
-		uint32_t campactionCount = 0; // Number of BLAS requesting compaction.
 		VkDeviceSize totalSize = 0; // Memory size of all allocated BLAS.
-		VkDeviceSize maxScratchSize = 0; // Largest scratch size.
 		
 		struct AccelerationStructureBuildGeometryInfo {
 			VkAccelerationStructureBuildGeometryInfoKHR buildInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR};
 			const VkAccelerationStructureBuildRangeInfoKHR* rangeInfo;
+			std::vector<uint32_t> primitiveCounts; // Maximum primitive count of every geometry.
 			VkAccelerationStructureBuildSizesInfoKHR sizeInfo{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR};
 		};
 
@@ -176,134 +472,191 @@ namespace core {
 			buildAS[i].buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
 			buildAS[i].buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
 			buildAS[i].buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-			buildAS[i].buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR; // Optional: add VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR for all BLAS that require compaction.
-			buildAS[i].buildInfo.geometryCount = 1;
-			buildAS[i].buildInfo.pGeometries = &(input[i].geometry);
+			buildAS[i].buildInfo.flags = input[i].flags;
+			buildAS[i].buildInfo.geometryCount = static_cast<uint32_t>(input[i].geometries.size());
+			buildAS[i].buildInfo.pGeometries = input[i].geometries.data();
 			// Fill Acceleration Structure Geometry Range Info.
-			buildAS[i].rangeInfo = &input[i].offset;
+			buildAS[i].rangeInfo = input[i].offsets.data();
+			for (const auto& offset : input[i].offsets) {
+				buildAS[i].primitiveCounts.push_back(offset.primitiveCount);
+			}
 
 			// Find sizes for accelerated structure and scratch buffer.
-			vkGetAccelerationStructureBuildSizesKHR(EngineContext::getDevice(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildAS[i].buildInfo, &buildAS[i].rangeInfo[0].primitiveCount, &buildAS[i].sizeInfo);
+			vkGetAccelerationStructureBuildSizesKHR(EngineContext::getDevice(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildAS[i].buildInfo, buildAS[i].primitiveCounts.data(), &buildAS[i].sizeInfo);
 		
 			totalSize += buildAS[i].sizeInfo.accelerationStructureSize;
-			maxScratchSize = std::max(maxScratchSize, buildAS[i].sizeInfo.buildScratchSize);
 		}
 
-		// Allocate scratch buffers holding the temporary data of the acceleration structure builder.
+		// Split BLAS into batches to allow staying in restricted amount of memory.
+		// Every BLAS of a batch gets its own aligned range of the scratch arena so the batch builds without dependencies.
+		VkDeviceSize scratchAlignment = EngineContext::getPhysicalDeviceProperties().accelStructProperties.minAccelerationStructureScratchOffsetAlignment;
+		std::vector<std::vector<uint32_t>> batches;
+		std::vector<VkDeviceSize> scratchOffsets(blasCount);
+		VkDeviceSize arenaSize = 0; // Largest scratch size of a batch.
+		{
+			std::vector<uint32_t> indices;
+			VkDeviceSize batchSize = 0;
+			VkDeviceSize scratchSize = 0;
+			VkDeviceSize batchLimit = 256'000'000; // 256 MB
+			for (uint32_t i = 0; i < blasCount; i++) {
+				scratchOffsets[i] = scratchSize;
+				scratchSize += (buildAS[i].sizeInfo.buildScratchSize + scratchAlignment - 1) & ~(scratchAlignment - 1);
+				batchSize += buildAS[i].sizeInfo.accelerationStructureSize + buildAS[i].sizeInfo.buildScratchSize;
+				indices.push_back(i);
+
+				// Over the batch limit or the last BLAS element.
+				if (batchSize >= batchLimit || i == blasCount - 1) {
+					arenaSize = std::max(arenaSize, scratchSize);
+					batches.push_back(std::move(indices));
+					indices.clear();
+					batchSize = 0;
+					scratchSize = 0;
+				}
+			}
+		}
+
+		// Allocate the scratch arena holding the temporary data of the acceleration structure builder.
 		Buffer scratchBuffer;
-		VkDeviceAddress scratchAlignment = EngineContext::getPhysicalDeviceProperties().accelStructProperties.minAccelerationStructureScratchOffsetAlignment;
-		ResourceAllocator::createBufferWithAlignment(maxScratchSize, scratchAlignment, scratchBuffer, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+		ResourceAllocator::createBufferWithAlignment(arenaSize, scratchAlignment, scratchBuffer, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MEMORY_USAGE_GPU_ONLY);
 		VkDeviceAddress scratchAddress = scratchBuffer.getDeviceAddress();
 
-		// Batch creation of BLAS to allow staying in restricted amount of memory.
-		std::vector<uint32_t> indices;
-		VkDeviceSize batchSize = 0;
-		VkDeviceSize batchLimit = 256'000'000; // 256 MB
-		for (uint32_t i = 0; i < blasCount; i++) {
-			indices.push_back(i);
-			batchSize += buildAS[i].sizeInfo.accelerationStructureSize;
-			
-			// Over the batch limit or the last BLAS element.
-			if (batchSize >= batchLimit || i == blasCount - 1) {
-				VkCommandBuffer cmdBuffer;
-				EngineContext::createCommandBuffer(&cmdBuffer, 1);
-				
-				// Record command buffer.
-				VkCommandBufferBeginInfo beginInfo{};
-				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-				VK_CHECK(vkBeginCommandBuffer(cmdBuffer, &beginInfo));
-				
-				for (const auto& idx : indices) {
-					// Allocate acceleration structure.
-					ResourceAllocator::createAccelerationStructure(buildAS[idx].sizeInfo.accelerationStructureSize, *input[idx].pBLAS, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
-					
-					buildAS[idx].buildInfo.dstAccelerationStructure = input[idx].pBLAS->handle;
-					buildAS[idx].buildInfo.scratchData.deviceAddress = scratchAddress;
-
-					// Building the bottom-level-acceleration-structure
-					vkCmdBuildAccelerationStructuresKHR(cmdBuffer, 1, &buildAS[idx].buildInfo, &buildAS[idx].rangeInfo);
-					
-					// Barrier to ensure that the scratch buffer is ready before building next acceleration structure.
-					VkMemoryBarrier barrier{};
-					barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-					barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-					barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
-					vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
-				}
+		for (const auto& indices : batches) {
+			// Record command buffer.
+			VkCommandBuffer cmdBuffer = AsyncCompute::begin();
 
-				// End command buffer.
-				VK_CHECK(vkEndCommandBuffer(cmdBuffer));
+			PendingCompaction compaction;
+			std::vector<VkAccelerationStructureKHR> compactHandles;
+			std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos;
+			std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos;
+			for (const auto& idx : indices) {
+				// Allocate acceleration structure.
+				ResourceAllocator::createAccelerationStructure(buildAS[idx].sizeInfo.accelerationStructureSize, *input[idx].pBLAS, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+				if (input[idx].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
+					compaction.blas.push_back(input[idx].pBLAS);
+					compactHandles.push_back(input[idx].pBLAS->handle);
+				} else if (!(input[idx].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR)) {
+					// Updatable BLAS are refitted every frame, a relocation would lose the refits recorded since its copy.
+					Defragmenter::registerAccelerationStructure(*input[idx].pBLAS, buildAS[idx].sizeInfo.accelerationStructureSize, VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+				}
+				
+				buildAS[idx].buildInfo.dstAccelerationStructure = input[idx].pBLAS->handle;
+				buildAS[idx].buildInfo.scratchData.deviceAddress = scratchAddress + scratchOffsets[idx];
+				buildInfos.push_back(buildAS[idx].buildInfo);
+				rangeInfos.push_back(buildAS[idx].rangeInfo);
+			}
 
-				// Submit command buffer and wait.
-				VkSubmitInfo submitInfo{};
-				submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-				submitInfo.commandBufferCount = 1;
-				submitInfo.pCommandBuffers = &cmdBuffer;
+			// Building every bottom-level-acceleration-structure of the batch at once.
+			vkCmdBuildAccelerationStructuresKHR(cmdBuffer, static_cast<uint32_t>(buildInfos.size()), buildInfos.data(), rangeInfos.data());
+			
+			// Barrier to ensure that the batch is built before querying its compacted sizes.
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-				VK_CHECK(vkQueueSubmit(EngineContext::getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE));
-				VK_CHECK(vkQueueWaitIdle(EngineContext::getGraphicsQueue()));
+			// Query the compacted sizes once every BLAS of the batch is built.
+			uint32_t compactCount = static_cast<uint32_t>(compactHandles.size());
+			if (compactCount > 0) {
+				VkQueryPoolCreateInfo queryPoolInfo{};
+				queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+				queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+				queryPoolInfo.queryCount = compactCount;
+				VK_CHECK(vkCreateQueryPool(EngineContext::getDevice(), &queryPoolInfo, nullptr, &compaction.queryPool));
 
-				// Reset
-				batchSize = 0;
-				indices.clear();
+				vkCmdResetQueryPool(cmdBuffer, compaction.queryPool, 0, compactCount);
+				vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer, compactCount, compactHandles.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR, compaction.queryPool, 0);
 			}
+
+			// Submit on the async compute queue, rendering only waits for the batch when it needs the BLAS.
+			// Compaction is left to a later update, the host never waits for the build.
+			compaction.token = AsyncCompute::submit();
+			if (compactCount > 0) compactions.push_back(std::move(compaction));
 		}
 
-		ResourceAllocator::destroyBuffer(scratchBuffer);
+		// The scratch arena is in use until the last submission completed.
+		AsyncCompute::releaseAfter(AsyncCompute::getLastToken(), [scratchBuffer]() { ResourceAllocator::destroyBuffer(scratchBuffer); });
+	}
+
+	void buildBLAS(std::vector<BottomLevelAccelerationStructureCreateInfo>& input, std::vector<PendingCompaction>& compactions) {
+		ALLOCATION_TAG("Scene::buildBLAS");
+		// Build on the CPU when host builds are enabled and every mesh kept its geometry on the host.
+		bool hostGeometry = std::all_of(input.begin(), input.end(), [](const BottomLevelAccelerationStructureCreateInfo& info) { return info.hostVertices != nullptr && info.hostIndices != nullptr; });
+		if (HostAccelerationBuilder::isEnabled() && hostGeometry) {
+			std::vector<BottomLevelAccelerationStructureCreateInfo> rejected = buildBLASOnHost(input);
+			if (!rejected.empty()) buildBLASOnDevice(rejected, compactions);
+			return;
+		}
+		buildBLASOnDevice(input, compactions);
 	}
 
-	VkTransformMatrixKHR toTransformMatrixKHR(glm::mat4 matrix) {
+	// Transposes the upper 3x4 of a column-major matrix into the row-major layout of VkTransformMatrixKHR.
+	inline void writeTransformMatrixKHR(const glm::mat4& matrix, VkTransformMatrixKHR& out) {
+#if defined(ENGINE_SSE2)
+		__m128 row0 = _mm_loadu_ps(&matrix[0][0]);
+		__m128 row1 = _mm_loadu_ps(&matrix[1][0]);
+		__m128 row2 = _mm_loadu_ps(&matrix[2][0]);
+		__m128 row3 = _mm_loadu_ps(&matrix[3][0]);
+		_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+		_mm_storeu_ps(out.matrix[0], row0);
+		_mm_storeu_ps(out.matrix[1], row1);
+		_mm_storeu_ps(out.matrix[2], row2);
+#else
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 4; c++) out.matrix[r][c] = matrix[c][r];
+		}
+#endif
+	}
+
+	VkTransformMatrixKHR toTransformMatrixKHR(const glm::mat4& matrix) {
 		VkTransformMatrixKHR out;
-		memcpy(&out.matrix, &glm::transpose(matrix), sizeof(VkTransformMatrixKHR));
+		writeTransformMatrixKHR(matrix, out);
 		return out;
 	}
 
-	void buildTLAS(std::vector<Object>& objects, AccelerationStructure& tlas) {
-		std::vector<VkAccelerationStructureInstanceKHR> instances;
-		instances.reserve(objects.size());
-		uint32_t nextInstanceIndex = 0;
+	// Objects per thread when generating TLAS instances, smaller ranges are not worth a thread.
+	const uint32_t INSTANCE_GENERATION_RANGE_SIZE = 4096;
 
-		for (auto obj : objects) {
-			for (uint32_t k = 0; k < obj.mesh->getSubmeshCount() && k < obj.materials.size(); k++) {
-				VkAccelerationStructureInstanceKHR inst{};
-				inst.transform = toTransformMatrixKHR(obj.transform);
-				inst.instanceCustomIndex = nextInstanceIndex++;
-				inst.accelerationStructureReference = obj.mesh->getSubmesh(k).getBLAS().getDeviceAddress();
-				inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-				inst.mask = 0xFF;
-				inst.instanceShaderBindingTableRecordOffset = obj.shaderHitGroupOffset;
-				instances.emplace_back(inst);
-			}
+	// Calls func(first, last) over ranges of [0, count) split across the hardware threads, the calling thread takes the first range.
+	template<typename Func>
+	static void parallelFor(const uint32_t count, const uint32_t minRangeSize, const Func& func) {
+		uint32_t rangeCount = std::min(std::max(1u, std::thread::hardware_concurrency()), (count + minRangeSize - 1) / minRangeSize);
+		if (rangeCount <= 1) {
+			if (count > 0) func(0u, count);
+			return;
 		}
 
-		uint32_t instCount = static_cast<uint32_t>(instances.size());
-
-		// Create command buffer.
-		VkCommandBuffer cmdBuffer;
-		EngineContext::createCommandBuffer(&cmdBuffer, 1);
-
-		// Record command buffer.
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-		VK_CHECK(vkBeginCommandBuffer(cmdBuffer, &beginInfo));
+		uint32_t rangeSize = (count + rangeCount - 1) / rangeCount;
+		std::vector<std::future<void>> tasks;
+		for (uint32_t first = rangeSize; first < count; first += rangeSize) {
+			uint32_t last = std::min(first + rangeSize, count);
+			tasks.push_back(std::async(std::launch::async, [&func, first, last]() { func(first, last); }));
+		}
+		func(0u, rangeSize);
+		for (auto& task : tasks) task.get();
+	}
 
-		// Create and stage a buffer holding the actual instance data for use by the AS builder.
-		VkDeviceSize bufferSize = sizeof(VkAccelerationStructureInstanceKHR) * instCount;
-		Buffer instanceBuffer;
-		Buffer instanceStageBuffer;
-		ResourceAllocator::createAndStageBuffer(cmdBuffer, bufferSize, instances.data(), instanceStageBuffer, instanceBuffer, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
-		VkDeviceAddress instanceBufferAddress = instanceBuffer.getDeviceAddress();
+	uint32_t getInstanceCount(const Object& obj) {
+		return std::min(obj.mesh->getSubmeshCount(), static_cast<uint32_t>(obj.materials.size()));
+	}
 
-		// Make sure the copy of the instance buffer are copied before triggering the acceleration structure build.
-		VkMemoryBarrier barrier{};
-		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	// Writes the TLAS instances of an object's submeshes, dst may be write-combined memory so every instance is stored whole.
+	void writeObjectInstances(const Object& obj, VkAccelerationStructureInstanceKHR* dst) {
+		uint32_t count = getInstanceCount(obj);
+		for (uint32_t k = 0; k < count; k++) {
+			VkAccelerationStructureInstanceKHR inst;
+			writeTransformMatrixKHR(obj.transform, inst.transform);
+			inst.instanceCustomIndex = obj.firstInstance + k;
+			inst.mask = 0xFF;
+			inst.instanceShaderBindingTableRecordOffset = obj.shaderHitGroupOffset;
+			inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+			inst.accelerationStructureReference = obj.mesh->getSubmesh(k).getBLAS().getDeviceAddress();
+			dst[k] = inst;
+		}
+	}
 
-		// Creating the TLAS.
+	// Instance geometry of a TLAS reading its instances from the given buffer.
+	VkAccelerationStructureGeometryKHR getTLASGeometry(const VkDeviceAddress& instanceBufferAddress) {
 		VkAccelerationStructureGeometryInstancesDataKHR instancesData{};
 		instancesData.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
 		instancesData.data.deviceAddress = instanceBufferAddress;
@@ -312,10 +665,247 @@ namespace core {
 		geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
 		geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
 		geometry.geometry.instances = instancesData;
+		return geometry;
+	}
+
+	void Scene::createStaticBatches(ResourcePool<Object>& objects) {
+		ALLOCATION_TAG("Scene::createStaticBatches");
+		destroyStaticBatches();
+
+		// Group small static objects by hit group and grid cell, the batch's instance has a single hit group offset.
+		std::map<std::tuple<uint32_t, int32_t, int32_t, int32_t>, std::vector<Handle<Object>>> groups;
+		for (uint32_t i = 0; i < objects.size(); i++) {
+			Handle<Object> handle = objects.getHandle(i);
+			Object& obj = objects.at(handle);
+			obj.batched = false;
+			if (!obj.isStatic || obj.mesh->isDeformable()) continue;
+
+			uint32_t triangleCount = 0;
+			for (uint32_t k = 0; k < obj.mesh->getSubmeshCount() && k < obj.materials.size(); k++) {
+				triangleCount += obj.mesh->getSubmesh(k).getIndexCount() / 3;
+			}
+			if (triangleCount == 0 || triangleCount > STATIC_BATCH_MAX_MESH_TRIANGLES) continue;
+
+			glm::ivec3 cell = glm::ivec3(glm::floor(glm::vec3(obj.transform[3]) / STATIC_BATCH_CELL_SIZE + 0.5f));
+			groups[std::make_tuple(obj.shaderHitGroupOffset, cell.x, cell.y, cell.z)].push_back(handle);
+		}
+
+		// Split groups into batches within the geometry limit.
+		uint32_t maxGeometries = static_cast<uint32_t>(std::min<uint64_t>(STATIC_BATCH_MAX_GEOMETRIES, EngineContext::getPhysicalDeviceProperties().accelStructProperties.maxGeometryCount));
+		for (auto& group : groups) {
+			StaticBatch* batch = nullptr;
+			for (const auto& handle : group.second) {
+				Object& obj = objects.at(handle);
+				uint32_t geometryCount = std::min(obj.mesh->getSubmeshCount(), static_cast<uint32_t>(obj.materials.size()));
+				if (batch == nullptr || batch->geometryCount + geometryCount > maxGeometries) {
+					staticBatches.emplace_back();
+					batch = &staticBatches.back();
+					batch->shaderHitGroupOffset = std::get<0>(group.first);
+				}
+				batch->objects.push_back(handle);
+				batch->geometryCount += geometryCount;
+				obj.batched = true;
+			}
+		}
+
+		// Merging a lone object gains nothing, it keeps its own instances.
+		for (auto it = staticBatches.begin(); it != staticBatches.end();) {
+			if (it->objects.size() > 1) {
+				it++;
+				continue;
+			}
+			objects.at(it->objects[0]).batched = false;
+			it = staticBatches.erase(it);
+		}
+
+		// Bake the object transforms, host-visible so the BLAS builds can read them right away.
+		for (auto& batch : staticBatches) {
+			std::vector<VkTransformMatrixKHR> transforms;
+			transforms.reserve(batch.geometryCount);
+			for (const auto& handle : batch.objects) {
+				Object& obj = objects.at(handle);
+				for (uint32_t k = 0; k < obj.mesh->getSubmeshCount() && k < obj.materials.size(); k++) {
+					transforms.push_back(toTransformMatrixKHR(obj.transform));
+				}
+			}
+			VkDeviceSize size = sizeof(VkTransformMatrixKHR) * transforms.size();
+			ResourceAllocator::createBufferWithAlignment(size, 16, batch.transformBuffer, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MEMORY_USAGE_UPLOAD);
+			ResourceAllocator::mapDataToBuffer(batch.transformBuffer, size, transforms.data());
+		}
+	}
+
+	void Scene::buildStaticBatches() {
+		ALLOCATION_TAG("Scene::buildStaticBatches");
+		// One geometry per batched submesh, reading its transform from the batch's transform buffer.
+		std::vector<BottomLevelAccelerationStructureCreateInfo> createInfos;
+		for (auto& batch : staticBatches) {
+			BottomLevelAccelerationStructureCreateInfo info{};
+			info.pBLAS = &batch.blas;
+			info.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+			uint32_t geometryIndex = 0;
+			for (const auto& handle : batch.objects) {
+				Object& obj = objects.at(handle);
+				for (uint32_t k = 0; k < obj.mesh->getSubmeshCount() && k < obj.materials.size(); k++) {
+					BottomLevelAccelerationStructureCreateInfo submeshInfo = fetchBottomLevelAccelerationStructureCreateInfo(obj.mesh, k);
+					VkAccelerationStructureGeometryKHR geometry = submeshInfo.geometries[0];
+					geometry.geometry.triangles.transformData.deviceAddress = batch.transformBuffer.getDeviceAddress();
+					VkAccelerationStructureBuildRangeInfoKHR offset = submeshInfo.offsets[0];
+					offset.transformOffset = geometryIndex++ * sizeof(VkTransformMatrixKHR);
+					info.geometries.push_back(geometry);
+					info.offsets.push_back(offset);
+				}
+			}
+			createInfos.push_back(std::move(info));
+		}
+		// Merged BLASes keep no host geometry, they always build on the device.
+		if (!createInfos.empty()) buildBLAS(createInfos, pendingCompactions);
+	}
+
+	void Scene::destroyStaticBatches() {
+		for (auto& batch : staticBatches) {
+			cancelCompaction(&batch.blas);
+			Defragmenter::unregister(batch.blas.allocation);
+			ResourceAllocator::destroyAccelerationStructure(batch.blas);
+			ResourceAllocator::destroyBuffer(batch.transformBuffer);
+		}
+		staticBatches.clear();
+	}
+
+	void Scene::cancelCompaction(const AccelerationStructure* blas) {
+		// BLAS destroyed before their compaction are skipped by it.
+		for (auto scene : scenes) {
+			for (auto& compaction : scene->pendingCompactions) {
+				std::replace(compaction.blas.begin(), compaction.blas.end(), const_cast<AccelerationStructure*>(blas), static_cast<AccelerationStructure*>(nullptr));
+			}
+		}
+	}
+
+	bool Scene::compactPendingBLAS() {
+		ALLOCATION_TAG("Scene::compactPendingBLAS");
+		VkDevice device = EngineContext::getDevice();
+		bool compacted = false;
+
+		// Batches complete in submission order, stop at the first one still building.
+		while (!pendingCompactions.empty() && AsyncCompute::isComplete(pendingCompactions.front().token)) {
+			PendingCompaction compaction = std::move(pendingCompactions.front());
+			pendingCompactions.erase(pendingCompactions.begin());
+			uint32_t queryCount = static_cast<uint32_t>(compaction.blas.size());
+
+			// Fetch compacted sizes written by the build command buffer.
+			std::vector<VkDeviceSize> compactSizes(queryCount);
+			VK_CHECK(vkGetQueryPoolResults(device, compaction.queryPool, 0, queryCount, queryCount * sizeof(VkDeviceSize), compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT | VK_QUERY_RESULT_64_BIT));
+			vkDestroyQueryPool(device, compaction.queryPool, nullptr);
+
+			// Copy each BLAS into a right-sized acceleration structure.
+			VkCommandBuffer cmdBuffer = AsyncCompute::begin();
+			std::vector<AccelerationStructure> compactedBLAS(queryCount);
+			for (uint32_t i = 0; i < queryCount; i++) {
+				if (compaction.blas[i] == nullptr) continue;
+				ResourceAllocator::createAccelerationStructure(compactSizes[i], compactedBLAS[i], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+
+				VkCopyAccelerationStructureInfoKHR copyInfo{};
+				copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+				copyInfo.src = compaction.blas[i]->handle;
+				copyInfo.dst = compactedBLAS[i].handle;
+				copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+				vkCmdCopyAccelerationStructureKHR(cmdBuffer, &copyInfo);
+			}
+
+			// The compacted copies are read by later builds and copies.
+			VkMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+			vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			ComputeToken token = AsyncCompute::submit();
+
+			// Replace the original BLAS by their compacted copies. Frames in flight may still trace the originals,
+			// their destruction is deferred by the allocator once the copies completed.
+			for (uint32_t i = 0; i < queryCount; i++) {
+				AccelerationStructure* pBLAS = compaction.blas[i];
+				if (pBLAS == nullptr) continue;
+				AccelerationStructure original = *pBLAS;
+				AsyncCompute::releaseAfter(token, [original]() { ResourceAllocator::destroyAccelerationStructure(original); });
+				*pBLAS = compactedBLAS[i];
+				Defragmenter::registerAccelerationStructure(*pBLAS, compactSizes[i], VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR);
+			}
+			compacted = true;
+		}
+		return compacted;
+	}
+
+	void Scene::buildTLAS(ResourcePool<Object>& objects) {
+		ALLOCATION_TAG("Scene::buildTLAS");
+		// Release the previous TLAS along with its instance and scratch buffers.
+		ResourceAllocator::destroyAccelerationStructure(tlas);
+		ResourceAllocator::destroyBuffer(instanceBuffer);
+		ResourceAllocator::destroyBuffer(tlasScratchBuffer);
+		tlas = {};
+		instanceBuffer = {};
+		tlasScratchBuffer = {};
+
+		// Assign instance ranges first, instance k of an object is its k-th submesh.
+		std::vector<const Object*> instancedObjects;
+		instancedObjects.reserve(objects.size());
+		dirtyObjects.clear();
+		uint32_t nextInstanceIndex = 0;
+		for (auto& obj : objects) {
+			if (obj.batched) continue;
+			obj.firstInstance = nextInstanceIndex;
+			nextInstanceIndex += getInstanceCount(obj);
+			instancedObjects.push_back(&obj);
+		}
+		instanceCount = nextInstanceIndex + static_cast<uint32_t>(staticBatches.size());
+		uint32_t instCount = instanceCount;
+
+		// Record command buffer, the build runs on the async compute queue after the BLAS builds it references.
+		VkCommandBuffer cmdBuffer = AsyncCompute::begin();
+
+		// Create the persistent buffer holding the instance data for use by the AS builder, and its staging buffer.
+		// At least one instance, so the buffers stay valid once every object was removed.
+		VkDeviceSize bufferSize = sizeof(VkAccelerationStructureInstanceKHR) * std::max(instCount, 1u);
+		Buffer instanceStageBuffer;
+		ResourceAllocator::createBuffer(bufferSize, instanceStageBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD);
+		ResourceAllocator::createBuffer(bufferSize, instanceBuffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, MEMORY_USAGE_GPU_ONLY);
+
+		// Generate the instances straight into the mapped staging buffer, in parallel over ranges of objects.
+		VkAccelerationStructureInstanceKHR* stagedInstances = static_cast<VkAccelerationStructureInstanceKHR*>(instanceStageBuffer.mapped);
+		parallelFor(static_cast<uint32_t>(instancedObjects.size()), INSTANCE_GENERATION_RANGE_SIZE, [&](uint32_t first, uint32_t last) {
+			for (uint32_t i = first; i < last; i++) {
+				writeObjectInstances(*instancedObjects[i], stagedInstances + instancedObjects[i]->firstInstance);
+			}
+		});
+
+		// One instance per static batch, its transforms are baked into the BLAS.
+		for (const auto& batch : staticBatches) {
+			VkAccelerationStructureInstanceKHR inst{};
+			inst.transform = toTransformMatrixKHR(glm::mat4(1.0f));
+			inst.instanceCustomIndex = batch.firstDescription;
+			inst.accelerationStructureReference = batch.blas.getDeviceAddress();
+			inst.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+			inst.mask = 0xFF;
+			inst.instanceShaderBindingTableRecordOffset = batch.shaderHitGroupOffset;
+			stagedInstances[nextInstanceIndex++] = inst;
+		}
+		ResourceAllocator::flushBuffer(instanceStageBuffer);
+
+		VkBufferCopy copyRegion{};
+		copyRegion.size = bufferSize;
+		vkCmdCopyBuffer(cmdBuffer, instanceStageBuffer.buffer, instanceBuffer.buffer, 1, &copyRegion);
+
+		// Make sure the instance buffer is copied, and the BLAS built, compacted or deserialized by earlier submissions written, before the build reads them.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		// Creating the TLAS, updatable so moving instances only needs a refit.
+		VkAccelerationStructureGeometryKHR geometry = getTLASGeometry(instanceBuffer.getDeviceAddress());
 
 		VkAccelerationStructureBuildGeometryInfoKHR buildInfo{};
 		buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-		buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+		buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
 		buildInfo.geometryCount = 1;
 		buildInfo.pGeometries = &geometry;
 		buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
@@ -329,14 +919,14 @@ namespace core {
 		// Create TLAS buffer.
 		ResourceAllocator::createAccelerationStructure(sizeInfo.accelerationStructureSize, tlas, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR);
 
-		// Build TLAS
-		Buffer scratchBuffer;
-		ResourceAllocator::createBuffer(sizeInfo.buildScratchSize, scratchBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-		VkDeviceAddress scratchAddress = scratchBuffer.getDeviceAddress();
+		// Build TLAS, the scratch buffer is kept for the per-frame refits.
+		VkDeviceSize scratchAlignment = EngineContext::getPhysicalDeviceProperties().accelStructProperties.minAccelerationStructureScratchOffsetAlignment;
+		VkDeviceSize scratchSize = std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize);
+		ResourceAllocator::createBufferWithAlignment(scratchSize, scratchAlignment, tlasScratchBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MEMORY_USAGE_GPU_ONLY);
 
 		buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
 		buildInfo.dstAccelerationStructure = tlas.handle;
-		buildInfo.scratchData.deviceAddress = scratchAddress;
+		buildInfo.scratchData.deviceAddress = tlasScratchBuffer.getDeviceAddress();
 
 		VkAccelerationStructureBuildRangeInfoKHR offsetInfo{};
 		offsetInfo.primitiveCount = instCount;
@@ -353,26 +943,292 @@ namespace core {
 		barrier2.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
 		vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier2, 0, nullptr, 0, nullptr);
 
-		// End command buffer.
-		VK_CHECK(vkEndCommandBuffer(cmdBuffer));
+		// Submit without waiting, the next graphics submission waits on the token before tracing the TLAS.
+		ComputeToken token = AsyncCompute::submit();
 
-		// Submit command buffer and wait.
-		VkSubmitInfo submitInfo{};
-		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &cmdBuffer;
+		// Cleanup.
+		AsyncCompute::releaseAfter(token, [instanceStageBuffer]() { ResourceAllocator::destroyBuffer(instanceStageBuffer); });
+		topologyChanged = false;
+	}
 
-		VK_CHECK(vkQueueSubmit(EngineContext::getGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE));
-		VK_CHECK(vkQueueWaitIdle(EngineContext::getGraphicsQueue()));
+	void Scene::recordAccelerationStructureUpdate(const VkCommandBuffer& commandBuffer, FrameSuballocator& frameAllocator) {
+		if (tlas.handle == VK_NULL_HANDLE) return;
 
-		// Cleanup.
-		ResourceAllocator::destroyBuffer(scratchBuffer);
-		ResourceAllocator::destroyBuffer(instanceStageBuffer);
-		ResourceAllocator::destroyBuffer(instanceBuffer);
+		// Deformable meshes with new vertices this frame.
+		std::vector<Mesh*> deformedMeshes;
+		for (auto mesh : meshes) {
+			if (mesh->isDeformable() && mesh->hasPendingVertices()) deformedMeshes.push_back(mesh);
+		}
+		if (dirtyObjects.empty() && deformedMeshes.empty()) return;
+
+		// Wait for previous frames to finish tracing and building before rewriting their inputs.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		// Upload the new vertices of deformed meshes through the frame's scratch memory.
+		for (auto mesh : deformedMeshes) {
+			VkDeviceSize size = sizeof(Vertex) * mesh->getVertices().size();
+			BufferRegion region = frameAllocator.push(mesh->getVertices().data(), size);
+			VkBufferCopy copyRegion{};
+			copyRegion.srcOffset = region.offset;
+			copyRegion.dstOffset = 0;
+			copyRegion.size = size;
+			vkCmdCopyBuffer(commandBuffer, region.buffer.buffer, mesh->getVertexBuffer().buffer, 1, &copyRegion);
+		}
+
+		// Moved objects in instance order, so the copies of neighbouring objects merge.
+		std::vector<const Object*> movedObjects;
+		movedObjects.reserve(dirtyObjects.size());
+		for (const auto& handle : dirtyObjects) {
+			const Object* obj = objects.get(handle);
+			if (obj != nullptr && !obj->batched) movedObjects.push_back(obj);
+		}
+		dirtyObjects.clear();
+		std::sort(movedObjects.begin(), movedObjects.end(), [](const Object* a, const Object* b) { return a->firstInstance < b->firstInstance; });
+		movedObjects.erase(std::unique(movedObjects.begin(), movedObjects.end()), movedObjects.end());
+
+		std::vector<uint32_t> uploadOffsets(movedObjects.size() + 1, 0);
+		for (size_t i = 0; i < movedObjects.size(); i++) {
+			uploadOffsets[i + 1] = uploadOffsets[i] + getInstanceCount(*movedObjects[i]);
+		}
+		uint32_t uploadCount = uploadOffsets.back();
+
+		if (uploadCount > 0) {
+			// Grow the upload ring, the previous one is released once no frame in flight uses it.
+			if (uploadCount > instanceUploadCapacity) {
+				ResourceAllocator::destroyBuffer(instanceUploadBuffer);
+				instanceUploadCapacity = std::max(uploadCount, instanceUploadCapacity * 2);
+				ResourceAllocator::createBuffer(sizeof(VkAccelerationStructureInstanceKHR) * instanceUploadCapacity * MAX_FRAMES_IN_FLIGHT, instanceUploadBuffer, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MEMORY_USAGE_UPLOAD);
+				instanceUploadIndex = 0;
+			}
+			VkDeviceSize uploadOffset = sizeof(VkAccelerationStructureInstanceKHR) * instanceUploadCapacity * instanceUploadIndex;
+			instanceUploadIndex = (instanceUploadIndex + 1) % MAX_FRAMES_IN_FLIGHT;
+
+			// Regenerate the moved instances straight into this frame's range of the ring.
+			VkAccelerationStructureInstanceKHR* uploadInstances = reinterpret_cast<VkAccelerationStructureInstanceKHR*>(static_cast<uint8_t*>(instanceUploadBuffer.mapped) + uploadOffset);
+			parallelFor(static_cast<uint32_t>(movedObjects.size()), INSTANCE_GENERATION_RANGE_SIZE, [&](uint32_t first, uint32_t last) {
+				for (uint32_t i = first; i < last; i++) {
+					writeObjectInstances(*movedObjects[i], uploadInstances + uploadOffsets[i]);
+				}
+			});
+			ResourceAllocator::flushBuffer(instanceUploadBuffer, uploadOffset, sizeof(VkAccelerationStructureInstanceKHR) * uploadCount);
+
+			// One copy region per run of consecutive instances.
+			std::vector<VkBufferCopy> copyRegions;
+			for (size_t i = 0; i < movedObjects.size(); i++) {
+				VkBufferCopy copyRegion{};
+				copyRegion.srcOffset = uploadOffset + sizeof(VkAccelerationStructureInstanceKHR) * uploadOffsets[i];
+				copyRegion.dstOffset = sizeof(VkAccelerationStructureInstanceKHR) * movedObjects[i]->firstInstance;
+				copyRegion.size = sizeof(VkAccelerationStructureInstanceKHR) * (uploadOffsets[i + 1] - uploadOffsets[i]);
+				if (copyRegion.size == 0) continue;
+				if (!copyRegions.empty() && copyRegions.back().srcOffset + copyRegions.back().size == copyRegion.srcOffset && copyRegions.back().dstOffset + copyRegions.back().size == copyRegion.dstOffset) {
+					copyRegions.back().size += copyRegion.size;
+				} else {
+					copyRegions.push_back(copyRegion);
+				}
+			}
+			vkCmdCopyBuffer(commandBuffer, instanceUploadBuffer.buffer, instanceBuffer.buffer, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+		}
+
+		VkMemoryBarrier barrier2{};
+		barrier2.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier2.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier2, 0, nullptr, 0, nullptr);
+
+		// Refit the BLAS of deformed meshes in place, or rebuild them once refits degraded them too much.
+		if (!deformedMeshes.empty()) {
+			std::vector<BottomLevelAccelerationStructureCreateInfo> createInfos;
+			std::vector<VkBuildAccelerationStructureModeKHR> modes;
+			for (auto mesh : deformedMeshes) {
+				VkBuildAccelerationStructureModeKHR mode = mesh->consumePendingVertices() ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+				for (uint32_t k = 0; k < mesh->getSubmeshCount(); k++) {
+					createInfos.push_back(fetchBottomLevelAccelerationStructureCreateInfo(mesh, k));
+					modes.push_back(mode);
+				}
+			}
+
+			// Every build gets its own aligned range of the scratch buffer.
+			VkDeviceSize scratchAlignment = EngineContext::getPhysicalDeviceProperties().accelStructProperties.minAccelerationStructureScratchOffsetAlignment;
+			std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(createInfos.size());
+			std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> rangeInfos(createInfos.size());
+			std::vector<VkDeviceSize> scratchOffsets(createInfos.size());
+			VkDeviceSize scratchSize = 0;
+			for (size_t i = 0; i < createInfos.size(); i++) {
+				buildInfos[i].sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+				buildInfos[i].type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+				buildInfos[i].mode = modes[i];
+				buildInfos[i].flags = createInfos[i].flags;
+				buildInfos[i].geometryCount = 1;
+				buildInfos[i].pGeometries = createInfos[i].geometries.data();
+				buildInfos[i].srcAccelerationStructure = modes[i] == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR ? createInfos[i].pBLAS->handle : VK_NULL_HANDLE;
+				buildInfos[i].dstAccelerationStructure = createInfos[i].pBLAS->handle;
+				rangeInfos[i] = createInfos[i].offsets.data();
+
+				VkAccelerationStructureBuildSizesInfoKHR sizeInfo{};
+				sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+				vkGetAccelerationStructureBuildSizesKHR(EngineContext::getDevice(), VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfos[i], &createInfos[i].offsets[0].primitiveCount, &sizeInfo);
+				scratchOffsets[i] = scratchSize;
+				VkDeviceSize buildScratchSize = modes[i] == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR ? sizeInfo.updateScratchSize : sizeInfo.buildScratchSize;
+				scratchSize += (buildScratchSize + scratchAlignment - 1) & ~(scratchAlignment - 1);
+			}
+
+			// Grow the scratch buffer, the previous one is released once no frame in flight uses it.
+			if (scratchSize > blasScratchSize) {
+				ResourceAllocator::destroyBuffer(blasScratchBuffer);
+				ResourceAllocator::createBufferWithAlignment(scratchSize, scratchAlignment, blasScratchBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MEMORY_USAGE_GPU_ONLY);
+				blasScratchSize = scratchSize;
+			}
+			for (size_t i = 0; i < buildInfos.size(); i++) {
+				buildInfos[i].scratchData.deviceAddress = blasScratchBuffer.getDeviceAddress() + scratchOffsets[i];
+			}
+
+			vkCmdBuildAccelerationStructuresKHR(commandBuffer, static_cast<uint32_t>(buildInfos.size()), buildInfos.data(), rangeInfos.data());
+
+			// The TLAS refit reads the updated BLAS.
+			VkMemoryBarrier barrier3{};
+			barrier3.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			barrier3.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+			barrier3.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier3, 0, nullptr, 0, nullptr);
+		}
+
+		// Refit the TLAS in place.
+		VkAccelerationStructureGeometryKHR geometry = getTLASGeometry(instanceBuffer.getDeviceAddress());
+
+		VkAccelerationStructureBuildGeometryInfoKHR buildInfo{};
+		buildInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+		buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+		buildInfo.geometryCount = 1;
+		buildInfo.pGeometries = &geometry;
+		buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+		buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+		buildInfo.srcAccelerationStructure = tlas.handle;
+		buildInfo.dstAccelerationStructure = tlas.handle;
+		buildInfo.scratchData.deviceAddress = tlasScratchBuffer.getDeviceAddress();
+
+		VkAccelerationStructureBuildRangeInfoKHR offsetInfo{};
+		offsetInfo.primitiveCount = instanceCount;
+		const VkAccelerationStructureBuildRangeInfoKHR* pOffsetInfo = &offsetInfo;
+
+		vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildInfo, &pOffsetInfo);
+
+		// Make the refitted acceleration structures and uploaded vertices visible to the shaders.
+		VkMemoryBarrier barrier4{};
+		barrier4.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier4.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier4.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier4, 0, nullptr, 0, nullptr);
+	}
+
+	void Scene::setTransform(const Handle<Object>& object, const glm::mat4& transform) {
+		Object* obj = objects.get(object);
+		if (obj == nullptr) return;
+		obj->transform = transform;
+		// Moves pile up while the BVH is not queried, past one per object a rebuild is cheaper.
+		if (!queryBVHChanged) queryBVHMoved.push_back(object);
+		if (queryBVHMoved.size() > objects.size()) {
+			queryBVHChanged = true;
+			queryBVHMoved.clear();
+		}
+
+		// Transforms of batched objects are baked into their batch's BLAS, which must be rebuilt.
+		if (obj->batched) {
+			topologyChanged = true;
+			return;
+		}
+
+		// Instances are rewritten anyway by the next full build.
+		if (tlas.handle == VK_NULL_HANDLE || topologyChanged) return;
+		dirtyObjects.push_back(object);
+	}
+
+	SceneBVH& Scene::getBVH() {
+		// Only added or removed objects change the topology, moved objects are refitted.
+		if (queryBVHChanged) {
+			queryBVH.build(objects);
+			queryBVHChanged = false;
+			queryBVHMoved.clear();
+			return queryBVH;
+		}
+
+		// Deformed meshes refit their own BVH, but their bounds in the object BVH must follow.
+		for (uint32_t i = 0; i < objects.size(); i++) {
+			Handle<Object> handle = objects.getHandle(i);
+			if (objects.at(handle).mesh->isDeformable()) queryBVHMoved.push_back(handle);
+		}
+		if (!queryBVHMoved.empty()) {
+			queryBVH.refit(objects, queryBVHMoved);
+			queryBVHMoved.clear();
+		}
+		return queryBVH;
+	}
+
+	// Meshes drawn through their own TLAS instances, meshes only used by static batches need no BLAS of their own.
+	static std::unordered_set<Mesh*> getInstancedMeshes(ResourcePool<Object>& objects) {
+		std::unordered_set<Mesh*> instancedMeshes;
+		for (auto& obj : objects) {
+			if (!obj.batched) instancedMeshes.insert(obj.mesh);
+		}
+		return instancedMeshes;
 	}
 
-	void Scene::buildAccelerationStructure(std::vector<Object>& objects, std::unordered_set<Mesh*>& meshes) {
-		buildBLAS(fetchAllBottomLevelAccelerationStructureCreateInfo(meshes));
-		buildTLAS(objects, tlas);
+	void Scene::buildAccelerationStructure(ResourcePool<Object>& objects, std::unordered_set<Mesh*>& meshes) {
+		// Only meshes missing from the BLAS cache are built, then stored for the next launch.
+		// Storing waits for the builds and their compaction, it is deferred to the first update after they completed.
+		std::unordered_set<Mesh*> uncached = AccelerationStructureCache::load(getInstancedMeshes(objects));
+		if (!uncached.empty()) {
+			buildBLAS(fetchAllBottomLevelAccelerationStructureCreateInfo(uncached), pendingCompactions);
+			pendingCacheMeshes.insert(uncached.begin(), uncached.end());
+			pendingCacheToken = AsyncCompute::getLastToken();
+		}
+		buildStaticBatches();
+		for (auto mesh : meshes) {
+			mesh->releaseHostGeometry();
+		}
+		buildTLAS(objects);
+	}
+
+	void Scene::rebuildAccelerationStructure(ResourcePool<Object>& objects, std::unordered_set<Mesh*>& meshes) {
+		// Regroup static objects, added objects may join batches.
+		createStaticBatches(objects);
+
+		// Build BLASes of meshes instanced since the last build.
+		std::unordered_set<Mesh*> newMeshes;
+		for (auto mesh : getInstancedMeshes(objects)) {
+			if (mesh->getSubmeshCount() > 0 && mesh->getSubmesh(0).getBLAS().handle == VK_NULL_HANDLE) newMeshes.insert(mesh);
+		}
+		// The builds overlap rendering, caching them is deferred to the first update after they completed.
+		std::unordered_set<Mesh*> uncached = AccelerationStructureCache::load(newMeshes);
+		if (!uncached.empty()) {
+			buildBLAS(fetchAllBottomLevelAccelerationStructureCreateInfo(uncached), pendingCompactions);
+			pendingCacheMeshes.insert(uncached.begin(), uncached.end());
+			pendingCacheToken = AsyncCompute::getLastToken();
+		}
+		buildStaticBatches();
+		for (auto mesh : newMeshes) {
+			mesh->releaseHostGeometry();
+		}
+
+		// Instance indices changed, the object descriptions must follow.
+		ResourceAllocator::destroyBuffer(objDescBuffer);
+		createObjectDescriptions(objects);
+		buildTLAS(objects);
+	}
+
+	void Scene::onResourcesRelocated(const RelocationFlags& flags) {
+		// Moved vertex buffers have new device addresses.
+		// Frames in flight still read the old descriptions, so they are written to a new buffer instead of in place.
+		if (flags & RELOCATION_BUFFER_BIT) {
+			ResourceAllocator::destroyBuffer(objDescBuffer);
+			createObjectDescriptions(objects);
+		}
+		// Moved BLASes have new references, the TLAS instances must point at them.
+		if (flags & RELOCATION_ACCELERATION_STRUCTURE_BIT) {
+			buildTLAS(objects);
+		}
 	}
 }
@@ -0,0 +1,197 @@
+#include <suballocator.h>
+#include <engine_globals.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace core {
+
+	static VkDeviceSize alignRegion(const VkDeviceSize offset, const VkDeviceSize alignment) {
+		return ((offset + alignment - 1) / alignment) * alignment;
+	}
+
+	//***************************************************************************************//
+	//                                 Linear Suballocator                                   //
+	//***************************************************************************************//
+
+	LinearSuballocator::LinearSuballocator(const VkDeviceSize& blockSize, const VkDeviceSize& alignment, const VkBufferUsageFlags& usage, const MemoryUsage& memoryUsage) {
+		this->blockSize = blockSize;
+		this->alignment = alignment;
+		this->usage = usage;
+		this->memoryUsage = memoryUsage;
+	}
+
+	LinearSuballocator::~LinearSuballocator() {
+		cleanup();
+	}
+
+	void LinearSuballocator::cleanup() {
+		for (auto& block : blocks) {
+			ResourceAllocator::destroyBuffer(block.buffer);
+		}
+		blocks.clear();
+	}
+
+	void LinearSuballocator::reset() {
+		for (auto& block : blocks) {
+			block.head = 0;
+		}
+	}
+
+	BufferRegion LinearSuballocator::allocate(const VkDeviceSize& size) {
+		// Find the first block with enough space left.
+		Block* pBlock = nullptr;
+		VkDeviceSize offset = 0;
+		for (auto& block : blocks) {
+			offset = alignRegion(block.head, alignment);
+			if (offset + size <= block.size) {
+				pBlock = &block;
+				break;
+			}
+		}
+
+		// Otherwise create a new block (oversized requests get their own block).
+		if (pBlock == nullptr) {
+			pBlock = &createBlock(std::max(blockSize, size));
+			offset = 0;
+		}
+		pBlock->head = offset + size;
+
+		BufferRegion region{};
+		region.buffer = pBlock->buffer;
+		region.offset = offset;
+		region.size = size;
+		region.address = pBlock->address != 0 ? pBlock->address + offset : 0;
+		return region;
+	}
+
+	LinearSuballocator::Block& LinearSuballocator::createBlock(const VkDeviceSize& size) {
+		Block block{};
+		block.size = size;
+		block.head = 0;
+		ResourceAllocator::createBufferWithAlignment(size, alignment, block.buffer, usage, memoryUsage);
+		block.address = block.buffer.getDeviceAddress();
+		blocks.push_back(block);
+		return blocks.back();
+	}
+
+	//***************************************************************************************//
+	//                                  Pool Suballocator                                    //
+	//***************************************************************************************//
+
+	PoolSuballocator::PoolSuballocator(const VkDeviceSize& elementSize, const uint32_t& elementsPerBlock, const VkDeviceSize& alignment, const VkBufferUsageFlags& usage, const MemoryUsage& memoryUsage) {
+		this->elementSize = elementSize;
+		this->stride = alignRegion(elementSize, alignment);
+		this->elementsPerBlock = elementsPerBlock;
+		this->usage = usage;
+		this->memoryUsage = memoryUsage;
+	}
+
+	PoolSuballocator::~PoolSuballocator() {
+		cleanup();
+	}
+
+	void PoolSuballocator::cleanup() {
+		for (auto& block : blocks) {
+			ResourceAllocator::destroyBuffer(block.buffer);
+		}
+		blocks.clear();
+		freeRegions.clear();
+		releasedRegions.clear();
+	}
+
+	BufferRegion PoolSuballocator::allocate() {
+		// Recycle regions released before every frame in flight.
+		while (!releasedRegions.empty() && releasedRegions.front().first + MAX_FRAMES_IN_FLIGHT <= ResourceAllocator::getFrameCounter()) {
+			freeRegions.push_back(releasedRegions.front().second);
+			releasedRegions.pop_front();
+		}
+		if (freeRegions.empty()) {
+			createBlock();
+		}
+		BufferRegion region = freeRegions.back();
+		freeRegions.pop_back();
+		return region;
+	}
+
+	void PoolSuballocator::free(const BufferRegion& region) {
+		DEBUG_ASSERT(region.size == elementSize);
+		releasedRegions.push_back({ ResourceAllocator::getFrameCounter(), region });
+	}
+
+	void PoolSuballocator::createBlock() {
+		Block block{};
+		ResourceAllocator::createBufferWithAlignment(stride * elementsPerBlock, stride, block.buffer, usage, memoryUsage);
+		block.address = block.buffer.getDeviceAddress();
+		blocks.push_back(block);
+
+		// Push slots in reverse so they are handed out in increasing offset order.
+		for (uint32_t i = elementsPerBlock; i > 0; i--) {
+			BufferRegion region{};
+			region.buffer = block.buffer;
+			region.offset = stride * (i - 1);
+			region.size = elementSize;
+			region.address = block.address != 0 ? block.address + region.offset : 0;
+			freeRegions.push_back(region);
+		}
+	}
+
+	//***************************************************************************************//
+	//                                  Frame Suballocator                                   //
+	//***************************************************************************************//
+
+	FrameSuballocator::FrameSuballocator(const VkDeviceSize& frameSize, const VkDeviceSize& alignment, const VkBufferUsageFlags& usage) {
+		this->alignment = alignment;
+		this->frameSize = alignRegion(frameSize, alignment);
+		this->frameIndex = 0;
+		this->head = 0;
+		ResourceAllocator::createBufferWithAlignment(this->frameSize * MAX_FRAMES_IN_FLIGHT, alignment, buffer, usage, MEMORY_USAGE_DYNAMIC);
+		this->address = buffer.getDeviceAddress();
+		DEBUG_ASSERT_MSG(buffer.mapped != nullptr, "Frame suballocator buffer must be persistently mapped.");
+	}
+
+	FrameSuballocator::~FrameSuballocator() {
+		cleanup();
+	}
+
+	void FrameSuballocator::cleanup() {
+		if (buffer.isCreated()) {
+			ResourceAllocator::destroyBuffer(buffer);
+			buffer = Buffer{};
+		}
+	}
+
+	void FrameSuballocator::beginFrame(const uint32_t frameIndex) {
+		DEBUG_ASSERT(frameIndex < MAX_FRAMES_IN_FLIGHT);
+		this->frameIndex = frameIndex;
+		this->head = 0;
+	}
+
+	BufferRegion FrameSuballocator::allocate(const VkDeviceSize& size) {
+		// Lock-free bump, sizes are rounded up so every offset stays aligned.
+		VkDeviceSize offset = head.fetch_add(alignRegion(size, alignment), std::memory_order_relaxed);
+		if (offset + size > frameSize) {
+			throw std::runtime_error("Frame suballocator ran out of memory for the current frame.");
+		}
+
+		BufferRegion region{};
+		region.buffer = buffer;
+		region.offset = frameSize * frameIndex + offset;
+		region.size = size;
+		region.address = address != 0 ? address + region.offset : 0;
+		return region;
+	}
+
+	BufferRegion FrameSuballocator::push(const void* data, const VkDeviceSize& size) {
+		BufferRegion region = allocate(size);
+		memcpy(region.getMapped(), data, size);
+		return region;
+	}
+
+	void FrameSuballocator::flush() {
+		VkDeviceSize used = std::min(head.load(std::memory_order_relaxed), frameSize);
+		if (used > 0) {
+			ResourceAllocator::flushBuffer(buffer, frameSize * frameIndex, used);
+		}
+	}
+}
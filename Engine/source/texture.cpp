@@ -1,4 +1,5 @@
 #include <texture.h>
+#include <defragmenter.h>
 
 namespace core {
 
@@ -12,7 +13,13 @@ namespace core {
 		if (data == nullptr) {
 			ResourceAllocator::createImage2D(extent, format, mipLevels, image, usage);
 		} else {
-			ResourceAllocator::createAndStageImage2D(extent, format, mipLevels, data, image, usage);
+			// Sampled textures may be moved by the defragmenter, the view is recreated for the new image.
+			VkImageUsageFlags imageUsage = usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+			ResourceAllocator::createAndStageImage2D(extent, format, mipLevels, data, image, imageUsage);
+			Defragmenter::registerImage(image, extent, format, mipLevels, imageUsage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, [this]() {
+				ResourceAllocator::destroyImageView(view);
+				ResourceAllocator::createImageView2D(image.image, view, this->format, VK_IMAGE_ASPECT_COLOR_BIT);
+			});
 		}
 		ResourceAllocator::createImageView2D(image.image, view, format, VK_IMAGE_ASPECT_COLOR_BIT);
 		ResourceAllocator::createSampler2D(samplerAddressMode, enableAnisotropy, image.image, sampler);
@@ -23,6 +30,7 @@ namespace core {
 	}
 
 	void Texture::cleanup() {
+		Defragmenter::unregister(this->image.allocation);
 		ResourceAllocator::destroyImage(this->image);
 		ResourceAllocator::destroyImageView(this->view);
 		ResourceAllocator::destroySampler(this->sampler);